@@ -0,0 +1,720 @@
+#include <stdint.h>
+#include <string.h> /* memset */
+
+#include "apu.h"
+
+/* See: https://www.nesdev.org/wiki/APU
+ *
+ * NOTE: the APU is not clocked cycle by cycle. apu_run_until brings every
+ * channel from apu.time up to the given CPU cycle by jumping from one timer
+ * clock to the next, and only reports output level changes to blip. A
+ * channel that is silent doesn't even visit its timer clocks. */
+
+enum {
+	APU_PULSE1 = 0x4000,
+	APU_PULSE2 = 0x4004,
+	APU_TRIANGLE = 0x4008,
+	APU_NOISE = 0x400C,
+	APU_DMC = 0x4010,
+	APU_STATUS = 0x4015,
+	APU_FRAME_COUNTER = 0x4017
+};
+
+enum {
+	STATUS_PULSE1 = 0x01,
+	STATUS_PULSE2 = 0x02,
+	STATUS_TRIANGLE = 0x04,
+	STATUS_NOISE = 0x08,
+	STATUS_DMC = 0x10,
+	STATUS_FRAME_IRQ = 0x40,
+	STATUS_DMC_IRQ = 0x80
+};
+
+/* linear approximation of the APU mixer, scaled to ~27000 at full output.
+ * See: https://www.nesdev.org/wiki/APU_Mixer */
+enum {
+	PULSE_VOLUME = 241,
+	TRIANGLE_VOLUME = 272,
+	NOISE_VOLUME = 158,
+	DMC_VOLUME = 107
+};
+
+static const uint8_t
+length_table[32] = {
+	10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+	12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t
+duty_table[4][8] = {
+	{ 0, 1, 0, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 1, 1, 0, 0, 0 },
+	{ 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+static const uint16_t
+noise_periods[16] = {
+	4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+static const uint16_t
+dmc_periods[16] = {
+	428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+/* frame sequencer steps, CPU cycles since the start of the sequence */
+static const uint32_t
+frame_times[5] = { 7457, 14913, 22371, 29829, 37281 };
+
+static const uint32_t
+frame_periods[2] = { 29830, 37282 };
+
+/* frame_step of a $4017 write that hasn't taken effect yet */
+enum {
+	FRAME_STEP_RESET = 5
+};
+
+static inline int length_halted(uint8_t reg0)   { return reg0 & 0x20; }
+static inline int pulse_timer(const apu_pulse *p) { return p->regs[2] | (p->regs[3] & 0x07) << 8; }
+static inline int triangle_timer(const apu_triangle *t) { return t->regs[2] | (t->regs[3] & 0x07) << 8; }
+static inline int triangle_level(uint8_t phase) { return phase < 16 ? 15 - phase : phase - 16; }
+
+static inline void
+update_amp(apu *a, int *amp, int level, int volume, uint64_t time)
+{
+	int delta = level - *amp;
+
+	if (delta != 0) {
+		*amp = level;
+		blip_add_delta(&a->blip, (uint32_t)(time - a->frame_start), delta * volume);
+	}
+}
+
+static void
+irq_update(apu *a)
+{
+	bus_cpu_set_irq(a->bus, a->frame_irq || a->dmc.irq);
+}
+
+static int
+envelope_volume(const apu_envelope *e, uint8_t reg0)
+{
+	return (reg0 & 0x10) ? reg0 & 0x0F : e->decay;
+}
+
+static void
+envelope_clock(apu_envelope *e, uint8_t reg0)
+{
+	if (e->start) {
+		e->start = 0;
+		e->decay = 15;
+		e->divider = reg0 & 0x0F;
+		return;
+	}
+
+	if (e->divider > 0) {
+		e->divider--;
+		return;
+	}
+
+	e->divider = reg0 & 0x0F;
+
+	if (e->decay > 0) {
+		e->decay--;
+	} else if (length_halted(reg0)) {
+		e->decay = 15;
+	}
+}
+
+/* pulse 1 negates with ones' complement, pulse 2 with twos' complement */
+static int
+sweep_target(const apu_pulse *p, int channel)
+{
+	int period = pulse_timer(p);
+	int change = period >> (p->regs[1] & 0x07);
+
+	if (p->regs[1] & 0x08) {
+		return period - change - (channel == 0);
+	}
+
+	return period + change;
+}
+
+static int
+pulse_muted(const apu_pulse *p, int channel)
+{
+	return pulse_timer(p) < 8 || sweep_target(p, channel) > 0x7FF;
+}
+
+static void
+sweep_clock(apu_pulse *p, int channel)
+{
+	int target = sweep_target(p, channel);
+
+	if (p->sweep_divider == 0 && (p->regs[1] & 0x80) && (p->regs[1] & 0x07) && !pulse_muted(p, channel)) {
+		p->regs[2] = (uint8_t)(target & 0xFF);
+		p->regs[3] = (uint8_t)((p->regs[3] & 0xF8) | (target >> 8));
+	}
+
+	if (p->sweep_divider == 0 || p->sweep_reload) {
+		p->sweep_divider = (p->regs[1] >> 4) & 0x07;
+		p->sweep_reload = 0;
+	} else {
+		p->sweep_divider--;
+	}
+}
+
+static void
+pulse_run(apu *a, int channel, uint64_t from, uint64_t to)
+{
+	apu_pulse *p = &a->pulse[channel];
+	const uint8_t *duty = duty_table[p->regs[0] >> 6];
+	int period = (pulse_timer(p) + 1) * 2;
+	int volume = (p->length == 0 || pulse_muted(p, channel)) ? 0 : envelope_volume(&p->env, p->regs[0]);
+	uint64_t t = from + (uint64_t)p->delay;
+	uint64_t n;
+
+	update_amp(a, &p->amp, duty[p->phase] ? volume : 0, PULSE_VOLUME, from);
+
+	if (volume == 0) {
+		n = apu_clocks_until(t, to, period);
+		p->phase = (uint8_t)((p->phase + n) & 0x07);
+		t += n * (uint64_t)period;
+	} else {
+		for (; t < to; t += (uint64_t)period) {
+			p->phase = (p->phase + 1) & 0x07;
+			update_amp(a, &p->amp, duty[p->phase] ? volume : 0, PULSE_VOLUME, t);
+		}
+	}
+
+	p->delay = (int)(t - to);
+}
+
+static void
+triangle_run(apu *a, uint64_t from, uint64_t to)
+{
+	apu_triangle *tr = &a->triangle;
+	int period = triangle_timer(tr) + 1;
+	uint64_t t = from + (uint64_t)tr->delay;
+
+	update_amp(a, &tr->amp, triangle_level(tr->phase), TRIANGLE_VOLUME, from);
+
+	/* NOTE: ultrasonic periods are silenced instead of averaged */
+	if (tr->length == 0 || tr->linear == 0 || period < 3) {
+		t += apu_clocks_until(t, to, period) * (uint64_t)period;
+	} else {
+		for (; t < to; t += (uint64_t)period) {
+			tr->phase = (tr->phase + 1) & 0x1F;
+			update_amp(a, &tr->amp, triangle_level(tr->phase), TRIANGLE_VOLUME, t);
+		}
+	}
+
+	tr->delay = (int)(t - to);
+}
+
+static void
+noise_run(apu *a, uint64_t from, uint64_t to)
+{
+	apu_noise *ns = &a->noise;
+	int period = noise_periods[ns->regs[2] & 0x0F];
+	int tap = (ns->regs[2] & 0x80) ? 6 : 1;
+	int volume = ns->length ? envelope_volume(&ns->env, ns->regs[0]) : 0;
+	uint64_t t = from + (uint64_t)ns->delay;
+	uint16_t feedback;
+
+	update_amp(a, &ns->amp, (ns->lfsr & 0x1) ? 0 : volume, NOISE_VOLUME, from);
+
+	for (; t < to; t += (uint64_t)period) {
+		feedback = (ns->lfsr ^ (ns->lfsr >> tap)) & 0x1;
+		ns->lfsr = (uint16_t)((ns->lfsr >> 1) | (feedback << 14));
+
+		if (volume) {
+			update_amp(a, &ns->amp, (ns->lfsr & 0x1) ? 0 : volume, NOISE_VOLUME, t);
+		}
+	}
+
+	ns->delay = (int)(t - to);
+}
+
+static void
+dmc_restart(apu_dmc *d)
+{
+	d->addr = (uint16_t)(0xC000 + d->regs[2] * 64);
+	d->remaining = (uint16_t)(d->regs[3] * 16 + 1);
+}
+
+/* memory reader: the bus DMAs the byte at dmc.addr and hands it over */
+void
+apu_dmc_fill(apu *a, uint8_t val)
+{
+	apu_dmc *d = &a->dmc;
+
+	if (d->buffer_full || d->remaining == 0) {
+		return;
+	}
+
+	d->buffer = val;
+	d->buffer_full = 1;
+	d->addr = d->addr == 0xFFFF ? 0x8000 : d->addr + 1;
+	d->remaining--;
+
+	if (d->remaining == 0) {
+		if (d->regs[0] & 0x40) {
+			dmc_restart(d);
+		} else if (d->regs[0] & 0x80) {
+			d->irq = 1;
+			irq_update(a);
+		}
+	}
+}
+
+static void
+dmc_run(apu *a, uint64_t from, uint64_t to)
+{
+	apu_dmc *d = &a->dmc;
+	int period = dmc_periods[d->regs[0] & 0x0F];
+	uint64_t t = from + (uint64_t)d->delay;
+	uint64_t n;
+
+	update_amp(a, &d->amp, d->level, DMC_VOLUME, from);
+
+	if (d->silence && !d->buffer_full && d->remaining == 0) {
+		/* idle: only the bit counter keeps running */
+		n = apu_clocks_until(t, to, period);
+		d->bits = (uint8_t)((d->bits + 7 - (uint8_t)(n % 8)) % 8 + 1);
+		t += n * (uint64_t)period;
+		d->delay = (int)(t - to);
+		return;
+	}
+
+	for (; t < to; t += (uint64_t)period) {
+		if (!d->silence) {
+			if (d->shift & 0x1) {
+				if (d->level <= 125) {
+					d->level += 2;
+				}
+			} else if (d->level >= 2) {
+				d->level -= 2;
+			}
+
+			update_amp(a, &d->amp, d->level, DMC_VOLUME, t);
+		}
+
+		d->shift >>= 1;
+
+		if (--d->bits == 0) {
+			d->bits = 8;
+			d->silence = !d->buffer_full;
+
+			if (d->buffer_full) {
+				d->shift = d->buffer;
+				d->buffer_full = 0;
+			}
+		}
+	}
+
+	d->delay = (int)(t - to);
+}
+
+static void
+run_channels(apu *a, uint64_t to)
+{
+	int i;
+
+	if (to <= a->time) {
+		return;
+	}
+
+	pulse_run(a, 0, a->time, to);
+	pulse_run(a, 1, a->time, to);
+	triangle_run(a, a->time, to);
+	noise_run(a, a->time, to);
+	dmc_run(a, a->time, to);
+
+	for (i = 0; i < a->exp_count; i++) {
+		a->exp[i].ops->run(&a->exp[i], a, a->time, to);
+	}
+
+	a->time = to;
+}
+
+static void
+quarter_frame(apu *a)
+{
+	apu_triangle *tr = &a->triangle;
+
+	envelope_clock(&a->pulse[0].env, a->pulse[0].regs[0]);
+	envelope_clock(&a->pulse[1].env, a->pulse[1].regs[0]);
+	envelope_clock(&a->noise.env, a->noise.regs[0]);
+
+	if (tr->linear_reload) {
+		tr->linear = tr->regs[0] & 0x7F;
+	} else if (tr->linear > 0) {
+		tr->linear--;
+	}
+
+	if (!(tr->regs[0] & 0x80)) {
+		tr->linear_reload = 0;
+	}
+}
+
+static void
+half_frame(apu *a)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (a->pulse[i].length && !length_halted(a->pulse[i].regs[0])) {
+			a->pulse[i].length--;
+		}
+		sweep_clock(&a->pulse[i], i);
+	}
+
+	if (a->triangle.length && !(a->triangle.regs[0] & 0x80)) {
+		a->triangle.length--;
+	}
+
+	if (a->noise.length && !length_halted(a->noise.regs[0])) {
+		a->noise.length--;
+	}
+}
+
+static void
+frame_clock(apu *a)
+{
+	switch (a->frame_step) {
+		case FRAME_STEP_RESET:
+			a->frame_step = 0;
+			a->frame_next = a->frame_seq + frame_times[0];
+
+			if (a->frame_mode) {
+				quarter_frame(a);
+				half_frame(a);
+			}
+			return;
+		case 0:
+		case 2:
+			quarter_frame(a);
+			break;
+		case 1:
+			quarter_frame(a);
+			half_frame(a);
+			break;
+		case 3:
+			if (a->frame_mode) {
+				break; /* 5-step sequence does nothing here */
+			}
+
+			quarter_frame(a);
+			half_frame(a);
+
+			if (!a->frame_inhibit) {
+				a->frame_irq = 1;
+				irq_update(a);
+			}
+			break;
+		case 4:
+			quarter_frame(a);
+			half_frame(a);
+			break;
+	}
+
+	a->frame_step++;
+
+	if (a->frame_step == (a->frame_mode ? 5 : 4)) {
+		a->frame_step = 0;
+		a->frame_seq += frame_periods[a->frame_mode];
+	}
+
+	a->frame_next = a->frame_seq + frame_times[a->frame_step];
+}
+
+void
+apu_run_until(apu *a, uint64_t time)
+{
+	while (a->frame_next <= time) {
+		run_channels(a, a->frame_next);
+		frame_clock(a);
+	}
+
+	run_channels(a, time);
+}
+
+/* NOTE: the frame sequencer raises its IRQ at a time known in advance. Any
+ * register write can move it, so the caller has to ask again after each
+ * one. The DMC IRQ comes with the DMA of the last sample byte. */
+uint64_t
+apu_next_irq(const apu *a)
+{
+	if (!a->frame_mode && !a->frame_inhibit && !a->frame_irq) {
+		return a->frame_seq + frame_times[3];
+	}
+
+	return UINT64_MAX;
+}
+
+/* CPU cycle the memory reader needs the bus at: right away if the sample
+ * buffer is empty, otherwise as soon as the output unit empties it. A timer
+ * clock at t is run by apu_run_until(t + 1). */
+uint64_t
+apu_dmc_next_fetch(const apu *a)
+{
+	const apu_dmc *d = &a->dmc;
+	uint64_t period = dmc_periods[d->regs[0] & 0x0F];
+
+	if (d->remaining == 0) {
+		return UINT64_MAX;
+	}
+
+	if (!d->buffer_full) {
+		return a->time;
+	}
+
+	return a->time + (uint64_t)d->delay + (d->bits - 1u) * period + 1;
+}
+
+void
+apu_reset(apu *a, struct bus *bus, uint64_t time)
+{
+	memset(a, 0, sizeof(*a));
+
+	a->bus = bus;
+	a->time = time;
+	a->frame_start = time;
+	a->frame_seq = time;
+	a->frame_next = time + frame_times[0];
+	a->noise.lfsr = 1;
+	a->dmc.bits = 8;
+	a->dmc.silence = 1;
+
+	blip_init(&a->blip, APU_CLOCK_RATE, APU_SAMPLE_RATE);
+}
+
+void
+apu_end_frame(apu *a, uint64_t time)
+{
+	apu_run_until(a, time);
+	blip_end_frame(&a->blip, (uint32_t)(time - a->frame_start));
+	a->frame_start = time;
+}
+
+int
+apu_read_samples(apu *a, int16_t *out, int count)
+{
+	return blip_read_samples(&a->blip, out, count);
+}
+
+uint8_t
+apu_read_status(apu *a, uint64_t time)
+{
+	uint8_t res = 0;
+
+	apu_run_until(a, time);
+
+	res |= a->pulse[0].length ? STATUS_PULSE1 : 0;
+	res |= a->pulse[1].length ? STATUS_PULSE2 : 0;
+	res |= a->triangle.length ? STATUS_TRIANGLE : 0;
+	res |= a->noise.length ? STATUS_NOISE : 0;
+	res |= a->dmc.remaining ? STATUS_DMC : 0;
+	res |= a->frame_irq ? STATUS_FRAME_IRQ : 0;
+	res |= a->dmc.irq ? STATUS_DMC_IRQ : 0;
+
+	a->frame_irq = 0;
+	irq_update(a);
+
+	return res;
+}
+
+static void
+pulse_write(apu *a, int channel, uint16_t reg, uint8_t val)
+{
+	apu_pulse *p = &a->pulse[channel];
+
+	p->regs[reg] = val;
+
+	switch (reg) {
+		case 1:
+			p->sweep_reload = 1;
+			break;
+		case 3:
+			if (a->enabled & (STATUS_PULSE1 << channel)) {
+				p->length = length_table[val >> 3];
+			}
+			p->phase = 0;
+			p->env.start = 1;
+			break;
+	}
+}
+
+static void
+status_write(apu *a, uint8_t val)
+{
+	a->enabled = val;
+
+	if (!(val & STATUS_PULSE1)) {
+		a->pulse[0].length = 0;
+	}
+
+	if (!(val & STATUS_PULSE2)) {
+		a->pulse[1].length = 0;
+	}
+
+	if (!(val & STATUS_TRIANGLE)) {
+		a->triangle.length = 0;
+	}
+
+	if (!(val & STATUS_NOISE)) {
+		a->noise.length = 0;
+	}
+
+	if (!(val & STATUS_DMC)) {
+		a->dmc.remaining = 0;
+	} else if (a->dmc.remaining == 0) {
+		dmc_restart(&a->dmc);
+	}
+
+	a->dmc.irq = 0;
+	irq_update(a);
+}
+
+static void
+frame_counter_write(apu *a, uint64_t time, uint8_t val)
+{
+	a->frame_mode = (val >> 7) & 0x1;
+	a->frame_inhibit = (val >> 6) & 0x1;
+
+	if (a->frame_inhibit) {
+		a->frame_irq = 0;
+		irq_update(a);
+	}
+
+	/* NOTE: the sequencer restarts 3 cycles after a write on an APU cycle,
+	 * 4 after one between two. The 5-step clock comes with the restart. */
+	a->frame_seq = time + ((time & 0x1) ? 4 : 3);
+	a->frame_step = FRAME_STEP_RESET;
+	a->frame_next = a->frame_seq;
+}
+
+void
+apu_write(apu *a, uint64_t time, uint16_t addr, uint8_t val)
+{
+	apu_run_until(a, time);
+
+	if (addr < APU_PULSE2) {
+		pulse_write(a, 0, addr - APU_PULSE1, val);
+		return;
+	}
+
+	if (addr < APU_TRIANGLE) {
+		pulse_write(a, 1, addr - APU_PULSE2, val);
+		return;
+	}
+
+	switch (addr) {
+		case APU_TRIANGLE:
+		case APU_TRIANGLE + 1:
+		case APU_TRIANGLE + 2:
+			a->triangle.regs[addr - APU_TRIANGLE] = val;
+			break;
+		case APU_TRIANGLE + 3:
+			a->triangle.regs[3] = val;
+			if (a->enabled & STATUS_TRIANGLE) {
+				a->triangle.length = length_table[val >> 3];
+			}
+			a->triangle.linear_reload = 1;
+			break;
+		case APU_NOISE:
+		case APU_NOISE + 1:
+		case APU_NOISE + 2:
+			a->noise.regs[addr - APU_NOISE] = val;
+			break;
+		case APU_NOISE + 3:
+			a->noise.regs[3] = val;
+			if (a->enabled & STATUS_NOISE) {
+				a->noise.length = length_table[val >> 3];
+			}
+			a->noise.env.start = 1;
+			break;
+		case APU_DMC:
+			a->dmc.regs[0] = val;
+			if (!(val & 0x80)) {
+				a->dmc.irq = 0;
+				irq_update(a);
+			}
+			break;
+		case APU_DMC + 1:
+			a->dmc.regs[1] = val;
+			a->dmc.level = val & 0x7F;
+			break;
+		case APU_DMC + 2:
+		case APU_DMC + 3:
+			a->dmc.regs[addr - APU_DMC] = val;
+			break;
+		case APU_STATUS:
+			status_write(a, val);
+			break;
+		case APU_FRAME_COUNTER:
+			frame_counter_write(a, time, val);
+			break;
+	}
+}
+
+/* for expansion chips: report a new output level of one of their channels */
+void
+apu_output(apu *a, int *amp, int level, int volume, uint64_t time)
+{
+	update_amp(a, amp, level, volume, time);
+}
+
+/* chips is a mask of EXP_* bits, unsupported chips are ignored */
+void
+apu_attach(apu *a, uint8_t chips)
+{
+	static const struct {
+		uint8_t bit;
+		const expansion_ops *ops;
+	} supported[] = {
+		{ EXP_VRC6, &vrc6_ops },
+		{ EXP_N163, &n163_ops },
+		{ EXP_S5B, &s5b_ops }
+	};
+	size_t i;
+
+	a->exp_count = 0;
+	memset(a->exp, 0, sizeof(a->exp));
+
+	for (i = 0; i < sizeof(supported) / sizeof(supported[0]); i++) {
+		if (chips & supported[i].bit) {
+			a->exp[a->exp_count++].ops = supported[i].ops;
+		}
+	}
+}
+
+int
+apu_expansion_read(apu *a, uint64_t time, uint16_t addr, uint8_t *val)
+{
+	int i;
+
+	for (i = 0; i < a->exp_count; i++) {
+		if (a->exp[i].ops->read != NULL && a->exp[i].ops->read(&a->exp[i], a, time, addr, val)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* NOTE: NSF tunes may combine chips whose ports overlap, every chip that
+ * decodes the address gets the write */
+void
+apu_expansion_write(apu *a, uint64_t time, uint16_t addr, uint8_t val)
+{
+	int i;
+
+	apu_run_until(a, time);
+
+	for (i = 0; i < a->exp_count; i++) {
+		a->exp[i].ops->write(&a->exp[i], a, addr, val);
+	}
+}
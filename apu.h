@@ -0,0 +1,117 @@
+#ifndef NES_APU_H
+#define NES_APU_H
+
+#include <stdint.h>
+
+#include "blip.h"
+#include "expansion.h"
+
+enum {
+	APU_CLOCK_RATE = 1789773, /* NTSC CPU clock */
+	APU_SAMPLE_RATE = 96000, /* resampled to the host rate afterwards */
+	APU_MAX_EXPANSIONS = 3
+};
+
+/* NOTE: to use these functions we have to import bus.h, which includes
+ * this file. Therefore, we are using forward declaration (like ppu.h). */
+struct bus;
+void bus_cpu_set_irq(struct bus *, uint8_t);
+
+typedef struct {
+	uint8_t start;
+	uint8_t divider;
+	uint8_t decay;
+} apu_envelope;
+
+typedef struct {
+	uint8_t regs[4];
+	uint8_t length;
+	uint8_t phase;
+	uint8_t sweep_divider;
+	uint8_t sweep_reload;
+	apu_envelope env;
+	int delay; /* CPU cycles until the next timer clock */
+	int amp;   /* output level last sent to blip */
+} apu_pulse;
+
+typedef struct {
+	uint8_t regs[4];
+	uint8_t length;
+	uint8_t phase;
+	uint8_t linear;
+	uint8_t linear_reload;
+	int delay;
+	int amp;
+} apu_triangle;
+
+typedef struct {
+	uint8_t regs[4];
+	uint8_t length;
+	uint16_t lfsr;
+	apu_envelope env;
+	int delay;
+	int amp;
+} apu_noise;
+
+typedef struct {
+	uint8_t regs[4];
+	uint16_t addr;      /* address of the next sample byte */
+	uint16_t remaining; /* sample bytes left */
+	uint8_t buffer;
+	uint8_t buffer_full;
+	uint8_t shift;
+	uint8_t bits;
+	uint8_t silence;
+	uint8_t level;
+	uint8_t irq;
+	int delay;
+	int amp;
+} apu_dmc;
+
+typedef struct apu {
+	apu_pulse pulse[2];
+	apu_triangle triangle;
+	apu_noise noise;
+	apu_dmc dmc;
+
+	uint8_t enabled;     /* $4015 channel enable bits */
+	uint8_t frame_mode;  /* $4017 bit 7: 5-step sequence */
+	uint8_t frame_inhibit;
+	uint8_t frame_irq;
+	uint8_t frame_step;
+	uint64_t frame_next; /* CPU cycle of the next frame sequencer step */
+	uint64_t frame_seq;  /* CPU cycle the current sequence started at */
+
+	uint64_t time;        /* CPU cycle the APU has been run up to */
+	uint64_t frame_start; /* CPU cycle of blip time 0 */
+
+	expansion exp[APU_MAX_EXPANSIONS];
+	int exp_count;
+
+	blip blip;
+	struct bus *bus;
+} apu;
+
+/* number of timer clocks in [t, to) for a timer clocked every period cycles */
+static inline uint64_t
+apu_clocks_until(uint64_t t, uint64_t to, int period)
+{
+	return t < to ? (to - t + (uint64_t)period - 1) / (uint64_t)period : 0;
+}
+
+void apu_reset(apu *, struct bus *, uint64_t);
+void apu_run_until(apu *, uint64_t);
+uint64_t apu_next_irq(const apu *);
+uint64_t apu_dmc_next_fetch(const apu *);
+void apu_dmc_fill(apu *, uint8_t);
+void apu_end_frame(apu *, uint64_t);
+int apu_read_samples(apu *, int16_t *, int);
+uint8_t apu_read_status(apu *, uint64_t);
+void apu_write(apu *, uint64_t, uint16_t, uint8_t);
+
+void apu_attach(apu *, uint8_t);
+int apu_expansion_read(apu *, uint64_t, uint16_t, uint8_t *);
+void apu_expansion_write(apu *, uint64_t, uint16_t, uint8_t);
+void apu_output(apu *, int *, int, int, uint64_t);
+
+#endif /* NES_APU_H */
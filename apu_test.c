@@ -0,0 +1,426 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <string.h>
+
+#include "apu.c"
+#include "blip.c"
+#include "expansion.c"
+
+enum {
+	FRAME_CYCLES = 29781,
+	FRAMES = 20,
+	MAX_SAMPLES = 1024
+};
+
+struct bus {
+	uint8_t irq;
+};
+
+/* stands in for the bus DMA unit */
+static void
+dma(apu *a)
+{
+	uint16_t addr = a->dmc.addr;
+
+	apu_dmc_fill(a, (uint8_t)(addr * 131 + (addr >> 8)));
+}
+
+void
+bus_cpu_set_irq(struct bus *bus, uint8_t level)
+{
+	bus->irq = level;
+}
+
+static uint32_t seed;
+
+static uint32_t
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* the same random register access on both APUs, $4015 reads included */
+static void
+access(apu *a, apu *b, uint64_t time)
+{
+	static const uint16_t regs[] = {
+		0x4000, 0x4001, 0x4002, 0x4003, 0x4004, 0x4005, 0x4006, 0x4007,
+		0x4008, 0x400A, 0x400B, 0x400C, 0x400E, 0x400F,
+		0x4010, 0x4011, 0x4012, 0x4013, 0x4015, 0x4015, 0x4017
+	};
+	uint16_t addr = regs[rnd() % (sizeof(regs) / sizeof(regs[0]))];
+	uint8_t val = (uint8_t)rnd();
+
+	if (addr == 0x4015 && (val & 0x1)) {
+		apu_read_status(a, time);
+		apu_read_status(b, time);
+		return;
+	}
+
+	if (addr == 0x4015) {
+		val |= 0x1F;
+	} else if (addr == 0x4017) {
+		val &= rnd() & 0x1 ? 0x80 : 0x00;
+	} else if (addr == 0x4013) {
+		val &= 0x03;
+	}
+
+	apu_write(a, time, addr, val);
+	apu_write(b, time, addr, val);
+}
+
+/* NOTE: the reference clocks every channel timer on the cycle it is due,
+ * one CPU cycle at a time like the hardware, where apu_run_until jumps from
+ * clock to clock, skips silent channels and counts idle DMC bits. Register
+ * writes, $4015 reads and the frame sequencer are events, not catch-up, so
+ * the reference borrows them from apu.c: it keeps its registers in an apu
+ * whose time is pinned past every cycle, which leaves apu_run_until with
+ * nothing to do but the frame sequencer. */
+typedef struct {
+	apu a;
+	uint64_t next[5]; /* cycle of the next timer clock, per channel */
+} ref_apu;
+
+static void
+ref_reset(ref_apu *r, struct bus *bus)
+{
+	apu_reset(&r->a, bus, 0);
+	r->a.time = UINT64_MAX;
+	memset(r->next, 0, sizeof(r->next));
+}
+
+static int
+ref_pulse_level(const apu_pulse *p, int channel)
+{
+	if (p->length == 0 || pulse_muted(p, channel) || !duty_table[p->regs[0] >> 6][p->phase]) {
+		return 0;
+	}
+
+	return envelope_volume(&p->env, p->regs[0]);
+}
+
+static int
+ref_noise_level(const apu_noise *ns)
+{
+	return ns->length == 0 || (ns->lfsr & 0x1) ? 0 : envelope_volume(&ns->env, ns->regs[0]);
+}
+
+static void
+ref_dmc_clock(apu_dmc *d)
+{
+	if (!d->silence) {
+		if (d->shift & 0x1) {
+			if (d->level <= 125) {
+				d->level += 2;
+			}
+		} else if (d->level >= 2) {
+			d->level -= 2;
+		}
+	}
+
+	d->shift >>= 1;
+
+	if (--d->bits == 0) {
+		d->bits = 8;
+		d->silence = !d->buffer_full;
+
+		if (d->buffer_full) {
+			d->shift = d->buffer;
+			d->buffer_full = 0;
+		}
+	}
+}
+
+/* cycle t, after the events of t: output levels and the timer clocks due */
+static void
+ref_step(ref_apu *r, uint64_t t)
+{
+	apu *a = &r->a;
+	apu_triangle *tr = &a->triangle;
+	apu_noise *ns = &a->noise;
+	apu_dmc *d = &a->dmc;
+	uint16_t feedback;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		apu_pulse *p = &a->pulse[i];
+
+		update_amp(a, &p->amp, ref_pulse_level(p, i), PULSE_VOLUME, t);
+		if (t == r->next[i]) {
+			p->phase = (p->phase + 1) & 0x07;
+			r->next[i] = t + (uint64_t)(pulse_timer(p) + 1) * 2;
+			update_amp(a, &p->amp, ref_pulse_level(p, i), PULSE_VOLUME, t);
+		}
+	}
+
+	update_amp(a, &tr->amp, triangle_level(tr->phase), TRIANGLE_VOLUME, t);
+	if (t == r->next[2]) {
+		if (tr->length && tr->linear && triangle_timer(tr) >= 2) {
+			tr->phase = (tr->phase + 1) & 0x1F;
+		}
+		r->next[2] = t + (uint64_t)triangle_timer(tr) + 1;
+		update_amp(a, &tr->amp, triangle_level(tr->phase), TRIANGLE_VOLUME, t);
+	}
+
+	update_amp(a, &ns->amp, ref_noise_level(ns), NOISE_VOLUME, t);
+	if (t == r->next[3]) {
+		feedback = (ns->lfsr ^ (ns->lfsr >> ((ns->regs[2] & 0x80) ? 6 : 1))) & 0x1;
+		ns->lfsr = (uint16_t)((ns->lfsr >> 1) | (feedback << 14));
+		r->next[3] = t + noise_periods[ns->regs[2] & 0x0F];
+		update_amp(a, &ns->amp, ref_noise_level(ns), NOISE_VOLUME, t);
+	}
+
+	update_amp(a, &d->amp, d->level, DMC_VOLUME, t);
+	if (t == r->next[4]) {
+		ref_dmc_clock(d);
+		r->next[4] = t + dmc_periods[d->regs[0] & 0x0F];
+		update_amp(a, &d->amp, d->level, DMC_VOLUME, t);
+	}
+}
+
+Test(apu, catch_up_matches_per_cycle) {
+	static ref_apu reference;
+	static apu lazy;
+	apu *ref = &reference.a;
+	struct bus ref_bus = {0}, lazy_bus = {0};
+	int16_t ref_out[MAX_SAMPLES], lazy_out[MAX_SAMPLES];
+	uint64_t t, next_access = 1, deadline;
+	int f, ref_n, lazy_n, irqs = 0;
+
+	seed = 1;
+	ref_reset(&reference, &ref_bus);
+	apu_reset(&lazy, &lazy_bus, 0);
+	deadline = apu_next_irq(&lazy);
+
+	for (f = 0, t = 0; f < FRAMES; f++) {
+		for (; t < (uint64_t)(f + 1) * FRAME_CYCLES; t++) {
+			/* the memory reader refills an empty buffer at once */
+			if (!ref->dmc.buffer_full && ref->dmc.remaining) {
+				dma(ref);
+			}
+			apu_run_until(ref, t);
+
+			if (t >= deadline) {
+				apu_run_until(&lazy, t);
+				deadline = apu_next_irq(&lazy);
+			}
+
+			if (t >= apu_dmc_next_fetch(&lazy)) {
+				apu_run_until(&lazy, t);
+				dma(&lazy);
+			}
+
+			if (t == next_access) {
+				access(ref, &lazy, t);
+				deadline = apu_next_irq(&lazy);
+				next_access += 1 + rnd() % 600;
+			}
+
+			ref_step(&reference, t);
+
+			cr_assert(eq(u8, ref_bus.irq, lazy_bus.irq), "irq differs at cycle %lu", (unsigned long)t);
+			irqs += ref_bus.irq;
+
+			if (ref_bus.irq) {
+				apu_read_status(ref, t);
+				apu_read_status(&lazy, t);
+				deadline = apu_next_irq(&lazy);
+			}
+		}
+
+		apu_end_frame(ref, t);
+		apu_end_frame(&lazy, t);
+		deadline = apu_next_irq(&lazy);
+
+		ref_n = apu_read_samples(ref, ref_out, MAX_SAMPLES);
+		lazy_n = apu_read_samples(&lazy, lazy_out, MAX_SAMPLES);
+		cr_assert(eq(int, ref_n, lazy_n));
+		cr_assert(eq(int, memcmp(ref_out, lazy_out, (size_t)ref_n * sizeof(ref_out[0])), 0), "frame %d differs", f);
+	}
+
+	cr_assert(gt(int, irqs, 0));
+}
+
+/* a $4017 write restarts the sequencer 3 cycles later on an even cycle, 4
+ * on an odd one, and the 5-step clock waits for the restart */
+Test(apu, frame_counter_reset_delay) {
+	static apu a;
+	struct bus bus = {0};
+	uint64_t time;
+
+	for (time = 100; time < 102; time++) {
+		apu_reset(&a, &bus, 0);
+		apu_write(&a, 0, 0x4015, 0x01);
+		apu_write(&a, 0, 0x4000, 0x00);
+		apu_write(&a, 0, 0x4003, 0x08); /* length 254 */
+
+		apu_write(&a, time, 0x4017, 0x80);
+		apu_run_until(&a, time + (time & 0x1 ? 3 : 2));
+		cr_assert(eq(u8, a.pulse[0].length, 254), "write at %d", (int)time);
+		apu_run_until(&a, time + (time & 0x1 ? 4 : 3));
+		cr_assert(eq(u8, a.pulse[0].length, 253), "write at %d", (int)time);
+
+		apu_write(&a, 2 * time, 0x4017, 0x00);
+		cr_assert(eq(u64, apu_next_irq(&a), 2 * time + 3 + 29829));
+	}
+}
+
+/* sum and peak of the level a channel outputs on each of cycles [from, to) */
+static long
+level_sum(apu *a, const int *amp, uint64_t from, uint64_t to, int *peak)
+{
+	long sum = 0;
+	uint64_t t;
+
+	*peak = 0;
+	for (t = from; t < to; t++) {
+		apu_run_until(a, t + 1);
+		sum += *amp;
+		if (*amp > *peak) {
+			*peak = *amp;
+		}
+	}
+
+	return sum;
+}
+
+Test(expansion, vrc6) {
+	static apu a;
+	struct bus bus = {0};
+	vrc6 *v;
+	int peak, amp;
+
+	apu_reset(&a, &bus, 0);
+	apu_attach(&a, EXP_VRC6);
+	v = &a.exp[0].chip.vrc6;
+
+	/* pulse 1: duty 4/16, volume 15, 100 cycle steps */
+	apu_expansion_write(&a, 0, 0x9000, 0x3F);
+	apu_expansion_write(&a, 0, 0x9001, 99);
+	apu_expansion_write(&a, 0, 0x9002, 0x80);
+	/* saw: rate 8, 50 cycle steps, 14 steps to the period */
+	apu_expansion_write(&a, 0, 0xB000, 0x08);
+	apu_expansion_write(&a, 0, 0xB001, 49);
+	apu_expansion_write(&a, 0, 0xB002, 0x80);
+
+	cr_assert(eq(long, level_sum(&a, &v->pulse[0].amp, 0, 4 * 1600, &peak), 4 * 400 * 15));
+	cr_assert(eq(int, peak, 15));
+
+	/* 0,1,1,2,2,...,6,6,0: rate * 6 at the top, 42 per period */
+	cr_assert(eq(long, level_sum(&a, &v->saw.amp, 4 * 1600, 4 * 1600 + 2 * 700, &peak), 2 * 42 * 50));
+	cr_assert(eq(int, peak, 6));
+
+	/* halt freezes the saw, disabling silences the pulse */
+	apu_expansion_write(&a, 8000, 0x9003, 0x01);
+	apu_expansion_write(&a, 8000, 0x9002, 0x00);
+	amp = v->saw.amp;
+	cr_assert(eq(long, level_sum(&a, &v->saw.amp, 8000, 9000, &peak), 1000L * amp));
+	cr_assert(eq(long, level_sum(&a, &v->pulse[0].amp, 8000, 9000, &peak), 0));
+
+	/* x16 frequency: 99 >> 4 + 1 = 7 cycle steps, 112 to the period */
+	apu_expansion_write(&a, 9000, 0x9003, 0x02);
+	apu_expansion_write(&a, 9000, 0x9002, 0x80);
+	cr_assert(eq(long, level_sum(&a, &v->pulse[0].amp, 9200, 9200 + 10 * 112, &peak), 10 * 28 * 15));
+}
+
+static void
+s5b_set(apu *a, uint64_t time, uint8_t reg, uint8_t val)
+{
+	apu_expansion_write(a, time, 0xC000, reg);
+	apu_expansion_write(a, time, 0xE000, val);
+}
+
+Test(expansion, s5b) {
+	static apu a;
+	struct bus bus = {0};
+	s5b *s;
+	long sum;
+	int i, peak;
+
+	apu_reset(&a, &bus, 0);
+	apu_attach(&a, EXP_S5B);
+	s = &a.exp[0].chip.s5b;
+
+	s5b_set(&a, 0, 0, 10);   /* A: toggles every 16 * 10 cycles */
+	s5b_set(&a, 0, 1, 0);
+	s5b_set(&a, 0, 7, 0x3E); /* tone on A only, no noise */
+	s5b_set(&a, 0, 8, 12);
+	s5b_set(&a, 0, 9, 5);    /* B: tone off, a constant level */
+
+	cr_assert(eq(long, level_sum(&a, &s->amp[0], 0, 3200, &peak), 1600L * 90));
+	cr_assert(eq(int, peak, 90));
+	cr_assert(eq(long, level_sum(&a, &s->amp[1], 3200, 4200, &peak), 1000L * 8));
+	cr_assert(eq(long, level_sum(&a, &s->amp[2], 4200, 5200, &peak), 0));
+
+	/* C: enveloped, a single decay of 32 cycle steps, then silence */
+	s5b_set(&a, 5200, 10, 0x10);
+	s5b_set(&a, 5200, 11, 2);
+	s5b_set(&a, 5200, 12, 0);
+	s5b_set(&a, 5200, 13, 0x00);
+	sum = 0;
+	for (i = 0; i < 16; i++) {
+		sum += s5b_volumes[i];
+	}
+	cr_assert(eq(long, level_sum(&a, &s->amp[2], 5200, 5200 + 16 * 32, &peak), 32 * sum));
+	cr_assert(eq(int, peak, 255));
+	cr_assert(eq(long, level_sum(&a, &s->amp[2], 5200 + 16 * 32, 8000, &peak), 0));
+
+	/* ... a rising ramp held at the top */
+	s5b_set(&a, 8000, 13, 0x0D);
+	cr_assert(eq(long, level_sum(&a, &s->amp[2], 8000, 8000 + 16 * 32, &peak), 32 * sum));
+	cr_assert(eq(long, level_sum(&a, &s->amp[2], 8000 + 16 * 32, 9000, &peak), (9000 - 8000 - 16 * 32) * 255L));
+
+	/* B: noise only, on about half of the time */
+	s5b_set(&a, 9000, 6, 1);
+	s5b_set(&a, 9000, 7, 0x2F);
+	s5b_set(&a, 9000, 9, 15);
+	sum = level_sum(&a, &s->amp[1], 9000, 9000 + 1000 * 32, &peak);
+	cr_assert(eq(int, peak, 255));
+	cr_assert(gt(long, sum, 300L * 32 * 255));
+	cr_assert(lt(long, sum, 700L * 32 * 255));
+}
+
+static void
+n163_set(apu *a, uint64_t time, uint8_t addr, const uint8_t *val, int len)
+{
+	int i;
+
+	apu_expansion_write(a, time, 0xF800, (uint8_t)(0x80 | addr));
+	for (i = 0; i < len; i++) {
+		apu_expansion_write(a, time, 0x4800, val[i]);
+	}
+}
+
+Test(expansion, n163) {
+	static apu a;
+	struct bus bus = {0};
+	/* one channel: a sample a step, 16 sample ramp at 0, volume 15 */
+	static const uint8_t regs[8] = { 0x00, 0, 0x00, 0, 0xF1, 0, 0x00, 0x0F };
+	uint8_t wave[8], val;
+	n163 *n;
+	uint64_t t;
+	int k;
+
+	apu_reset(&a, &bus, 0);
+	apu_attach(&a, EXP_N163);
+	n = &a.exp[0].chip.n163;
+
+	for (k = 0; k < 8; k++) {
+		wave[k] = (uint8_t)(2 * k | (2 * k + 1) << 4);
+	}
+	n163_set(&a, 0, 0x00, wave, 8);
+	n163_set(&a, 0, 0x78, regs, 8);
+
+	/* the update at 15k plays sample k + 1 */
+	for (k = 0; k < 40; k++) {
+		apu_run_until(&a, (uint64_t)k * 15 + 1);
+		cr_assert(eq(int, n->amp, ((k + 1) % 16 - 8) * 15 * 4), "update %d", k);
+	}
+
+	/* reads see the phase the chip has written back by then */
+	apu_expansion_write(&a, 601, 0xF800, 0x7D);
+	t = 601 + 5 * 15 + 7;
+	cr_assert(eq(int, apu_expansion_read(&a, t, 0x4800, &val), 1));
+	cr_assert(eq(int, val, (int)((t + 14) / 15 % 16)));
+}
@@ -0,0 +1,90 @@
+#include <stdint.h>
+
+#include "raylib.h"
+
+#include "audio.h"
+#include "ring.h"
+
+/* NOTE: raylib pulls samples from its own thread through audio_callback.
+ * The emulation pushes a frame worth of samples into the ring and keeps
+ * it around AUDIO_TARGET_FILL by producing slightly more or fewer samples
+ * per frame (audio_rate_ratio), so the audio clock and the video clock
+ * never drift apart far enough to underrun or overflow. */
+
+enum {
+	AUDIO_RING_SIZE = 8192,
+	AUDIO_TARGET_FILL = 2048,  /* ~43 ms at 48 kHz */
+	AUDIO_DEVICE_BUFFER = 512,
+	AUDIO_FILL_SMOOTHING = 16  /* frames the fill level is averaged over */
+};
+
+static const double
+max_adjust = 0.005; /* +-0.5% */
+
+static AudioStream stream;
+
+static ring audio_ring;
+static int16_t audio_ring_buf[AUDIO_RING_SIZE];
+static int16_t audio_last;
+static double audio_fill = AUDIO_TARGET_FILL;
+
+/* runs on the raylib audio thread */
+static void
+audio_callback(void *buffer, unsigned int frames)
+{
+	int16_t *out = buffer;
+	size_t got = ring_read(&audio_ring, out, frames);
+
+	if (got > 0) {
+		audio_last = out[got - 1];
+	}
+
+	/* underrun: hold the last level instead of clicking back to zero */
+	for (; got < frames; got++) {
+		out[got] = audio_last;
+	}
+}
+
+void
+audio_destroy()
+{
+	UnloadAudioStream(stream);
+	CloseAudioDevice();
+}
+
+void
+audio_init(int sample_rate)
+{
+	ring_init(&audio_ring, audio_ring_buf, AUDIO_RING_SIZE);
+
+	InitAudioDevice();
+	SetAudioStreamBufferSizeDefault(AUDIO_DEVICE_BUFFER);
+	stream = LoadAudioStream((unsigned int)sample_rate, 16, 1);
+	SetAudioStreamCallback(stream, audio_callback);
+	PlayAudioStream(stream);
+}
+
+void
+audio_push(const int16_t *samples, int count)
+{
+	/* NOTE: whatever doesn't fit is dropped, rate control keeps it rare */
+	ring_write(&audio_ring, samples, (size_t)count);
+}
+
+/* how much faster than nominal the emulation should produce samples */
+double
+audio_rate_ratio(void)
+{
+	double error;
+
+	audio_fill += ((double)ring_count(&audio_ring) - audio_fill) / AUDIO_FILL_SMOOTHING;
+	error = (AUDIO_TARGET_FILL - audio_fill) / AUDIO_TARGET_FILL;
+
+	if (error > 1) {
+		error = 1;
+	} else if (error < -1) {
+		error = -1;
+	}
+
+	return 1 + error * max_adjust;
+}
@@ -0,0 +1,13 @@
+#ifndef NES_AUDIO_H
+#define NES_AUDIO_H
+
+#include <stdint.h>
+
+enum { AUDIO_SAMPLE_RATE = 48000 }; /* default host rate */
+
+void audio_destroy();
+void audio_init(int);
+void audio_push(const int16_t *, int);
+double audio_rate_ratio(void);
+
+#endif /* NES_AUDIO_H */
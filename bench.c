@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 199309L /* clock_gettime */
+
+#include <math.h>
+#include <stddef.h> /* offsetof */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "apu.h"
+#include "hash.h"
+#include "history.h"
+#include "resample.h"
+#include "state.h"
+
+/* NOTE: every benchmark does SECONDS seconds of emulated work and reports
+ * the wall time one emulated second costs, next to the 1000 ms a second
+ * of real time gives us. */
+
+enum {
+	SECONDS = 10,
+	FRAME_CYCLES = 29781,
+	FRAMES_PER_SECOND = 60,
+	FRAME_SAMPLES = 4096
+};
+
+void
+bus_cpu_set_irq(struct bus *bus, uint8_t level)
+{
+	(void)bus;
+	(void)level;
+}
+
+static double
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void
+report(const char *name, double ms)
+{
+	double per_second = ms / SECONDS;
+
+	printf("%-24s %9.3f ms/s %9.1fx realtime\n", name, per_second, 1000 / per_second);
+}
+
+/* all tonal channels playing, notes changing every frame */
+static void
+apu_play_frame(apu *a, uint64_t time, int frame)
+{
+	apu_write(a, time, 0x4015, 0x0F);
+	apu_write(a, time, 0x4000, 0xBF);
+	apu_write(a, time, 0x4002, (uint8_t)(0x80 + frame));
+	apu_write(a, time, 0x4003, 0x01);
+	apu_write(a, time, 0x4004, 0x7F);
+	apu_write(a, time, 0x4006, (uint8_t)(0x40 + frame * 3));
+	apu_write(a, time, 0x4007, 0x00);
+	apu_write(a, time, 0x4008, 0xFF);
+	apu_write(a, time, 0x400A, (uint8_t)(0x20 + frame));
+	apu_write(a, time, 0x400B, 0x01);
+	apu_write(a, time, 0x400C, 0x3F);
+	apu_write(a, time, 0x400E, (uint8_t)(frame & 0x0F));
+	apu_write(a, time, 0x400F, 0x00);
+}
+
+static void
+bench_apu(void)
+{
+	static apu a;
+	int16_t samples[FRAME_SAMPLES];
+	uint64_t t = 0;
+	double start;
+	int f;
+
+	apu_reset(&a, NULL, 0);
+	start = now_ms();
+
+	for (f = 0; f < SECONDS * FRAMES_PER_SECOND; f++) {
+		apu_play_frame(&a, t, f);
+		t += FRAME_CYCLES;
+		apu_end_frame(&a, t);
+		apu_read_samples(&a, samples, FRAME_SAMPLES);
+	}
+
+	report("apu + blip", now_ms() - start);
+}
+
+static void
+bench_resample(int quality, const char *name, int rate)
+{
+	static resampler r;
+	static int16_t in[APU_SAMPLE_RATE / FRAMES_PER_SECOND];
+	int16_t out[FRAME_SAMPLES];
+	char label[64];
+	double start;
+	int i, f;
+
+	for (i = 0; i < APU_SAMPLE_RATE / FRAMES_PER_SECOND; i++) {
+		in[i] = (int16_t)(8000 * sin(i * 0.05) + 4000 * sin(i * 0.71));
+	}
+
+	resample_init(&r, quality, APU_SAMPLE_RATE, rate);
+	start = now_ms();
+
+	for (f = 0; f < SECONDS * FRAMES_PER_SECOND; f++) {
+		resample_run(&r, in, APU_SAMPLE_RATE / FRAMES_PER_SECOND, out, FRAME_SAMPLES);
+	}
+
+	snprintf(label, sizeof(label), "resample %s %d", name, rate);
+	report(label, now_ms() - start);
+}
+
+/* NOTE: a busy game in a state sized block. Every frame rewrites a
+ * quarter of RAM, all of OAM and a stretch of APU/audio state. */
+static void
+bench_history(void)
+{
+	static history h;
+	static uint8_t snap[sizeof(state)];
+	uint32_t seed = 1;
+	double start, ms;
+	int f, i;
+
+	if (history_init(&h, sizeof(snap), 32 << 20) != 0) {
+		return;
+	}
+
+	start = now_ms();
+
+	for (f = 0; f < SECONDS * FRAMES_PER_SECOND; f++) {
+		for (i = 0; i < STATE_RAM_SIZE / 4; i++) {
+			seed = seed * 1103515245 + 12345;
+			snap[offsetof(state, ram) + (seed >> 16) % STATE_RAM_SIZE] = (uint8_t)(seed >> 8);
+		}
+		memset(snap + offsetof(state, ppu) + offsetof(r2C02, oam), f, OAM_SIZE);
+		memset(snap + offsetof(state, apu) + (size_t)(f % 64) * 64, f, 1024);
+		history_push(&h, snap);
+	}
+
+	ms = now_ms() - start;
+	report("rewind push", ms);
+	printf("%-24s %9.1f%% of a frame, %zu bytes per frame\n", "",
+	       ms / SECONDS / 10, history_used(&h) / h.count);
+
+	history_free(&h);
+}
+
+/* a state and a frame buffer, hashed every frame */
+static void
+bench_hash(void)
+{
+	static uint8_t snap[sizeof(state)];
+	static uint32_t frame[SCREEN_WIDTH * SCREEN_HEIGHT];
+	uint64_t h = 0;
+	double start, ms;
+	int f;
+
+	start = now_ms();
+
+	for (f = 0; f < SECONDS * FRAMES_PER_SECOND; f++) {
+		snap[(size_t)f % sizeof(snap)] = (uint8_t)f;
+		frame[f] = (uint32_t)h;
+		h ^= hash64(snap, sizeof(snap), 0);
+		h ^= hash64(frame, sizeof(frame), 0);
+	}
+
+	ms = now_ms() - start;
+	report("state + frame hash", ms);
+	printf("%-24s %9.1f us per frame (%016llx)\n", "",
+	       ms * 1e3 / (SECONDS * FRAMES_PER_SECOND), (unsigned long long)h);
+}
+
+int
+main(void)
+{
+	static const char *names[RESAMPLE_QUALITIES] = { "low", "medium", "high" };
+	int q;
+
+	bench_apu();
+
+	for (q = 0; q < RESAMPLE_QUALITIES; q++) {
+		bench_resample(q, names[q], 44100);
+		bench_resample(q, names[q], 48000);
+	}
+
+	bench_history();
+	bench_hash();
+
+	return 0;
+}
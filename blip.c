@@ -0,0 +1,138 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h> /* memset, memmove */
+
+#include "blip.h"
+
+enum {
+	HIGHPASS_SHIFT = 9 /* DC blocker, a few tens of Hz */
+};
+
+/* NOTE: kernel[phase] is a band-limited impulse (Blackman-windowed sinc)
+ * sampled at BLIP_WIDTH points, shifted by phase / BLIP_PHASES of a sample.
+ * Every row sums to exactly 1 << BLIP_KERNEL_BITS, so a step of N always
+ * integrates back to N and the buffer never drifts. */
+static int32_t
+blip_kernel[BLIP_PHASES][BLIP_WIDTH];
+
+static int
+blip_kernel_ready = 0;
+
+static void
+kernel_build(void)
+{
+	const double pi = 3.14159265358979323846;
+	const double cutoff = 0.90; /* fraction of the output Nyquist frequency */
+	double row[BLIP_WIDTH];
+	double x, sum;
+	int32_t total;
+	int p, k;
+
+	for (p = 0; p < BLIP_PHASES; p++) {
+		sum = 0;
+
+		for (k = 0; k < BLIP_WIDTH; k++) {
+			x = k - (BLIP_HALF_WIDTH - 1) - (double)p / BLIP_PHASES;
+			row[k] = x == 0 ? cutoff : sin(pi * cutoff * x) / (pi * x);
+			row[k] *= 0.42 + 0.5 * cos(pi * x / BLIP_HALF_WIDTH) + 0.08 * cos(2 * pi * x / BLIP_HALF_WIDTH);
+			sum += row[k];
+		}
+
+		total = 0;
+		for (k = 0; k < BLIP_WIDTH; k++) {
+			blip_kernel[p][k] = (int32_t)lround(row[k] / sum * (1 << BLIP_KERNEL_BITS));
+			total += blip_kernel[p][k];
+		}
+
+		/* put the rounding error into the biggest tap */
+		blip_kernel[p][BLIP_HALF_WIDTH - 1 + (p >= BLIP_PHASES / 2)] += (1 << BLIP_KERNEL_BITS) - total;
+	}
+
+	blip_kernel_ready = 1;
+}
+
+void
+blip_set_rates(blip *b, double clock_rate, double sample_rate)
+{
+	b->factor = (uint64_t)(sample_rate / clock_rate * (double)((uint64_t)1 << BLIP_FRAC_BITS));
+}
+
+void
+blip_clear(blip *b)
+{
+	b->offset = 0;
+	b->integrator = 0;
+	memset(b->buf, 0, sizeof(b->buf));
+}
+
+void
+blip_init(blip *b, double clock_rate, double sample_rate)
+{
+	if (!blip_kernel_ready) {
+		kernel_build();
+	}
+
+	blip_set_rates(b, clock_rate, sample_rate);
+	blip_clear(b);
+}
+
+/* time is in clocks since the start of the current frame */
+void
+blip_add_delta(blip *b, uint32_t time, int delta)
+{
+	uint64_t pos = time * b->factor + b->offset;
+	uint32_t idx = (uint32_t)(pos >> BLIP_FRAC_BITS);
+	const int32_t *k = blip_kernel[(pos >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+	int32_t *out;
+	int i;
+
+	if (delta == 0 || idx >= BLIP_BUF_SIZE) {
+		return; /* NOTE: frame too long for the buffer, the change is lost */
+	}
+
+	out = b->buf + idx;
+	for (i = 0; i < BLIP_WIDTH; i++) {
+		out[i] += k[i] * delta;
+	}
+}
+
+void
+blip_end_frame(blip *b, uint32_t clocks)
+{
+	b->offset += clocks * b->factor;
+}
+
+int
+blip_samples_avail(const blip *b)
+{
+	int avail = (int)(b->offset >> BLIP_FRAC_BITS);
+	return avail < BLIP_BUF_SIZE ? avail : BLIP_BUF_SIZE;
+}
+
+int
+blip_read_samples(blip *b, int16_t *out, int count)
+{
+	int64_t sum = b->integrator;
+	int32_t s;
+	int avail = blip_samples_avail(b);
+	int i;
+
+	if (count > avail) {
+		count = avail;
+	}
+
+	for (i = 0; i < count; i++) {
+		sum += b->buf[i];
+		s = (int32_t)(sum >> BLIP_KERNEL_BITS);
+		out[i] = (int16_t)(s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : s);
+		sum -= sum >> HIGHPASS_SHIFT;
+	}
+
+	b->integrator = sum;
+	b->offset -= (uint64_t)count << BLIP_FRAC_BITS;
+
+	memmove(b->buf, b->buf + count, (size_t)(BLIP_BUF_SIZE + BLIP_WIDTH - count) * sizeof(b->buf[0]));
+	memset(b->buf + BLIP_BUF_SIZE + BLIP_WIDTH - count, 0, (size_t)count * sizeof(b->buf[0]));
+
+	return count;
+}
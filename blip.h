@@ -0,0 +1,36 @@
+#ifndef NES_BLIP_H
+#define NES_BLIP_H
+
+#include <stdint.h>
+
+/* band-limited step synthesis buffer.
+ * Sources don't produce samples. They only report at which clock their
+ * output level changes and by how much (blip_add_delta). Each change is
+ * added as a windowed-sinc step, and reading integrates the buffer. */
+
+enum {
+	BLIP_FRAC_BITS = 32,
+	BLIP_PHASE_BITS = 5,
+	BLIP_PHASES = 1 << BLIP_PHASE_BITS,
+	BLIP_HALF_WIDTH = 8,
+	BLIP_WIDTH = BLIP_HALF_WIDTH * 2,
+	BLIP_KERNEL_BITS = 15,
+	BLIP_BUF_SIZE = 4096
+};
+
+typedef struct {
+	uint64_t factor;    /* output samples per clock, BLIP_FRAC_BITS fixed point */
+	uint64_t offset;    /* buffer position of clock 0 of the current frame */
+	int64_t integrator;
+	int32_t buf[BLIP_BUF_SIZE + BLIP_WIDTH];
+} blip;
+
+void blip_init(blip *, double, double);
+void blip_set_rates(blip *, double, double);
+void blip_clear(blip *);
+void blip_add_delta(blip *, uint32_t, int);
+void blip_end_frame(blip *, uint32_t);
+int blip_samples_avail(const blip *);
+int blip_read_samples(blip *, int16_t *, int);
+
+#endif /* NES_BLIP_H */
@@ -1,16 +1,65 @@
 #include <stdint.h>
-#include <stdio.h>  /* TODO: remove */
-#include <stdlib.h> /* exit */
+#include <stddef.h> /* NULL */
+#include <string.h> /* memset */
 
 #include "bus.h"
 
 void
-bus_init(bus *bus, r2A03 *cpu, r2C02 *ppu, uint8_t *ram, cartrige rom)
+bus_init(bus *bus, r2A03 *cpu, r2C02 *ppu, apu *apu, uint8_t *ram, cartrige rom)
 {
 	bus->cpu = cpu;
 	bus->ppu = ppu;
+	bus->apu = apu;
 	bus->ram = ram;
 	bus->rom = rom;
+	bus->rom.dirty = &bus->dirty;
+	if (ppu != NULL) {
+		ppu->dirty = &bus->dirty;
+	}
+	dirty_init(&bus->dirty);
+	sched_reset(&bus->sched);
+	bus->dma_oam_end = 0;
+	bus->ppu_time = 0;
+	memset(bus->pads, 0, sizeof(bus->pads));
+}
+
+/* APU deadlines move with every APU register access */
+static void
+apu_post(bus *b)
+{
+	sched_post(&b->sched, SCHED_APU, apu_next_irq(b->apu));
+	sched_post(&b->sched, SCHED_DMC, apu_dmc_next_fetch(b->apu));
+}
+
+void
+bus_apu_reset(bus *b)
+{
+	apu_reset(b->apu, b, b->cpu->total);
+	apu_attach(b->apu, cartrige_audio(&b->rom));
+	apu_post(b);
+}
+
+/* NOTE: the APU is only brought up to date when the CPU touches one of its
+ * registers, when an IRQ it may raise or a DMC fetch is due and at the end
+ * of a frame */
+void
+bus_apu_sync(bus *b)
+{
+	apu_run_until(b->apu, b->cpu->total);
+	apu_post(b);
+}
+
+void
+bus_apu_end_frame(bus *b)
+{
+	apu_end_frame(b->apu, b->cpu->total);
+	apu_post(b);
+}
+
+int
+bus_apu_read_samples(bus *b, int16_t *out, int count)
+{
+	return apu_read_samples(b->apu, out, count);
 }
 
 uint8_t
@@ -49,6 +98,12 @@ bus_cpu_trigger_nmi(bus *b)
 	cpu_trigger_nmi(b->cpu);
 }
 
+void
+bus_cpu_set_irq(bus *b, uint8_t level)
+{
+	cpu_set_irq(b->cpu, level);
+}
+
 
 uint8_t
 bus_ppu_get_frame_ready_flag(bus *b)
@@ -66,6 +121,7 @@ void
 bus_ppu_reset(bus *b)
 {
 	ppu_reset(b->ppu, b);
+	b->ppu_time = b->cpu->total;
 }
 
 void
@@ -74,45 +130,159 @@ bus_ppu_tick(bus *b)
 	ppu_tick(b->ppu);
 }
 
+/* NOTE: three dots a CPU cycle. The PPU runs behind the CPU and catches
+ * up when the CPU touches its registers or the cartrige it reads from,
+ * and at vblank (see nes_frame). */
+void
+bus_ppu_run_until(bus *b, uint64_t time)
+{
+	if (time > b->ppu_time) {
+		ppu_run(b->ppu, (int)(3 * (time - b->ppu_time)));
+		b->ppu_time = time;
+	}
+}
+
+/* the CPU gets to the PPU in the middle of its cycle, after the PPU has
+ * run the one before */
+static void
+ppu_catch_up(bus *b)
+{
+	if (b->ppu != NULL) {
+		bus_ppu_run_until(b, b->cpu->total - 1);
+	}
+}
+
+/* the CPU cycle whose dots start the next vblank */
+uint64_t
+bus_ppu_next_vblank(bus *b)
+{
+	return b->ppu_time + (uint64_t)(ppu_dots_to_vblank(b->ppu) + 2) / 3;
+}
+
+/* NOTE: the frontend latches the buttons once per frame, reads only shift
+ * them out */
+void
+bus_pad_set(bus *b, int port, uint8_t buttons)
+{
+	pad_set(&b->pads[port], buttons);
+}
+
+/* NOTE: DMA unit. It takes the bus away from the CPU, which is halted
+ * until the transfer is done. Transfers happen at once, only the stall is
+ * modelled. See: https://www.nesdev.org/wiki/DMA */
+
+/* OAM DMA copies a whole CPU page into OAM through OAMDATA. The CPU is
+ * halted for 513 cycles, plus one more if the DMA starts on an odd one. */
+void
+bus_dma_oam(bus *b, uint8_t page)
+{
+	uint16_t base = (uint16_t)(page << 8);
+	uint64_t cycles = 513 + (b->cpu->total & 1);
+	int i;
+
+	ppu_catch_up(b);
+	for (i = 0; i < OAM_SIZE; i++) {
+		ppu_write(b->ppu, 0x2004, bus_read(b, (uint16_t)(base + i)));
+	}
+
+	b->dma_oam_end = b->cpu->total + cycles;
+	cpu_stall(b->cpu, cycles);
+}
+
+/* DMC DMA fetches one sample byte for the APU, posted as SCHED_DMC at the
+ * cycle the sample buffer empties. It steals 4 cycles, or 2 when it lands
+ * in the middle of an OAM DMA that already halted the CPU. The extra
+ * controller read it causes is done by pad_port_read. */
+void
+bus_dma_dmc(bus *b)
+{
+	apu *a = b->apu;
+
+	apu_run_until(a, b->cpu->total);
+
+	if (apu_dmc_next_fetch(a) <= b->cpu->total) {
+		apu_dmc_fill(a, bus_read(b, a->dmc.addr));
+		cpu_stall(b->cpu, b->cpu->total < b->dma_oam_end ? 2 : 4);
+	}
+
+	apu_post(b);
+}
+
 void
 bus_ram_reset(bus *b)
 {
 	mem_reset(b->ram);
+	dirty_all(&b->dirty);
+}
+
+void
+bus_sched_run(bus *b)
+{
+	int id;
+
+	while ((id = sched_pop(&b->sched, b->cpu->total)) >= 0) {
+		switch (id) {
+			case SCHED_APU:
+				bus_apu_sync(b);
+				break;
+			case SCHED_DMC:
+				bus_dma_dmc(b);
+				break;
+		}
+	}
+}
+
+/* NOTE: the CPU reads on the last cycle of its instruction. A DMC fetch
+ * that halts it there makes it read the port again, which clocks the
+ * shift register once more and loses a bit. */
+static uint8_t
+pad_port_read(bus *b, pad *p)
+{
+	if (b->sched.when[SCHED_DMC] == b->cpu->total + b->cpu->stall - 1) {
+		pad_read(p);
+	}
+
+	return pad_read(p);
 }
 
 uint8_t
 bus_read(bus *b, uint16_t addr)
 {
+	uint8_t val;
+
 	if (addr < 0x2000) {
 		return b->ram[addr % 0x800];
 	}
 
 	if (addr < 0x4000) {
+		if (b->ppu == NULL) {
+			return 0; /* NSF player */
+		}
 		addr = 0x2000 + addr % 8; // TODO: create func for composing addr?
+		ppu_catch_up(b);
 		return ppu_read(b->ppu, addr);
 	}
 
 	if (addr == 0x4014) {
-		fprintf(stderr, "bus_read 0x4014 -> PPU OAM\n");
-		return 0;
+		return 0; /* write only */
 	}
 
 	if (addr == 0x4015) {
-		fprintf(stderr, "bus_read 0x4015 -> APU Register\n");
-		return 0;
+		val = apu_read_status(b->apu, b->cpu->total);
+		apu_post(b);
+		return val;
 	}
 	
-	if (addr == 0x4016) {
-		fprintf(stderr, "bus_read 0x4016 -> controller_1\n");
-		return 0;
-	}
-
-	if (addr == 0x4017) {
-		fprintf(stderr, "bus_read 0x4017 -> controller_2\n");
-		return 0;
+	/* NOTE: the upper bits are open bus, usually $40 from the address */
+	if (addr == 0x4016 || addr == 0x4017) {
+		return (uint8_t)(0x40 | pad_port_read(b, &b->pads[addr - 0x4016]));
 	}
 
-	if (addr >= 0x6000) {
+	if (addr >= 0x4020) {
+		if (b->apu->exp_count && apu_expansion_read(b->apu, b->cpu->total, addr, &val)) {
+			apu_post(b); /* the chip may have run the APU */
+			return val;
+		}
 		return bus_cartrige_read(b, addr);
 	}
 
@@ -123,17 +293,42 @@ void
 bus_write(bus *b, uint16_t addr, uint8_t val)
 {
 	// TODO: define addresses!
-	if (addr < 0x1FFF) {
-		b->ram[addr] = val; /* TODO: add check */
+	if (addr < 0x2000) {
+		b->ram[addr % 0x800] = val;
+		dirty_mark(&b->dirty, DIRTY_RAM, addr % 0x800);
 		return;
 	}
 
 	if (addr >= 0x2000 && addr <= 0x3FFF) {
-		ppu_write(b->ppu, addr, val);
+		if (b->ppu != NULL) {
+			ppu_catch_up(b);
+			ppu_write(b->ppu, addr, val);
+		}
+		return;
+	}
+
+	if (addr == 0x4014 && b->ppu != NULL) {
+		bus_dma_oam(b, val);
+		return;
+	}
+
+	if (addr == 0x4016) {
+		pad_write(&b->pads[0], val);
+		pad_write(&b->pads[1], val);
+		return;
+	}
+
+	if ((addr >= 0x4000 && addr <= 0x4013) || addr == 0x4015 || addr == 0x4017) {
+		apu_write(b->apu, b->cpu->total, addr, val);
+		apu_post(b);
+		return;
 	}
 	
-	if (addr >= 0x8000) {
-		fprintf(stderr, "trying to write to cartrige rom space\n"); /* TODO: remove */
-		exit(1); /* TODO: replace with assert? */
+	if (addr >= 0x4020) {
+		if (b->apu->exp_count) {
+			apu_expansion_write(b->apu, b->cpu->total, addr, val);
+		}
+		ppu_catch_up(b); /* bank switches change what it fetches */
+		bus_cartrige_write(b, addr, val);
 	}
 }
@@ -3,22 +3,34 @@
 
 #include <stdint.h>
 
+#include "apu.h"
 #include "cartrige.h"
 #include "cpu.h"
+#include "dirty.h"
 #include "mem.h"
+#include "pad.h"
 #include "ppu.h"
+#include "sched.h"
 
 typedef struct bus {
 	r2A03 *cpu;
 	r2C02 *ppu;
+	apu *apu;
 	uint8_t *ram;
 	cartrige rom; /* TODO: use pointer? */
+	sched sched;
+	uint64_t dma_oam_end; /* CPU cycle the running OAM DMA finishes at */
+	uint64_t ppu_time; /* CPU cycle the PPU has run up to */
+	pad pads[2];
+	dirty dirty; /* pages written since the last snapshot */
 } bus;
 
-void bus_init(bus *, r2A03 *, r2C02 *, uint8_t *, cartrige);
+void bus_init(bus *, r2A03 *, r2C02 *, apu *, uint8_t *, cartrige);
 
 void bus_apu_reset(bus *);
-void bus_apu_tick(bus *);
+void bus_apu_sync(bus *);
+void bus_apu_end_frame(bus *);
+int bus_apu_read_samples(bus *, int16_t *, int);
 
 uint8_t bus_cartrige_get_mirroring(bus *);
 uint8_t bus_cartrige_read(bus *, uint16_t );
@@ -27,14 +39,24 @@ void bus_cartrige_write(bus *, uint16_t, uint8_t);
 void bus_cpu_reset(bus *);
 void bus_cpu_tick(bus *);
 void bus_cpu_trigger_nmi(bus *);
+void bus_cpu_set_irq(bus *, uint8_t);
 
 uint8_t bus_ppu_get_frame_ready_flag(bus *);
 void bus_ppu_unset_frame_ready_flag(bus *);
 void bus_ppu_reset(bus *);
 void bus_ppu_tick(bus *);
+void bus_ppu_run_until(bus *, uint64_t);
+uint64_t bus_ppu_next_vblank(bus *);
+
+void bus_pad_set(bus *, int, uint8_t);
+
+void bus_dma_oam(bus *, uint8_t);
+void bus_dma_dmc(bus *);
 
 void bus_ram_reset(bus *);
 
+void bus_sched_run(bus *);
+
 uint8_t bus_read(bus *, uint16_t);
 void bus_write(bus *, uint16_t, uint8_t);
 
@@ -0,0 +1,35 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+
+#include "bus.h"
+
+/* bit 0 of $4016 read by a 4 cycle LDA starting at cycle 100, so on
+ * cycle 103, with the next DMC fetch at dmc */
+static uint8_t
+lda_4016(bus *b, uint64_t dmc)
+{
+	b->cpu->total = 100;
+	b->cpu->stall = 4;
+	sched_post(&b->sched, SCHED_DMC, dmc);
+
+	return bus_read(b, 0x4016) & 0x1;
+}
+
+Test(bus, dmc_fetch_on_pad_read)
+{
+	static r2A03 cpu;
+	static bus b;
+
+	b.cpu = &cpu;
+	sched_reset(&b.sched);
+
+	/* shifts out 1, 0, 1, 0, 0, ... */
+	pad_set(&b.pads[0], PAD_A | PAD_SELECT);
+	pad_write(&b.pads[0], 1);
+	pad_write(&b.pads[0], 0);
+
+	cr_assert(eq(u8, lda_4016(&b, 102), 1)); /* A, the fetch misses the read */
+	cr_assert(eq(u8, lda_4016(&b, 103), 1)); /* B is lost, SELECT */
+	cr_assert(eq(u8, lda_4016(&b, SCHED_NEVER), 0)); /* START */
+	cr_assert(eq(u8, b.pads[1].shift, 0)); /* the other port is left alone */
+}
@@ -1,49 +1,170 @@
+#define _POSIX_C_SOURCE 200112L /* mmap, ftruncate */
+
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h> /* memcpy */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cartrige.h"
+#include "hash.h"
+#include "romdb.h"
 
 enum {
 	PRG_ROM_BANK_SIZE = 0x4000,
 	CHR_ROM_BANK_SIZE = 0x2000,
 	CHR_RAM_BANK_SIZE = 0x2000,
+	PRG_RAM_BANK_SIZE = 0x2000 /* all of $6000-$7FFF */
 };
 
-static inline mirroring_type
-get_mirroring_type(uint8_t ctl)
+/* whole banks, at least one: NROM reads anywhere in the banks it sees */
+static uint32_t
+bank_round(uint32_t len, uint32_t bank)
 {
-	uint8_t mirroring = ctl & 0x1;
-
-	switch (mirroring) {
-		case 0x0:
-			return HORIZONTAL_MIRRORING;
-		case 0x1:
-			return VERTICAL_MIRRORING;
-		case 0x4:
-			return 0;
-		/* TODO: */
-	}
-
-	return INVALID_MIRRORING;
+	return len > bank ? (len + bank - 1) / bank * bank : bank;
 }
 
 static inline uint16_t
 get_addr_offset(const cartrige *c)
 {
-	if (c->prg_size > 1) {
+	if (c->prg_len > PRG_ROM_BANK_SIZE) {
 		return 0x7FFF;
 	}
 	return 0x3FFF;
 }
 
+/* mapper 0 (NROM) */
+static uint8_t
+nrom_read(const cartrige *c, uint16_t addr)
+{
+	/* we have to decide should we read CHR or PRG data */
+
+	if (addr <= 0x1FFF) {
+		return c->chr[addr];
+	}
+
+	if (addr >= 0x8000) {
+		addr &= get_addr_offset(c);
+		return c->prg[addr];
+	}
+
+	if (addr >= 0x6000) {
+		return c->prg_ram != NULL ? c->prg_ram[addr - 0x6000] : 0;
+	}
+
+	if (addr >= 0x4020) {
+		return 0; /* nothing on the expansion area */
+	}
+
+	fprintf(stderr, "ERROR: ILLEGAL READ FROM %04X\n", addr);
+	return 0; // TODO how can we handle this?
+}
+
+static void
+nrom_write(cartrige *c, uint16_t addr, uint8_t val)
+{
+	/* NOTE: no registers, the only things to write are CHR-RAM on boards
+	 * that have it instead of CHR ROM and PRG-RAM on those that have it */
+	if (addr <= 0x1FFF && c->chr_ram != NULL) {
+		c->chr_ram[addr] = val;
+		dirty_mark(c->dirty, DIRTY_CHR_RAM, addr);
+	} else if (addr >= 0x6000 && addr <= 0x7FFF && c->prg_ram != NULL) {
+		c->prg_ram[addr - 0x6000] = val;
+		dirty_mark(c->dirty, DIRTY_PRG_RAM, (uint32_t)(addr - 0x6000));
+		c->unsaved = 1;
+	}
+}
+
+static const mapper_ops
+nrom_ops = { nrom_read, nrom_write, NULL };
+
+/* rom.nes -> rom.sav, next to the ROM */
+static void
+sav_path(char *out, size_t size, const char *rom)
+{
+	const char *slash = strrchr(rom, '/');
+	const char *dot = strrchr(rom, '.');
+	int len = (int)strlen(rom);
+
+	if (dot != NULL && (slash == NULL || dot > slash)) {
+		len = (int)(dot - rom);
+	}
+
+	snprintf(out, size, "%.*s.sav", len, rom);
+}
+
+/* NOTE: battery-backed PRG-RAM is the save file itself, mapped shared.
+ * Writes cost nothing more than writes to memory and are in the page
+ * cache at once, so even a crash doesn't lose them; cartrige_flush only
+ * tells the kernel to get them to the disk. Returns NULL if the file
+ * can't be mapped, the game runs with plain RAM then. */
+static uint8_t *
+sav_map(const char *rom, uint32_t len)
+{
+	char path[4096];
+	struct stat st;
+	void *mem;
+	int fd;
+
+	sav_path(path, sizeof(path), rom);
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Can't open %s, the game won't be saved.\n", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) != 0 || (st.st_size < (off_t)len && ftruncate(fd, (off_t)len) != 0)) {
+		fprintf(stderr, "Can't grow %s, the game won't be saved.\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		fprintf(stderr, "Can't map %s, the game won't be saved.\n", path);
+		return NULL;
+	}
+
+	return mem;
+}
+
+/* NOTE: the header as read, with whatever the ROM database knows about
+ * this dump put over it. Old dumpers got mirroring, battery and the
+ * upper mapper nibble wrong often enough. */
+static int
+read_header(FILE *rom, const char *path, ines_info *info)
+{
+	struct ines_header header;
+
+	if (fread(&header, sizeof(uint8_t), INES_HEADER_SIZE, rom) != INES_HEADER_SIZE ||
+	    !is_valid_ines_tag(header.magic)) {
+		fprintf(stderr, "ROM is not an iNES image.\n");  /* TODO wrap */
+		return -1;
+	}
+
+	if (ines_parse(&header, info) != 0) {
+		fprintf(stderr, "%s: bad iNES header.\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
 cartrige
 cartrige_create(const char *path)
 {
 	FILE *rom = NULL;
-	struct ines_header header;
-	mirroring_type mirroring;
-	uint8_t *prg, *chr;
+	ines_info info;
+	const romdb_entry *known;
+	uint8_t trainer[INES_TRAINER_SIZE];
+	uint8_t *prg, *chr, *prg_ram = NULL;
+	uint32_t crc;
+	uint8_t battery = 0;
 
 	rom = fopen(path, "rb");
 	if (rom == NULL) {
@@ -53,53 +174,87 @@ cartrige_create(const char *path)
 		};
 	}
 
-	/* TODO */
-	/* extract contents of rom according to ines layout */
-
-	/* check ines tag */
-	fread(&header, sizeof(uint8_t), 16, rom);
-	if (!is_valid_ines_tag(header.magic)) {
+	if (read_header(rom, path, &info) != 0) {
 		fclose(rom);
-		fprintf(stderr, "ROM is not an iNES image.\n");  /* TODO wrap */
 		return (cartrige){
 			.invalid = 1
 		};
 	}
 
-	/* get mapper */
-	/* check ines version (1.0 / 2.0) */
-
-	/* get mirroring */
-	mirroring = get_mirroring_type(header.flags6);
-	if (mirroring == INVALID_MIRRORING) {
+	/* NOTE: the trainer comes before PRG and goes to $7000 */
+	if (info.trainer && fread(trainer, sizeof(uint8_t), INES_TRAINER_SIZE, rom) != INES_TRAINER_SIZE) {
 		fclose(rom);
-		fprintf(stderr, "Invalid mirroring type.\n");  /* TODO wrap */
+		fprintf(stderr, "%s: truncated trainer.\n", path);
 		return (cartrige){
 			.invalid = 1
 		};
 	}
 
 	/* allocate prg */
-	prg = calloc(header.prg_rom_size * PRG_ROM_BANK_SIZE, sizeof(uint8_t));
+	prg = calloc(bank_round(info.prg_rom, PRG_ROM_BANK_SIZE), sizeof(uint8_t));
 	if (!prg) {
 		exit(1);
 	}
 
-	/* allocate chr */
-	chr = calloc(header.chr_rom_size * CHR_ROM_BANK_SIZE, sizeof(uint8_t));
+	/* allocate chr, RAM if there is no ROM. NOTE: NROM sees 8 KB of
+	 * CHR-RAM whatever size the header asks for. */
+	chr = calloc(bank_round(info.chr_rom, CHR_ROM_BANK_SIZE), sizeof(uint8_t));
 	if (!chr) {
 		free(prg);
 		exit(1);
 	}
 
-	fread(prg, sizeof(uint8_t), header.prg_rom_size * PRG_ROM_BANK_SIZE, rom);
-	fread(chr, sizeof(uint8_t), header.chr_rom_size * CHR_ROM_BANK_SIZE, rom);
+	if (fread(prg, sizeof(uint8_t), info.prg_rom, rom) != info.prg_rom ||
+	    fread(chr, sizeof(uint8_t), info.chr_rom, rom) != info.chr_rom) {
+		fprintf(stderr, "%s: ROM is shorter than its header says.\n", path);
+	}
+	fclose(rom);
+
+	crc = crc32(0, prg, info.prg_rom);
+	crc = crc32(crc, chr, info.chr_rom);
+	known = romdb_find(crc);
+	if (known != NULL && romdb_apply(known, &info)) {
+		fprintf(stderr, "%s: header corrected from the ROM database (%s).\n", path, known->name);
+	}
+
+	if (info.mapper != 0) {
+		fprintf(stderr, "Mapper %d is not supported, running as NROM.\n", info.mapper);
+	}
+
+	/* NOTE: NROM sees 8 KB of PRG-RAM whatever the size, the trainer
+	 * needs some to be loaded into */
+	if (info.prg_ram + info.prg_nvram != 0 || info.trainer) {
+		if (info.battery) {
+			prg_ram = sav_map(path, PRG_RAM_BANK_SIZE);
+			battery = prg_ram != NULL;
+		}
+		if (prg_ram == NULL) {
+			prg_ram = calloc(PRG_RAM_BANK_SIZE, sizeof(uint8_t));
+		}
+		if (prg_ram == NULL) {
+			exit(1);
+		}
+		if (info.trainer) {
+			memcpy(prg_ram + 0x1000, trainer, INES_TRAINER_SIZE);
+		}
+	}
 
 	return (cartrige){
 		.prg = prg,
 		.chr = chr,
-		.prg_size = header.prg_rom_size,
-		.chr_size = header.chr_rom_size
+		.prg_len = info.prg_rom,
+		.chr_len = info.chr_rom,
+		.mirroring = info.mirroring,
+		.mapper = info.mapper,
+		.submapper = info.submapper,
+		.timing = info.timing,
+		.crc = crc,
+		.chr_ram = info.chr_rom ? NULL : chr,
+		.chr_ram_len = info.chr_rom ? 0 : CHR_RAM_BANK_SIZE,
+		.prg_ram = prg_ram,
+		.prg_ram_len = prg_ram != NULL ? PRG_RAM_BANK_SIZE : 0,
+		.battery = battery,
+		.ops = &nrom_ops
 	};
 }
 
@@ -109,41 +264,107 @@ cartrige_get_mirroring(const cartrige *c)
 	return c->mirroring;
 }
 
+uint8_t
+cartrige_audio(const cartrige *c)
+{
+	return c->ops->audio != NULL ? c->ops->audio(c) : 0;
+}
+
+/* identifies the ROM contents, the header doesn't count */
+uint64_t
+cartrige_hash(const cartrige *c)
+{
+	uint64_t h;
+
+	h = hash64(c->prg, c->prg_len, 0);
+	return hash64(c->chr, c->chr_len, h);
+}
+
 uint8_t
 cartrige_read(const cartrige *c, uint16_t addr)
 {
-	/* TODO: this is implementation only for mapper 0.
-	* Other mappers will have different implementation
-	* */
+	return c->ops->read(c, addr);
+}
 
-	/* we have to decide should we read CHR or PRG data */
+void
+cartrige_write(cartrige *c, uint16_t addr, uint8_t val)
+{
+	c->ops->write(c, addr, val);
+}
 
-	if (addr <= 0x1FFF) {
-		return c->chr[addr];
-	}
+/* a second cartrige for another console. ROM is shared, RAM is not. */
+cartrige
+cartrige_clone(const cartrige *c)
+{
+	cartrige clone = *c;
 
-	if (addr >= 0x6000) {
-		addr &= get_addr_offset(c);
-		return c->prg[addr];
+	clone.shared = 1;
+	clone.battery = 0; /* the save file is the first cartrige's */
+	if (c->prg_ram != NULL) {
+		clone.prg_ram = malloc(c->prg_ram_len);
+		if (clone.prg_ram == NULL) {
+			exit(1);
+		}
+		memcpy(clone.prg_ram, c->prg_ram, c->prg_ram_len);
+	}
+	if (c->chr_ram != NULL) {
+		clone.chr_ram = malloc(c->chr_ram_len);
+		if (clone.chr_ram == NULL) {
+			exit(1);
+		}
+		memcpy(clone.chr_ram, c->chr_ram, c->chr_ram_len);
+		clone.chr = clone.chr_ram;
 	}
 
-	fprintf(stderr, "ERROR: ILLEGAL READ FROM %04X\n", addr);
-	return 0; // TODO how can we handle this?
+	return clone;
 }
 
 void
-cartrige_write(cartrige *c, uint16_t addr, uint8_t val)
+cartrige_free(cartrige *c)
 {
-	/* TODO: this is implementation only for mapper 0.
-	* Other mappers will have different implementation
-	* */
+	if (!c->shared) {
+		free(c->prg);
+	}
+	if (!c->shared || c->chr_ram != NULL) {
+		free(c->chr); /* a clone's CHR-RAM is its own */
+	}
+	if (c->battery) {
+		msync(c->prg_ram, c->prg_ram_len, MS_SYNC);
+		munmap(c->prg_ram, c->prg_ram_len);
+	} else {
+		free(c->prg_ram);
+	}
+}
 
-	/* we have to decide should we write to CHR or PRG data */
+/* at frame boundaries: written PRG-RAM on its way to the disk */
+void
+cartrige_flush(cartrige *c)
+{
+	if (c->battery && c->unsaved) {
+		msync(c->prg_ram, c->prg_ram_len, MS_ASYNC);
+		c->unsaved = 0;
+	}
 }
 
+/* NOTE: PRG-RAM becomes a private copy and the save file is left alone
+ * from now on, for consoles whose games aren't the player's (forked
+ * searches, movies, netplay). */
 void
-cartrige_free(cartrige *c)
+cartrige_detach(cartrige *c)
 {
-	free(c->prg);
-	free(c->chr);
+	uint8_t *ram;
+
+	if (!c->battery) {
+		return;
+	}
+
+	ram = malloc(c->prg_ram_len);
+	if (ram == NULL) {
+		exit(1);
+	}
+	memcpy(ram, c->prg_ram, c->prg_ram_len);
+	munmap(c->prg_ram, c->prg_ram_len);
+
+	c->prg_ram = ram;
+	c->battery = 0;
 }
@@ -3,21 +3,52 @@
 
 #include <stdint.h>
 
+#include "dirty.h"
 #include "ines.h"
 
+typedef struct cartrige cartrige;
+
+/* NOTE: mapper vtable. Every access to cartrige space ($4020-$FFFF on the
+ * CPU bus, $0000-$1FFF on the PPU bus) goes through it. */
 typedef struct {
+	uint8_t (*read)(const cartrige *, uint16_t);
+	void (*write)(cartrige *, uint16_t, uint8_t);
+	uint8_t (*audio)(const cartrige *); /* EXP_* chips on board, NULL if none */
+} mapper_ops;
+
+struct cartrige {
 	uint8_t *prg; /* code section */
-	uint8_t *chr; /* graphics section */
-	uint8_t prg_size;
-	uint8_t chr_size;
+	uint8_t *chr; /* graphics section, chr_ram on boards without CHR ROM */
 	mirroring_type mirroring;
-	int mapper;
+	int mapper;     /* from the header, only NROM is emulated */
+	int submapper;
+	ines_timing timing;
+	uint32_t crc;   /* CRC32 of PRG + CHR ROM */
 	int invalid;
-} cartrige;
+
+	const mapper_ops *ops;
+	uint8_t *prg_ram;  /* $6000-$7FFF, NULL if the board has none */
+	uint32_t prg_ram_len;
+	uint8_t battery;   /* prg_ram is the .sav file, mapped */
+	uint8_t unsaved;   /* written since the last flush */
+	uint32_t prg_len;  /* bytes in prg, for mappers that bank it */
+	uint32_t chr_len;  /* bytes of CHR ROM, 0 if it is RAM */
+	uint8_t *chr_ram;  /* NULL if the board has CHR ROM */
+	uint32_t chr_ram_len;
+	uint8_t banks[8];  /* bank registers, meaning depends on the mapper */
+	uint8_t chips;     /* expansion audio of boards that vary (NSF) */
+	uint8_t shared;    /* prg/chr belong to the cartrige this was cloned from */
+	dirty *dirty;      /* of the bus it is plugged into */
+};
 
 cartrige cartrige_create(const char *);
+cartrige cartrige_clone(const cartrige *);
 void cartrige_free(cartrige *);
+void cartrige_flush(cartrige *);
+void cartrige_detach(cartrige *);
 uint8_t cartrige_get_mirroring(const cartrige *);
+uint8_t cartrige_audio(const cartrige *);
+uint64_t cartrige_hash(const cartrige *);
 uint8_t cartrige_read(const cartrige *, uint16_t);
 void cartrige_write(cartrige *, uint16_t, uint8_t);
 
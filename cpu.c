@@ -58,7 +58,7 @@ static uint16_t read16(r2A03 *);
 static uint8_t getflag(r2A03 *, uint8_t);
 static uint8_t get_c(r2A03 *);
 static uint8_t get_z(r2A03 *);
-/* static uint8_t get_i(r2A03 *); */
+static uint8_t get_i(r2A03 *);
 static uint8_t get_v(r2A03 *);
 static uint8_t get_n(r2A03 *);
 
@@ -594,13 +594,11 @@ get_n(r2A03 *cpu)
 	return getflag(cpu, MASK_NEGATIVE);
 }
 
-/*
 static uint8_t
 get_i(r2A03 *cpu)
 {
 	return getflag(cpu, MASK_INTERRUPT_DISABLE);
 }
-*/
 
 /*
 static uint8_t
@@ -787,15 +785,13 @@ poll_interrupts(r2A03 *cpu)
 {
 	if (cpu->nmi) {
 		handle_nmi(cpu);
-		cpu->stall += 7;
 		cpu->nmi = 0;
 		return;
 	}
 
-	if (cpu->irq) {
+	/* NOTE: IRQ is level triggered, the source clears the line */
+	if (cpu->irq && !get_i(cpu)) {
 		handle_irq(cpu);
-		cpu->stall += 7;
-		cpu->irq = 0;
 		return;
 	}
 }
@@ -805,6 +801,7 @@ handle_irq(r2A03 *cpu)
 {
 	push16(cpu, cpu->PC);
 	push8(cpu, cpu->P);
+	set_i(cpu);
 	cpu->stall += 7;
 	cpu->PC = get16_addr(cpu, VECTOR_IRQ);
 }
@@ -814,6 +811,7 @@ handle_nmi(r2A03 *cpu)
 {
 	push16(cpu, cpu->PC);
 	push8(cpu, cpu->P);
+	set_i(cpu);
 	cpu->stall += 7;
 	cpu->PC = get16_addr(cpu, VECTOR_NMI);
 }
@@ -1543,12 +1541,66 @@ cpu_tick(r2A03 *cpu)
 	optable[cpu->opcode].func(cpu);
 }
 
+/* NOTE: makes the CPU JSR to addr from ret: the subroutine's RTS lands on
+ * ret. Only valid between instructions. Used by the NSF player. */
+void
+cpu_call(r2A03 *cpu, uint16_t addr, uint16_t ret)
+{
+	push16(cpu, (uint16_t)(ret - 1));
+	cpu->PC = addr;
+}
+
+/* true when the next tick starts the instruction at PC */
+int
+cpu_at_boundary(const r2A03 *cpu)
+{
+	return cpu->stall <= 1;
+}
+
+/* lets cycles pass without running instructions */
+void
+cpu_skip_until(r2A03 *cpu, uint64_t total)
+{
+	if (total > cpu->total) {
+		cpu->total = total;
+		cpu->stall = 1;
+	}
+}
+
+/* lets the cycles left of the running instruction pass, at most until
+ * total, without ticking through them */
+void
+cpu_idle_until(r2A03 *cpu, uint64_t total)
+{
+	uint64_t idle = cpu->stall > 1 ? cpu->stall - 1 : 0;
+
+	if (total <= cpu->total) {
+		return;
+	}
+
+	idle = idle < total - cpu->total ? idle : total - cpu->total;
+	cpu->total += idle;
+	cpu->stall -= idle;
+}
+
+void
+cpu_stall(r2A03 *cpu, uint64_t cycles)
+{
+	cpu->stall += cycles;
+}
+
 void
 cpu_trigger_nmi(r2A03 *cpu)
 {
 	cpu->nmi = 1;
 }
 
+void
+cpu_set_irq(r2A03 *cpu, uint8_t level)
+{
+	cpu->irq = level;
+}
+
 typedef union {
 	struct {
 		uint8_t lo;
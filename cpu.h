@@ -23,8 +23,14 @@ typedef struct {
 	struct bus *bus;
 } r2A03;
 
+void cpu_call(r2A03 *, uint16_t, uint16_t);
+int cpu_at_boundary(const r2A03 *);
 void cpu_reset(r2A03 *, struct bus *);
+void cpu_skip_until(r2A03 *, uint64_t);
+void cpu_idle_until(r2A03 *, uint64_t);
+void cpu_stall(r2A03 *, uint64_t);
 void cpu_tick(r2A03 *);
 void cpu_trigger_nmi(r2A03 *);
+void cpu_set_irq(r2A03 *, uint8_t);
 
 #endif /* NES_CPU_H */
@@ -140,3 +140,35 @@ Test(cpu, stx_zpg) {
 	cpu_tick(&cpu);
 	cr_assert(eq(u8, bus_read(cpu.bus, 0x10), cpu.X));
 }
+
+/* 7 cycles to take the interrupt, then the handler's first NOP */
+static void
+interrupt_cycles(uint16_t vector, uint8_t nmi, uint8_t irq)
+{
+	r2A03 cpu = {0};
+	uint8_t dummy_rom[] = {0xEA}; /* 0xEA - NOP */
+
+	load_dummy_rom(cpu.bus, dummy_rom, 1);
+	bus_write(cpu.bus, 0x9000, 0xEA);
+	bus_write(cpu.bus, vector, 0x00);
+	bus_write(cpu.bus, vector + 1, 0x90);
+	write_dummy_reset(cpu.bus, 0x8000);
+
+	cpu_reset(&cpu, cpu.bus);
+	cpu.P = 0x20;
+	cpu.nmi = nmi;
+	cpu.irq = irq;
+	cpu.stall = 1;
+
+	cpu_tick(&cpu);
+	cr_assert(eq(u16, cpu.PC, 0x9001));
+	cr_assert(eq(u64, cpu.stall, 7 + 2));
+}
+
+Test(cpu, irq_cycles) {
+	interrupt_cycles(VECTOR_IRQ, 0, 1);
+}
+
+Test(cpu, nmi_cycles) {
+	interrupt_cycles(VECTOR_NMI, 1, 0);
+}
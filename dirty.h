@@ -0,0 +1,56 @@
+#ifndef NES_DIRTY_H
+#define NES_DIRTY_H
+
+#include <stdint.h>
+
+/* NOTE: write tracking for the console's memories in 256 byte pages.
+ * A write stamps its page with the current epoch; taking a snapshot ends
+ * the epoch. A snapshot taken at epoch e is up to date except for the
+ * pages stamped after e, so it can be refreshed by copying just those
+ * (see state_update). */
+enum {
+	DIRTY_RAM,
+	DIRTY_VRAM,
+	DIRTY_PRG_RAM,
+	DIRTY_CHR_RAM,
+	DIRTY_REGIONS
+};
+
+enum {
+	DIRTY_PAGE_SHIFT = 8,
+	DIRTY_PAGE_SIZE = 1 << DIRTY_PAGE_SHIFT,
+	DIRTY_MAX_PAGES = 0x8000 >> DIRTY_PAGE_SHIFT /* largest region, PRG-RAM */
+};
+
+typedef struct dirty {
+	uint32_t epoch; /* starts at 1, 0 is before any snapshot */
+	uint32_t pages[DIRTY_REGIONS][DIRTY_MAX_PAGES];
+} dirty;
+
+static inline void
+dirty_mark(dirty *d, int region, uint32_t addr)
+{
+	d->pages[region][addr >> DIRTY_PAGE_SHIFT] = d->epoch;
+}
+
+/* everything changed, after a reset or a state load */
+static inline void
+dirty_all(dirty *d)
+{
+	int r, p;
+
+	for (r = 0; r < DIRTY_REGIONS; r++) {
+		for (p = 0; p < DIRTY_MAX_PAGES; p++) {
+			d->pages[r][p] = d->epoch;
+		}
+	}
+}
+
+static inline void
+dirty_init(dirty *d)
+{
+	d->epoch = 1;
+	dirty_all(d);
+}
+
+#endif /* NES_DIRTY_H */
@@ -0,0 +1,449 @@
+#include <stddef.h> /* NULL */
+#include <stdint.h>
+
+#include "apu.h"
+#include "expansion.h"
+
+/* output weights, chosen so that a full volume channel is about as loud
+ * as a full volume APU pulse */
+enum {
+	VRC6_PULSE_VOLUME = 241,
+	VRC6_SAW_VOLUME = 117,
+	S5B_VOLUME = 14,
+	N163_VOLUME = 8
+};
+
+/* Konami VRC6. See: https://www.nesdev.org/wiki/VRC6_audio */
+
+static inline int
+vrc6_period(const vrc6 *v, const vrc6_channel *c)
+{
+	return ((c->regs[1] | (c->regs[2] & 0x0F) << 8) >> v->shift) + 1;
+}
+
+static inline int
+vrc6_pulse_level(const vrc6_channel *c)
+{
+	int duty = (c->regs[0] >> 4) & 0x07;
+
+	if (!(c->regs[2] & 0x80)) {
+		return 0;
+	}
+
+	return (c->regs[0] & 0x80) || c->step <= duty ? c->regs[0] & 0x0F : 0;
+}
+
+static void
+vrc6_pulse_run(vrc6 *v, apu *a, vrc6_channel *c, uint64_t from, uint64_t to)
+{
+	int period = vrc6_period(v, c);
+	uint64_t t = from + (uint64_t)c->delay;
+	uint64_t n;
+
+	apu_output(a, &c->amp, vrc6_pulse_level(c), VRC6_PULSE_VOLUME, from);
+
+	if (!(c->regs[2] & 0x80) || v->halt) {
+		return; /* timer stopped */
+	}
+
+	if ((c->regs[0] & 0x80) || (c->regs[0] & 0x0F) == 0) {
+		/* the duty step doesn't change the output */
+		n = apu_clocks_until(t, to, period);
+		c->step = (uint8_t)((c->step - n) & 0x0F);
+		t += n * (uint64_t)period;
+	} else {
+		for (; t < to; t += (uint64_t)period) {
+			c->step = (c->step - 1) & 0x0F;
+			apu_output(a, &c->amp, vrc6_pulse_level(c), VRC6_PULSE_VOLUME, t);
+		}
+	}
+
+	c->delay = (int)(t - to);
+}
+
+static void
+vrc6_saw_run(vrc6 *v, apu *a, uint64_t from, uint64_t to)
+{
+	vrc6_channel *c = &v->saw;
+	int period = vrc6_period(v, c);
+	uint64_t t = from + (uint64_t)c->delay;
+
+	apu_output(a, &c->amp, (c->regs[2] & 0x80) ? v->accum >> 3 : 0, VRC6_SAW_VOLUME, from);
+
+	if (!(c->regs[2] & 0x80) || v->halt) {
+		return;
+	}
+
+	/* the accumulator grows on every other clock and is reset on the 14th */
+	for (; t < to; t += (uint64_t)period) {
+		if (++c->step == 14) {
+			c->step = 0;
+			v->accum = 0;
+		} else if (!(c->step & 0x1)) {
+			v->accum = (uint8_t)(v->accum + (c->regs[0] & 0x3F));
+		}
+
+		apu_output(a, &c->amp, v->accum >> 3, VRC6_SAW_VOLUME, t);
+	}
+
+	c->delay = (int)(t - to);
+}
+
+static void
+vrc6_run(expansion *e, apu *a, uint64_t from, uint64_t to)
+{
+	vrc6 *v = &e->chip.vrc6;
+
+	vrc6_pulse_run(v, a, &v->pulse[0], from, to);
+	vrc6_pulse_run(v, a, &v->pulse[1], from, to);
+	vrc6_saw_run(v, a, from, to);
+}
+
+static int
+vrc6_write(expansion *e, apu *a, uint16_t addr, uint8_t val)
+{
+	vrc6 *v = &e->chip.vrc6;
+	vrc6_channel *c;
+	int reg = addr & 0x03;
+
+	switch (addr & 0xF000) {
+		case 0x9000:
+			if (reg == 3) {
+				/* bit 2 (x256 frequency) wins over bit 1 (x16) */
+				v->halt = val & 0x01;
+				v->shift = (val & 0x04) ? 8 : (val & 0x02) ? 4 : 0;
+				return 1;
+			}
+			c = &v->pulse[0];
+			break;
+		case 0xA000:
+			c = &v->pulse[1];
+			break;
+		case 0xB000:
+			c = &v->saw;
+			break;
+		default:
+			return 0;
+	}
+
+	if (reg == 3) {
+		return 0;
+	}
+
+	c->regs[reg] = val;
+
+	/* disabling a channel resets its sequencer */
+	if (reg == 2 && !(val & 0x80)) {
+		c->step = c == &v->saw ? 0 : 15;
+		if (c == &v->saw) {
+			v->accum = 0;
+		}
+	}
+
+	(void)a;
+	return 1;
+}
+
+const expansion_ops
+vrc6_ops = { NULL, vrc6_write, vrc6_run };
+
+/* Sunsoft 5B. See: https://www.nesdev.org/wiki/Sunsoft_5B_audio
+ * NOTE: the envelope is modelled with 16 steps per ramp, as on the
+ * AY-3-8910 */
+
+/* 3 dB per volume step */
+static const uint8_t
+s5b_volumes[16] = { 0, 2, 3, 4, 6, 8, 11, 16, 23, 32, 45, 64, 90, 128, 180, 255 };
+
+enum {
+	S5B_ENV_HOLD = 0x01,
+	S5B_ENV_ALTERNATE = 0x02,
+	S5B_ENV_ATTACK = 0x04,
+	S5B_ENV_CONTINUE = 0x08
+};
+
+static inline int
+s5b_tone_period(const s5b *s, int i)
+{
+	int period = s->regs[i * 2] | (s->regs[i * 2 + 1] & 0x0F) << 8;
+
+	return 16 * (period ? period : 1);
+}
+
+static inline int
+s5b_noise_period(const s5b *s)
+{
+	int period = s->regs[6] & 0x1F;
+
+	return 32 * (period ? period : 1);
+}
+
+static inline int
+s5b_env_period(const s5b *s)
+{
+	int period = s->regs[11] | s->regs[12] << 8;
+
+	return 16 * (period ? period : 1);
+}
+
+static inline int
+s5b_level(const s5b *s, int i)
+{
+	uint8_t vol = s->regs[8 + i];
+	int tone = s->out[i] || (s->regs[7] & (1 << i));
+	int noise = (s->noise & 0x1) || (s->regs[7] & (8 << i));
+
+	if (!tone || !noise) {
+		return 0;
+	}
+
+	if (vol & 0x10) {
+		return s5b_volumes[s->env_attack ? s->env_step : 15 - s->env_step];
+	}
+
+	return s5b_volumes[vol & 0x0F];
+}
+
+/* XNOR feedback from bits 0 and 3: the all-zero reset state is a valid
+ * one, all ones would lock up instead */
+static inline void
+s5b_noise_step(s5b *s)
+{
+	uint32_t bit = ~(s->noise ^ s->noise >> 3) & 0x1;
+
+	s->noise = (s->noise >> 1) | bit << 16;
+}
+
+static void
+s5b_env_step(s5b *s)
+{
+	uint8_t shape = s->regs[13];
+
+	if (s->env_held || ++s->env_step < 16) {
+		return;
+	}
+
+	/* end of a ramp */
+	s->env_step = 15;
+	if (!(shape & S5B_ENV_CONTINUE)) {
+		s->env_attack = 0; /* silent from now on */
+		s->env_held = 1;
+	} else if (shape & S5B_ENV_HOLD) {
+		s->env_attack ^= (shape & S5B_ENV_ALTERNATE) ? 1 : 0;
+		s->env_held = 1;
+	} else {
+		s->env_attack ^= (shape & S5B_ENV_ALTERNATE) ? 1 : 0;
+		s->env_step = 0;
+	}
+}
+
+static void
+s5b_output(s5b *s, apu *a, uint64_t time)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		apu_output(a, &s->amp[i], s5b_level(s, i), S5B_VOLUME, time);
+	}
+}
+
+/* NOTE: the tones, the noise and the envelope all step on their own
+ * timers, each step is handled in time order and the three channels are
+ * output after it */
+static void
+s5b_run(expansion *e, apu *a, uint64_t from, uint64_t to)
+{
+	s5b *s = &e->chip.s5b;
+	uint64_t tone[3], noise, env, t;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		tone[i] = from + (uint64_t)s->delay[i];
+	}
+	noise = from + (uint64_t)s->noise_delay;
+	env = from + (uint64_t)s->env_delay;
+
+	s5b_output(s, a, from);
+
+	for (;;) {
+		t = noise < env ? noise : env;
+		for (i = 0; i < 3; i++) {
+			t = tone[i] < t ? tone[i] : t;
+		}
+		if (t >= to) {
+			break;
+		}
+
+		for (i = 0; i < 3; i++) {
+			if (tone[i] == t) {
+				s->out[i] ^= 1;
+				tone[i] += (uint64_t)s5b_tone_period(s, i);
+			}
+		}
+		if (noise == t) {
+			s5b_noise_step(s);
+			noise += (uint64_t)s5b_noise_period(s);
+		}
+		if (env == t) {
+			s5b_env_step(s);
+			env += (uint64_t)s5b_env_period(s);
+		}
+
+		s5b_output(s, a, t);
+	}
+
+	for (i = 0; i < 3; i++) {
+		s->delay[i] = (int)(tone[i] - to);
+	}
+	s->noise_delay = (int)(noise - to);
+	s->env_delay = (int)(env - to);
+}
+
+static int
+s5b_write(expansion *e, apu *a, uint16_t addr, uint8_t val)
+{
+	s5b *s = &e->chip.s5b;
+
+	switch (addr & 0xE000) {
+		case 0xC000:
+			s->select = val & 0x0F;
+			return 1;
+		case 0xE000:
+			s->regs[s->select] = val;
+			if (s->select == 13) {
+				/* writing the shape restarts the envelope */
+				s->env_step = 0;
+				s->env_attack = (val & S5B_ENV_ATTACK) ? 1 : 0;
+				s->env_held = 0;
+				s->env_delay = s5b_env_period(s);
+			}
+			return 1;
+	}
+
+	(void)a;
+	return 0;
+}
+
+const expansion_ops
+s5b_ops = { NULL, s5b_write, s5b_run };
+
+/* Namco 163. See: https://www.nesdev.org/wiki/Namco_163_audio
+ *
+ * NOTE: the chip updates one channel every 15 CPU cycles and outputs only
+ * that channel until the next update. Here the output is the average of
+ * all active channels, which is what the multiplexing sounds like once
+ * filtered. */
+
+enum {
+	N163_UPDATE_CYCLES = 15,
+	N163_CHANNEL_REGS = 0x40
+};
+
+static inline int
+n163_channels(const n163 *n)
+{
+	return ((n->ram[0x7F] >> 4) & 0x07) + 1;
+}
+
+static inline uint8_t
+n163_sample(const n163 *n, uint8_t idx)
+{
+	return (n->ram[idx >> 1] >> ((idx & 0x1) * 4)) & 0x0F;
+}
+
+static void
+n163_update(n163 *n, int ch)
+{
+	uint8_t *r = n->ram + N163_CHANNEL_REGS + ch * 8;
+	uint32_t freq = r[0] | r[2] << 8 | (uint32_t)(r[4] & 0x03) << 16;
+	uint32_t phase = r[1] | r[3] << 8 | (uint32_t)r[5] << 16;
+	uint32_t len = (uint32_t)(256 - (r[4] & 0xFC)) << 16;
+
+	phase = (phase + freq) % len;
+	r[1] = (uint8_t)phase;
+	r[3] = (uint8_t)(phase >> 8);
+	r[5] = (uint8_t)(phase >> 16);
+
+	n->levels[ch] = (n163_sample(n, (uint8_t)((phase >> 16) + r[6])) - 8) * (r[7] & 0x0F);
+}
+
+static int
+n163_level(const n163 *n, int count)
+{
+	int sum = 0;
+	int ch;
+
+	for (ch = 8 - count; ch < 8; ch++) {
+		sum += n->levels[ch];
+	}
+
+	return sum * 4 / count;
+}
+
+static void
+n163_run(expansion *e, apu *a, uint64_t from, uint64_t to)
+{
+	n163 *n = &e->chip.n163;
+	int count = n163_channels(n);
+	uint64_t t = from + (uint64_t)n->delay;
+
+	apu_output(a, &n->amp, n163_level(n, count), N163_VOLUME, from);
+
+	for (; t < to; t += N163_UPDATE_CYCLES) {
+		if (n->channel < 8 - count) {
+			n->channel = 7;
+		}
+
+		n163_update(n, n->channel);
+		n->channel = n->channel == 8 - count ? 7 : n->channel - 1;
+
+		apu_output(a, &n->amp, n163_level(n, count), N163_VOLUME, t);
+	}
+
+	n->delay = (int)(t - to);
+}
+
+static uint8_t *
+n163_port(n163 *n)
+{
+	uint8_t *p = &n->ram[n->addr & 0x7F];
+
+	if (n->addr & 0x80) {
+		n->addr = (uint8_t)((n->addr & 0x80) | ((n->addr + 1) & 0x7F));
+	}
+
+	return p;
+}
+
+static int
+n163_read(expansion *e, apu *a, uint64_t time, uint16_t addr, uint8_t *val)
+{
+	if ((addr & 0xF800) != 0x4800) {
+		return 0;
+	}
+
+	apu_run_until(a, time); /* channel phases are written back to RAM */
+	*val = *n163_port(&e->chip.n163);
+	return 1;
+}
+
+static int
+n163_write(expansion *e, apu *a, uint16_t addr, uint8_t val)
+{
+	n163 *n = &e->chip.n163;
+
+	switch (addr & 0xF800) {
+		case 0x4800:
+			*n163_port(n) = val;
+			return 1;
+		case 0xF800:
+			n->addr = val;
+			return 1;
+	}
+
+	(void)a;
+	return 0;
+}
+
+const expansion_ops
+n163_ops = { n163_read, n163_write, n163_run };
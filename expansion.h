@@ -0,0 +1,88 @@
+#ifndef NES_EXPANSION_H
+#define NES_EXPANSION_H
+
+#include <stdint.h>
+
+/* NOTE: expansion audio. A chip sits next to the APU: it is brought up to
+ * date together with it (run), gets the cartrige writes (write) and reads
+ * (read) it claims, and reports its output changes to the APU's blip
+ * buffer through apu_output. Nothing runs for chips the board lacks.
+ * Writes come with the APU already run up to the CPU; reads come with the
+ * CPU time, a chip whose readable state changes as it runs catches up
+ * itself, only for the addresses it claims. */
+
+/* chip bits, same layout as byte $7B of the NSF header */
+enum {
+	EXP_VRC6 = 0x01,
+	EXP_VRC7 = 0x02,
+	EXP_FDS = 0x04,
+	EXP_MMC5 = 0x08,
+	EXP_N163 = 0x10,
+	EXP_S5B = 0x20
+};
+
+struct apu;
+struct expansion;
+
+typedef struct {
+	int (*read)(struct expansion *, struct apu *, uint64_t, uint16_t, uint8_t *);
+	int (*write)(struct expansion *, struct apu *, uint16_t, uint8_t);
+	void (*run)(struct expansion *, struct apu *, uint64_t, uint64_t);
+} expansion_ops;
+
+/* Konami VRC6: two pulses and a sawtooth */
+typedef struct {
+	uint8_t regs[4];
+	uint8_t step;
+	int delay;
+	int amp;
+} vrc6_channel;
+
+typedef struct {
+	vrc6_channel pulse[2];
+	vrc6_channel saw;
+	uint8_t accum;
+	uint8_t halt;
+	uint8_t shift; /* $9003 frequency scaling, periods are shifted right */
+} vrc6;
+
+/* Sunsoft 5B: three AY-3-8910 style square channels sharing a noise
+ * and an envelope generator */
+typedef struct {
+	uint8_t regs[16];
+	uint8_t select;
+	uint8_t out[3];
+	uint8_t env_step;   /* 0-15 along the current ramp */
+	uint8_t env_attack; /* the ramp goes up */
+	uint8_t env_held;
+	uint32_t noise;     /* 17 bit LFSR */
+	int delay[3];
+	int noise_delay;
+	int env_delay;
+	int amp[3];
+} s5b;
+
+/* Namco 163: up to 8 wavetable channels, time-multiplexed */
+typedef struct {
+	uint8_t ram[128];
+	uint8_t addr;      /* $F800 address port, bit 7 auto-increment */
+	uint8_t channel;   /* channel the next update goes to */
+	int delay;
+	int amp;
+	int levels[8];     /* last output of each channel */
+} n163;
+
+typedef struct expansion {
+	const expansion_ops *ops;
+	union {
+		vrc6 vrc6;
+		s5b s5b;
+		n163 n163;
+	} chip;
+} expansion;
+
+extern const expansion_ops vrc6_ops;
+extern const expansion_ops s5b_ops;
+extern const expansion_ops n163_ops;
+
+#endif /* NES_EXPANSION_H */
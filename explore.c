@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200112L /* fork, pipe */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "explore.h"
+
+/* NOTE: what a child writes back. Smaller than PIPE_BUF, so records of
+ * children finishing at the same time never interleave. */
+typedef struct {
+	int64_t score;
+	int32_t branch;
+	int32_t pad;
+} explore_result;
+
+/* results of the children reaped so far, the pipe never blocks */
+static void
+explore_drain(int fd, int branches, int64_t *scores, int *done)
+{
+	explore_result r;
+
+	while (read(fd, &r, sizeof(r)) == (ssize_t)sizeof(r)) {
+		if (r.branch >= 0 && r.branch < branches) {
+			scores[r.branch] = r.score;
+			(*done)++;
+		}
+	}
+}
+
+/* Runs branches [0, branches) with at most jobs children alive at a time
+ * and fills scores, EXPLORE_FAILED for a branch that didn't report.
+ * Returns the number of branches that did, -1 if none could start. */
+int
+explore_run(int branches, int jobs, explore_branch branch, void *arg, int64_t *scores)
+{
+	explore_result r = {0};
+	int fd[2];
+	int i, next = 0, running = 0, done = 0;
+	pid_t pid;
+
+	if (jobs < 1) {
+		jobs = 1;
+	} else if (jobs > EXPLORE_MAX_JOBS) {
+		jobs = EXPLORE_MAX_JOBS;
+	}
+
+	for (i = 0; i < branches; i++) {
+		scores[i] = EXPLORE_FAILED;
+	}
+
+	if (pipe(fd) != 0 || fcntl(fd[0], F_SETFL, O_NONBLOCK) != 0) {
+		perror("explore: pipe");
+		return -1;
+	}
+
+	/* NOTE: buffered output would be written once by every child */
+	fflush(NULL);
+
+	while (next < branches || running > 0) {
+		while (running < jobs && next < branches) {
+			pid = fork();
+			if (pid == 0) {
+				close(fd[0]);
+				r.score = branch(arg, next);
+				r.branch = next;
+				_exit(write(fd[1], &r, sizeof(r)) == (ssize_t)sizeof(r) ? 0 : 1);
+			}
+
+			if (pid < 0) {
+				if (running == 0) {
+					perror("explore: fork");
+					next = branches; /* nothing will free a process slot */
+				}
+				break;
+			}
+
+			running++;
+			next++;
+		}
+
+		if (running == 0) {
+			break;
+		}
+
+		/* NOTE: a child has written its result before it exits */
+		while (waitpid(-1, NULL, 0) < 0 && errno == EINTR) {
+		}
+		running--;
+		explore_drain(fd[0], branches, scores, &done);
+	}
+
+	explore_drain(fd[0], branches, scores, &done);
+	close(fd[0]);
+	close(fd[1]);
+
+	return done > 0 || branches == 0 ? done : -1;
+}
@@ -0,0 +1,20 @@
+#ifndef NES_EXPLORE_H
+#define NES_EXPLORE_H
+
+#include <stdint.h>
+
+/* NOTE: branch(arg, i) runs in a child forked from the process as it is
+ * now, so every branch starts from the same emulator state without it
+ * being saved or copied: the kernel shares the pages until somebody
+ * writes. The score the branch returns comes back through a pipe. */
+typedef int64_t (*explore_branch)(void *, int);
+
+enum {
+	EXPLORE_MAX_JOBS = 256
+};
+
+#define EXPLORE_FAILED INT64_MIN /* score of a branch that died */
+
+int explore_run(int, int, explore_branch, void *, int64_t *);
+
+#endif /* NES_EXPLORE_H */
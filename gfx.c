@@ -26,11 +26,18 @@ gfx_draw_frame(const uint32_t *frame_buf)
 void
 gfx_init()
 {
+	SetConfigFlags(FLAG_VSYNC_HINT); /* NOTE: video paces the emulation */
 	InitWindow(256, 240, "");
 	viewport = LoadRenderTexture(256, 240);
 	SetTextureFilter(viewport.texture, TEXTURE_FILTER_POINT);
 }
 
+void
+gfx_set_title(const char *title)
+{
+	SetWindowTitle(title);
+}
+
 int
 gfx_should_exit()
 {
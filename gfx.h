@@ -6,6 +6,7 @@
 void gfx_destroy();
 void gfx_draw_frame(const uint32_t *);
 void gfx_init();
+void gfx_set_title(const char *);
 int gfx_should_exit();
 
 #endif /* NES_GFX_H */
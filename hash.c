@@ -0,0 +1,324 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h> /* memcpy, memset */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "hash.h"
+
+/* NOTE: XXH3-style hash of long buffers (states, frames).
+ * Eight 64-bit lanes take a 64-byte stripe at a time. Every lane
+ * multiplies the two 32-bit halves of (data ^ secret) and also adds the
+ * neighbouring lane's plain data. That only needs 32x32->64 multiplies,
+ * which SSE2/AVX2 have. The secret moves 8 bytes per stripe, so equal
+ * stripes at different places count differently. Every 16 stripes the
+ * lanes are scrambled, and at the end they are folded into one value.
+ * The vector paths (AVX2 when the compiler targets it, SSE2 otherwise)
+ * give the same results as hash64_scalar, the reference and fallback.
+ * Host byte order, like everything it hashes. */
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+enum {
+	LANES = 8,
+	STRIPE = LANES * 8,
+	BLOCK_STRIPES = 16,
+	BLOCK = STRIPE * BLOCK_STRIPES,
+	SCRAMBLE_KEY = BLOCK_STRIPES, /* secret[] offsets */
+	MERGE_KEY = 8,
+	LAST_KEY = BLOCK_STRIPES - 1
+};
+
+static const uint64_t
+hash_secret[LANES + BLOCK_STRIPES] = {
+	0x6E789E6AA1B965F4ULL, 0x06C45D188009454FULL, 0xF88BB8A8724C81ECULL,
+	0x1B39896A51A8749BULL, 0x53CB9F0C747EA2EAULL, 0x2C829ABE1F4532E1ULL,
+	0xC584133AC916AB3CULL, 0x3EE5789041C98AC3ULL, 0xF3B8488C368CB0A6ULL,
+	0x657EECDD3CB13D09ULL, 0xC2D326E0055BDEF6ULL, 0x8621A03FE0BBDB7BULL,
+	0x8E1F7555983AA92FULL, 0xB54E0F1600CC4D19ULL, 0x84BB3F97971D80ABULL,
+	0x7D29825C75521255ULL, 0xC3CF17102B7F7F86ULL, 0x3466E9A083914F64ULL,
+	0xD81A8D2B5A4485ACULL, 0xDB01602B100B9ED7ULL, 0xA9038A921825F10DULL,
+	0xEDF5F1D90DCA2F6AULL, 0x54496AD67BD2634CULL, 0xDD7C01D4F5407269ULL
+};
+
+static const uint64_t
+hash_init[LANES] = {
+	PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+	PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1
+};
+
+static void
+accumulate_scalar(uint64_t *acc, const uint8_t *p, const uint64_t *secret, size_t stripes)
+{
+	uint64_t data[LANES], dk;
+	size_t s;
+	int i;
+
+	for (s = 0; s < stripes; s++, p += STRIPE) {
+		memcpy(data, p, STRIPE);
+		for (i = 0; i < LANES; i++) {
+			dk = data[i] ^ secret[s + (size_t)i];
+			acc[i ^ 1] += data[i];
+			acc[i] += (dk & 0xFFFFFFFF) * (dk >> 32);
+		}
+	}
+}
+
+static void
+scramble_scalar(uint64_t *acc, const uint64_t *key)
+{
+	int i;
+
+	for (i = 0; i < LANES; i++) {
+		acc[i] ^= acc[i] >> 47;
+		acc[i] ^= key[i];
+		acc[i] *= PRIME32_1;
+	}
+}
+
+#if defined(__AVX2__)
+static void
+accumulate(uint64_t *acc, const uint8_t *p, const uint64_t *secret, size_t stripes)
+{
+	__m256i a0 = _mm256_loadu_si256((const __m256i *)acc);
+	__m256i a1 = _mm256_loadu_si256((const __m256i *)(acc + 4));
+	__m256i d, dk;
+	size_t s;
+
+	for (s = 0; s < stripes; s++, p += STRIPE) {
+		d = _mm256_loadu_si256((const __m256i *)p);
+		dk = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i *)(secret + s)));
+		a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+		a0 = _mm256_add_epi64(a0, _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32)));
+
+		d = _mm256_loadu_si256((const __m256i *)(p + 32));
+		dk = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i *)(secret + s + 4)));
+		a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+		a1 = _mm256_add_epi64(a1, _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32)));
+	}
+
+	_mm256_storeu_si256((__m256i *)acc, a0);
+	_mm256_storeu_si256((__m256i *)(acc + 4), a1);
+}
+
+static void
+scramble(uint64_t *acc, const uint64_t *key)
+{
+	const __m256i prime = _mm256_set1_epi64x(PRIME32_1);
+	__m256i a;
+	int i;
+
+	for (i = 0; i < LANES; i += 4) {
+		a = _mm256_loadu_si256((const __m256i *)(acc + i));
+		a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+		a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)(key + i)));
+		a = _mm256_add_epi64(_mm256_mul_epu32(a, prime),
+		                     _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime), 32));
+		_mm256_storeu_si256((__m256i *)(acc + i), a);
+	}
+}
+#elif defined(__SSE2__)
+static void
+accumulate(uint64_t *acc, const uint8_t *p, const uint64_t *secret, size_t stripes)
+{
+	__m128i a[LANES / 2], d, dk;
+	size_t s;
+	int i;
+
+	for (i = 0; i < LANES / 2; i++) {
+		a[i] = _mm_loadu_si128((const __m128i *)(acc + 2 * i));
+	}
+
+	for (s = 0; s < stripes; s++, p += STRIPE) {
+		for (i = 0; i < LANES / 2; i++) {
+			d = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+			dk = _mm_xor_si128(d, _mm_loadu_si128((const __m128i *)(secret + s + 2 * (size_t)i)));
+			a[i] = _mm_add_epi64(a[i], _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+			a[i] = _mm_add_epi64(a[i], _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32)));
+		}
+	}
+
+	for (i = 0; i < LANES / 2; i++) {
+		_mm_storeu_si128((__m128i *)(acc + 2 * i), a[i]);
+	}
+}
+
+static void
+scramble(uint64_t *acc, const uint64_t *key)
+{
+	const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+	__m128i a;
+	int i;
+
+	for (i = 0; i < LANES; i += 2) {
+		a = _mm_loadu_si128((const __m128i *)(acc + i));
+		a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+		a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *)(key + i)));
+		a = _mm_add_epi64(_mm_mul_epu32(a, prime),
+		                  _mm_slli_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), prime), 32));
+		_mm_storeu_si128((__m128i *)(acc + i), a);
+	}
+}
+#else
+static void
+accumulate(uint64_t *acc, const uint8_t *p, const uint64_t *secret, size_t stripes)
+{
+	accumulate_scalar(acc, p, secret, stripes);
+}
+
+static void
+scramble(uint64_t *acc, const uint64_t *key)
+{
+	scramble_scalar(acc, key);
+}
+#endif
+
+/* upper ^ lower half of the 128-bit product */
+static uint64_t
+mul_fold(uint64_t a, uint64_t b)
+{
+	uint64_t lo_lo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+	uint64_t hi_lo = (a >> 32) * (b & 0xFFFFFFFF);
+	uint64_t lo_hi = (a & 0xFFFFFFFF) * (b >> 32);
+	uint64_t hi_hi = (a >> 32) * (b >> 32);
+	uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xFFFFFFFF) + lo_hi;
+	uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+	uint64_t lower = (cross << 32) | (lo_lo & 0xFFFFFFFF);
+
+	return lower ^ upper;
+}
+
+static uint64_t
+hash_run(const uint8_t *p, size_t len, uint64_t seed, int vector)
+{
+	uint64_t acc[LANES], h;
+	uint8_t last[STRIPE];
+	size_t b, rest, stripes;
+	int i;
+
+	for (i = 0; i < LANES; i++) {
+		acc[i] = hash_init[i] ^ (seed + hash_secret[i]);
+	}
+
+	for (b = 0; b < len / BLOCK; b++, p += BLOCK) {
+		if (vector) {
+			accumulate(acc, p, hash_secret, BLOCK_STRIPES);
+			scramble(acc, hash_secret + SCRAMBLE_KEY);
+		} else {
+			accumulate_scalar(acc, p, hash_secret, BLOCK_STRIPES);
+			scramble_scalar(acc, hash_secret + SCRAMBLE_KEY);
+		}
+	}
+
+	rest = len % BLOCK;
+	stripes = rest / STRIPE;
+	if (vector) {
+		accumulate(acc, p, hash_secret, stripes);
+	} else {
+		accumulate_scalar(acc, p, hash_secret, stripes);
+	}
+
+	/* the tail is padded with zeros, the length tells them apart */
+	rest %= STRIPE;
+	if (rest) {
+		memset(last, 0, sizeof(last));
+		memcpy(last, p + stripes * STRIPE, rest);
+		accumulate_scalar(acc, last, hash_secret + LAST_KEY, 1);
+	}
+
+	h = (uint64_t)len * PRIME64_1 ^ seed;
+	for (i = 0; i < LANES; i += 2) {
+		h += mul_fold(acc[i] ^ hash_secret[MERGE_KEY + i], acc[i + 1] ^ hash_secret[MERGE_KEY + i + 1]);
+	}
+
+	h ^= h >> 37;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+uint64_t
+hash64(const void *data, size_t len, uint64_t seed)
+{
+	return hash_run(data, len, seed, 1);
+}
+
+uint64_t
+hash64_scalar(const void *data, size_t len, uint64_t seed)
+{
+	return hash_run(data, len, seed, 0);
+}
+
+/* NOTE: CRC-32 (IEEE, as zip and ROM databases use it), slice-by-8.
+ * Table k holds the CRC of a byte followed by k zero bytes, so eight
+ * bytes take eight lookups that don't wait for each other instead of a
+ * chain of eight. Tables are built on first use, little endian hosts
+ * only like the rest of the file formats. */
+static uint32_t crc_table[8][256];
+static int crc_table_ready;
+
+static void
+crc_table_build(void)
+{
+	uint32_t c;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = (uint32_t)i;
+		for (k = 0; k < 8; k++) {
+			c = c & 1 ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+		}
+		crc_table[0][i] = c;
+	}
+
+	for (i = 0; i < 256; i++) {
+		for (k = 1; k < 8; k++) {
+			c = crc_table[k - 1][i];
+			crc_table[k][i] = crc_table[0][c & 0xFF] ^ (c >> 8);
+		}
+	}
+
+	crc_table_ready = 1;
+}
+
+/* continues crc over more data, start with 0 */
+uint32_t
+crc32(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	uint32_t lo, hi;
+
+	if (!crc_table_ready) {
+		crc_table_build();
+	}
+
+	crc = ~crc;
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&lo, p, 4);
+		memcpy(&hi, p + 4, 4);
+		lo ^= crc;
+		crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+		      crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+		      crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+		      crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+	}
+
+	for (; len > 0; len--, p++) {
+		crc = crc_table[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+	}
+
+	return ~crc;
+}
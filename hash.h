@@ -0,0 +1,11 @@
+#ifndef NES_HASH_H
+#define NES_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t hash64(const void *, size_t, uint64_t);
+uint64_t hash64_scalar(const void *, size_t, uint64_t);
+uint32_t crc32(uint32_t, const void *, size_t);
+
+#endif /* NES_HASH_H */
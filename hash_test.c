@@ -0,0 +1,71 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+
+#include "hash.c"
+
+static uint8_t buf[5000];
+
+static void
+fill(uint32_t seed)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(buf); i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (uint8_t)(seed >> 16);
+	}
+}
+
+Test(hash, matches_scalar) {
+	size_t len;
+
+	fill(1);
+	for (len = 0; len <= sizeof(buf); len += len < 200 ? 1 : 97) {
+		cr_assert(eq(u64, hash64(buf, len, 0), hash64_scalar(buf, len, 0)));
+		cr_assert(eq(u64, hash64(buf + 1, len - (len > 0), 7), hash64_scalar(buf + 1, len - (len > 0), 7)));
+	}
+}
+
+/* every single bit flip shows, wherever it is */
+Test(hash, bit_flips) {
+	uint64_t h;
+	size_t i;
+
+	fill(2);
+	h = hash64(buf, sizeof(buf), 0);
+
+	for (i = 0; i < sizeof(buf) * 8; i += 13) {
+		buf[i / 8] ^= (uint8_t)(1 << (i % 8));
+		cr_assert(ne(u64, hash64(buf, sizeof(buf), 0), h));
+		buf[i / 8] ^= (uint8_t)(1 << (i % 8));
+	}
+
+	cr_assert(eq(u64, hash64(buf, sizeof(buf), 0), h));
+	cr_assert(ne(u64, hash64(buf, sizeof(buf), 1), h));
+}
+
+/* the same stripe at another place or zero padding changes the hash */
+Test(hash, position) {
+	uint8_t a[256] = {0}, b[256] = {0};
+
+	memset(a, 0x5A, 64);
+	memset(b + 64, 0x5A, 64);
+	cr_assert(ne(u64, hash64(a, sizeof(a), 0), hash64(b, sizeof(b), 0)));
+	cr_assert(ne(u64, hash64(a, 100, 0), hash64(a, 101, 0)));
+}
+
+Test(hash, crc32) {
+	size_t i;
+	uint32_t bytewise = 0;
+
+	cr_assert(eq(u32, crc32(0, "123456789", 9), 0xCBF43926));
+	cr_assert(eq(u32, crc32(0, "", 0), 0));
+
+	/* eight at a time or one at a time, in pieces or not */
+	fill(3);
+	for (i = 0; i < sizeof(buf); i++) {
+		bytewise = crc32(bytewise, buf + i, 1);
+	}
+	cr_assert(eq(u32, crc32(0, buf, sizeof(buf)), bytewise));
+	cr_assert(eq(u32, crc32(crc32(0, buf, 1234), buf + 1234, sizeof(buf) - 1234), bytewise));
+}
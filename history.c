@@ -0,0 +1,229 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h> /* memcpy */
+
+#include "history.h"
+
+enum {
+	MIN_RUN = 4 /* shorter equal runs are cheaper inside a literal */
+};
+
+static void
+ring_put(history *h, uint64_t pos, const void *src, size_t n)
+{
+	size_t off = (size_t)(pos % h->cap);
+	size_t first = n < h->cap - off ? n : h->cap - off;
+
+	memcpy(h->ring + off, src, first);
+	memcpy(h->ring, (const uint8_t *)src + first, n - first);
+}
+
+static void
+ring_get(const history *h, uint64_t pos, void *dst, size_t n)
+{
+	size_t off = (size_t)(pos % h->cap);
+	size_t first = n < h->cap - off ? n : h->cap - off;
+
+	memcpy(dst, h->ring + off, first);
+	memcpy((uint8_t *)dst + first, h->ring, n - first);
+}
+
+static size_t
+put_varint(uint8_t *p, size_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+
+	return n;
+}
+
+static size_t
+get_varint(const uint8_t **p)
+{
+	size_t v = 0;
+	int shift = 0;
+
+	while (**p & 0x80) {
+		v |= (size_t)(*(*p)++ & 0x7F) << shift;
+		shift += 7;
+	}
+	v |= (size_t)*(*p)++ << shift;
+
+	return v;
+}
+
+/* first index >= i where the snapshots differ, a word at a time */
+static size_t
+equal_until(const uint8_t *a, const uint8_t *b, size_t i, size_t n)
+{
+	uint64_t x, y;
+
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		if (x != y) {
+			break;
+		}
+	}
+
+	while (i < n && a[i] == b[i]) {
+		i++;
+	}
+
+	return i;
+}
+
+/* NOTE: the delta is a list of (equal bytes to skip, literal length,
+ * literal XOR bytes). Equal bytes at the end are implied. */
+static size_t
+delta_encode(const uint8_t *a, const uint8_t *b, size_t n, uint8_t *out)
+{
+	size_t i = 0, o = 0, start, zeros, run, k;
+
+	while (i < n) {
+		start = i;
+		i = equal_until(a, b, i, n);
+		if (i == n) {
+			break;
+		}
+		zeros = i - start;
+
+		start = i;
+		for (run = 0; i < n && run < MIN_RUN; i++) {
+			run = a[i] == b[i] ? run + 1 : 0;
+		}
+		if (run == MIN_RUN) {
+			i -= MIN_RUN;
+		}
+
+		o += put_varint(out + o, zeros);
+		o += put_varint(out + o, i - start);
+		for (k = start; k < i; k++) {
+			out[o++] = a[k] ^ b[k];
+		}
+	}
+
+	return o;
+}
+
+static void
+delta_apply(uint8_t *dst, const uint8_t *delta, size_t len)
+{
+	const uint8_t *p = delta, *end = delta + len;
+	size_t pos = 0, lit, k;
+
+	while (p < end) {
+		pos += get_varint(&p);
+		lit = get_varint(&p);
+		for (k = 0; k < lit; k++) {
+			dst[pos + k] ^= p[k];
+		}
+		p += lit;
+		pos += lit;
+	}
+}
+
+/* Returns 0 on success. */
+int
+history_init(history *h, size_t size, size_t cap)
+{
+	h->ring = malloc(cap);
+	h->last = malloc(size);
+	h->scratch = malloc(size * 2 + 16); /* worst case of delta_encode */
+
+	if (h->ring == NULL || h->last == NULL || h->scratch == NULL) {
+		history_free(h);
+		return -1;
+	}
+
+	h->cap = cap;
+	h->size = size;
+	h->head = 0;
+	h->tail = 0;
+	h->count = 0;
+
+	return 0;
+}
+
+void
+history_free(history *h)
+{
+	free(h->ring);
+	free(h->last);
+	free(h->scratch);
+	h->ring = h->last = h->scratch = NULL;
+	h->size = 0;
+	h->count = 0;
+}
+
+static void
+evict(history *h)
+{
+	uint32_t len;
+
+	ring_get(h, h->tail, &len, sizeof(len));
+	h->tail += len + 2 * sizeof(len);
+	h->count--;
+}
+
+void
+history_push(history *h, const void *snap)
+{
+	uint32_t len;
+	size_t need;
+
+	if (h->count > 0) {
+		len = (uint32_t)delta_encode(snap, h->last, h->size, h->scratch);
+		need = len + 2 * sizeof(len);
+
+		if (need > h->cap) {
+			h->tail = h->head; /* doesn't fit at all, start over */
+			h->count = 0;
+		} else {
+			while (h->head + need - h->tail > h->cap) {
+				evict(h);
+			}
+			ring_put(h, h->head, &len, sizeof(len));
+			ring_put(h, h->head + sizeof(len), h->scratch, len);
+			ring_put(h, h->head + sizeof(len) + len, &len, sizeof(len));
+			h->head += need;
+		}
+	}
+
+	memcpy(h->last, snap, h->size);
+	h->count++;
+}
+
+/* drops the newest snapshot and copies out the one before it.
+ * Returns -1 if there is none. */
+int
+history_back(history *h, void *snap)
+{
+	uint32_t len;
+
+	if (h->count < 2) {
+		return -1;
+	}
+
+	ring_get(h, h->head - sizeof(len), &len, sizeof(len));
+	h->head -= len + 2 * sizeof(len);
+	ring_get(h, h->head + sizeof(len), h->scratch, len);
+	delta_apply(h->last, h->scratch, len);
+	h->count--;
+
+	memcpy(snap, h->last, h->size);
+	return 0;
+}
+
+/* bytes of the ring in use */
+size_t
+history_used(const history *h)
+{
+	return (size_t)(h->head - h->tail);
+}
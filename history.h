@@ -0,0 +1,29 @@
+#ifndef NES_HISTORY_H
+#define NES_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* NOTE: rewind buffer. The newest snapshot is kept in full, older ones
+ * only as the XOR of two neighbours with the zero runs squeezed out, so
+ * a frame that touched a few hundred bytes costs a few hundred bytes.
+ * Deltas point backwards (newer -> older) and live in a ring, running
+ * out of space just forgets the oldest frames. */
+typedef struct {
+	uint8_t *ring;    /* [len][delta][len] entries */
+	size_t cap;
+	uint64_t head;    /* end of the newest entry, grows forever */
+	uint64_t tail;    /* start of the oldest entry */
+	uint8_t *last;    /* newest snapshot */
+	uint8_t *scratch; /* one encoded delta */
+	size_t size;      /* bytes per snapshot */
+	size_t count;     /* snapshots held, last included */
+} history;
+
+int history_init(history *, size_t, size_t);
+void history_free(history *);
+void history_push(history *, const void *);
+int history_back(history *, void *);
+size_t history_used(const history *);
+
+#endif /* NES_HISTORY_H */
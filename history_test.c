@@ -0,0 +1,83 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+
+#include "history.c"
+
+enum {
+	SIZE = 1000,
+	FRAMES = 64
+};
+
+static uint8_t frames[FRAMES][SIZE];
+
+/* every frame changes a few scattered bytes and one longer stretch */
+static void
+make_frames(void)
+{
+	uint32_t seed = 1;
+	int f, i;
+
+	for (i = 0; i < SIZE; i++) {
+		frames[0][i] = (uint8_t)i;
+	}
+
+	for (f = 1; f < FRAMES; f++) {
+		memcpy(frames[f], frames[f - 1], SIZE);
+		for (i = 0; i < 8; i++) {
+			seed = seed * 1103515245 + 12345;
+			frames[f][(seed >> 8) % SIZE] ^= (uint8_t)(seed >> 24 | 1);
+		}
+		memset(frames[f] + (f * 37) % (SIZE - 50), f, 50);
+	}
+}
+
+Test(history, round_trip) {
+	history h;
+	uint8_t out[SIZE];
+	int f;
+
+	make_frames();
+	cr_assert(eq(int, history_init(&h, SIZE, 1 << 16), 0));
+
+	for (f = 0; f < FRAMES; f++) {
+		history_push(&h, frames[f]);
+	}
+	cr_assert(eq(sz, h.count, FRAMES));
+	cr_assert(lt(sz, history_used(&h), (size_t)FRAMES * SIZE / 4));
+
+	for (f = FRAMES - 2; f >= 0; f--) {
+		cr_assert(eq(int, history_back(&h, out), 0));
+		cr_assert(eq(int, memcmp(out, frames[f], SIZE), 0));
+	}
+	cr_assert(eq(int, history_back(&h, out), -1));
+
+	history_free(&h);
+}
+
+/* a small ring wraps around and forgets the oldest frames */
+Test(history, eviction) {
+	history h;
+	uint8_t out[SIZE];
+	size_t kept;
+	int f;
+
+	make_frames();
+	cr_assert(eq(int, history_init(&h, SIZE, 700), 0));
+
+	for (f = 0; f < FRAMES; f++) {
+		history_push(&h, frames[f]);
+		cr_assert(le(sz, history_used(&h), 700));
+	}
+
+	kept = h.count;
+	cr_assert(lt(sz, kept, FRAMES));
+	cr_assert(gt(sz, kept, 2));
+
+	for (f = FRAMES - 2; f >= FRAMES - (int)kept; f--) {
+		cr_assert(eq(int, history_back(&h, out), 0));
+		cr_assert(eq(int, memcmp(out, frames[f], SIZE), 0));
+	}
+	cr_assert(eq(int, history_back(&h, out), -1));
+
+	history_free(&h);
+}
@@ -1,5 +1,11 @@
 #include "ines.h"
 
+enum {
+	PRG_ROM_UNIT = 0x4000,
+	CHR_ROM_UNIT = 0x2000,
+	INES_RAM_UNIT = 0x2000
+};
+
 static const uint8_t
 ines_tag[4] = { 0x4E, 0x45, 0x53, 0x1A }; /* N + E + S + 0x1A */
 
@@ -15,3 +21,99 @@ is_valid_ines_tag(const uint8_t *tag)
 	}
 	return 1;
 }
+
+/* NOTE: NES 2.0 ROM sizes are a 12 bit count of units, or 2^E * (2M + 1)
+ * bytes when the top nibble is all ones. Returns 0 for sizes that don't
+ * fit in 32 bits. */
+static uint32_t
+rom_size(uint8_t lsb, uint8_t msb, uint32_t unit)
+{
+	int e = lsb >> 2;
+	uint32_t m = (uint32_t)(lsb & 3) * 2 + 1;
+
+	if (msb != 0xF) {
+		return ((uint32_t)msb << 8 | lsb) * unit;
+	}
+
+	return e < 29 ? (1U << e) * m : 0;
+}
+
+/* 0 is none, otherwise 64 << shift bytes */
+static uint32_t
+ram_size(uint8_t shift)
+{
+	return shift ? 64U << shift : 0;
+}
+
+static void
+ines1_parse(const struct ines_header *h, ines_info *info)
+{
+	uint32_t ram = h->prg_ram_size ? h->prg_ram_size * INES_RAM_UNIT : INES_RAM_UNIT;
+
+	info->version = 1;
+	info->mapper = h->flags6 >> 4;
+
+	/* NOTE: old dumps have junk ("DiskDude!") from byte 7 on, the upper
+	 * mapper nibble is only good if the unused bytes are zero */
+	if (h->flags12 == 0 && h->padding[0] == 0 && h->padding[1] == 0 && h->padding[2] == 0) {
+		info->mapper |= h->flags7 & 0xF0;
+	}
+
+	info->prg_rom = h->prg_rom_size * PRG_ROM_UNIT;
+	info->chr_rom = h->chr_rom_size * CHR_ROM_UNIT;
+	info->chr_ram = info->chr_rom ? 0 : CHR_ROM_UNIT;
+
+	/* NOTE: byte 8 is mostly left at 0, which the spec reads as 8 KB. We
+	 * take it as none unless the battery bit says otherwise, the boards
+	 * that do have plain PRG-RAM (Family BASIC) set the byte. */
+	if (info->battery) {
+		info->prg_nvram = ram;
+	} else if (h->prg_ram_size) {
+		info->prg_ram = ram;
+	}
+
+	info->timing = h->flags9 & 1 ? INES_PAL : INES_NTSC;
+}
+
+static void
+ines2_parse(const struct ines_header *h, ines_info *info)
+{
+	info->version = 2;
+	info->mapper = h->flags6 >> 4 | (h->flags7 & 0xF0) | (h->prg_ram_size & 0x0F) << 8;
+	info->submapper = h->prg_ram_size >> 4;
+	info->prg_rom = rom_size(h->prg_rom_size, h->flags9 & 0x0F, PRG_ROM_UNIT);
+	info->chr_rom = rom_size(h->chr_rom_size, h->flags9 >> 4, CHR_ROM_UNIT);
+	info->prg_ram = ram_size(h->flags10 & 0x0F);
+	info->prg_nvram = ram_size(h->flags10 >> 4);
+	info->chr_ram = ram_size(h->flags11 & 0x0F);
+	info->chr_nvram = ram_size(h->flags11 >> 4);
+	info->timing = (ines_timing)(h->flags12 & 3);
+}
+
+/* Returns 0 on success, -1 if the header makes no sense. */
+int
+ines_parse(const struct ines_header *h, ines_info *info)
+{
+	*info = (ines_info){0};
+
+	if (!is_valid_ines_tag(h->magic)) {
+		return -1;
+	}
+
+	info->battery = (h->flags6 & PRG_RAM_MASK) != 0;
+	info->trainer = (h->flags6 & TRAINER_MASK) != 0;
+
+	if (h->flags6 & ALT_LAYOUT_MASK) {
+		info->mirroring = FOUR_SCREEN;
+	} else {
+		info->mirroring = h->flags6 & MIRRORING_MASK ? VERTICAL_MIRRORING : HORIZONTAL_MIRRORING;
+	}
+
+	if ((h->flags7 & NES2_MASK) == NES2_ID) {
+		ines2_parse(h, info);
+	} else {
+		ines1_parse(h, info);
+	}
+
+	return info->prg_rom != 0 ? 0 : -1;
+}
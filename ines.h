@@ -3,7 +3,8 @@
 
 #include <stdint.h>
 
-/* see to https://www.nesdev.org/wiki/INES */
+/* see to https://www.nesdev.org/wiki/INES
+ * and https://www.nesdev.org/wiki/NES_2.0 */
 
 typedef enum {
 	HORIZONTAL_MIRRORING,
@@ -14,30 +15,66 @@ typedef enum {
 	INVALID_MIRRORING
 } mirroring_type;
 
+typedef enum {
+	INES_NTSC,
+	INES_PAL,
+	INES_MULTI_REGION,
+	INES_DENDY
+} ines_timing;
+
 enum flags6_masks {
 	MIRRORING_MASK = 0x01,
-	PRG_RAM_MASK = 0x02,
+	PRG_RAM_MASK = 0x02,    /* battery-backed PRG-RAM */
 	TRAINER_MASK = 0x04,
-	ALT_LAYOUT_MASK = 0x08,
+	ALT_LAYOUT_MASK = 0x08, /* four-screen VRAM */
+};
+
+enum {
+	INES_HEADER_SIZE = 16,
+	INES_TRAINER_SIZE = 512,
+	NES2_MASK = 0x0C, /* of flags7 */
+	NES2_ID = 0x08
 };
 
 struct ines_header {
 	uint8_t magic[4];
-	uint8_t prg_rom_size; /* number of 16KB ROM banks (PRG ROM) */
-	uint8_t chr_rom_size; /* number of 8KB VROM banks (CHR ROM) */
+	uint8_t prg_rom_size; /* number of 16KB ROM banks (PRG ROM), LSB on 2.0 */
+	uint8_t chr_rom_size; /* number of 8KB VROM banks (CHR ROM), LSB on 2.0 */
 	uint8_t flags6;       /* ROM control byte 1 */
 	uint8_t flags7;       /* ROM control byte 2 */
-	uint8_t prg_ram_size; /* number of 8KB banks (PRG RAM) */
-	uint8_t flags9;
-	uint8_t flags10;
-	uint8_t padding[5]; /* unused */
+	uint8_t prg_ram_size; /* number of 8KB banks (PRG RAM), mapper MSB/submapper on 2.0 */
+	uint8_t flags9;       /* TV system, ROM size MSBs on 2.0 */
+	uint8_t flags10;      /* PRG-RAM/NVRAM shifts on 2.0 */
+	uint8_t flags11;      /* CHR-RAM/NVRAM shifts on 2.0 */
+	uint8_t flags12;      /* timing on 2.0 */
+	uint8_t padding[3];   /* unused */
 };
 
 struct ines {
 	struct ines_header header;
-	uint8_t trainer[512];
+	uint8_t trainer[INES_TRAINER_SIZE];
 };
 
+/* NOTE: what a header says about the board, whichever version it is.
+ * Sizes are in bytes, RAM that keeps its contents (battery) is counted
+ * apart from RAM that doesn't. */
+typedef struct {
+	int version; /* 1 or 2 */
+	int mapper;
+	int submapper;
+	uint32_t prg_rom;
+	uint32_t chr_rom;
+	uint32_t prg_ram;
+	uint32_t prg_nvram;
+	uint32_t chr_ram;
+	uint32_t chr_nvram;
+	mirroring_type mirroring;
+	int battery;
+	int trainer;
+	ines_timing timing;
+} ines_info;
+
 int is_valid_ines_tag(const uint8_t *);
+int ines_parse(const struct ines_header *, ines_info *);
 
 #endif /* NES_INES_H */
@@ -0,0 +1,60 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <string.h>
+
+#include "ines.c"
+
+static struct ines_header
+header(uint8_t flags6, uint8_t flags7)
+{
+	return (struct ines_header){
+		.magic = { 0x4E, 0x45, 0x53, 0x1A },
+		.prg_rom_size = 2,
+		.chr_rom_size = 1,
+		.flags6 = flags6,
+		.flags7 = flags7
+	};
+}
+
+/* "DiskDude!" from byte 7 on: the upper mapper nibble is junk */
+Test(ines, v1_junk)
+{
+	struct ines_header h = header(0x13, 0x44);
+	ines_info info;
+
+	memcpy(&h.flags12, "Dude", 4);
+	cr_assert(eq(int, ines_parse(&h, &info), 0));
+	cr_assert(eq(int, info.version, 1));
+	cr_assert(eq(int, info.mapper, 1));
+	cr_assert(eq(int, info.mirroring, VERTICAL_MIRRORING));
+	cr_assert(eq(u32, info.prg_rom, 0x8000));
+	cr_assert(eq(u32, info.prg_nvram, 0x2000));
+
+	h.flags12 = h.padding[0] = h.padding[1] = h.padding[2] = 0;
+	cr_assert(eq(int, ines_parse(&h, &info), 0));
+	cr_assert(eq(int, info.mapper, 0x41));
+}
+
+Test(ines, v2)
+{
+	struct ines_header h = header(0x48, 0x18);
+	ines_info info;
+
+	h.prg_ram_size = 0x31; /* submapper 3, mapper bits 8-11 */
+	h.flags9 = 0xF0;       /* CHR ROM 2^2 * 3 bytes */
+	h.chr_rom_size = 0x09;
+	h.flags10 = 0x70;
+	h.flags11 = 0x07;
+	h.flags12 = 3;
+
+	cr_assert(eq(int, ines_parse(&h, &info), 0));
+	cr_assert(eq(int, info.version, 2));
+	cr_assert(eq(int, info.mapper, 0x114));
+	cr_assert(eq(int, info.submapper, 3));
+	cr_assert(eq(int, info.mirroring, FOUR_SCREEN));
+	cr_assert(eq(u32, info.chr_rom, 12));
+	cr_assert(eq(u32, info.prg_ram, 0));
+	cr_assert(eq(u32, info.prg_nvram, 0x2000));
+	cr_assert(eq(u32, info.chr_ram, 0x2000));
+	cr_assert(eq(int, info.timing, INES_DENDY));
+}
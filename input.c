@@ -0,0 +1,76 @@
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+
+#include "raylib.h"
+
+#include "input.h"
+#include "pad.h"
+
+/* NOTE: player 1 is the keyboard or the first gamepad, player 2 the
+ * second gamepad. Polled once per frame. */
+
+static const struct {
+	uint8_t button;
+	int key;
+	int gamepad;
+} bindings[] = {
+	{ PAD_A, KEY_X, GAMEPAD_BUTTON_RIGHT_FACE_RIGHT },
+	{ PAD_B, KEY_Z, GAMEPAD_BUTTON_RIGHT_FACE_DOWN },
+	{ PAD_SELECT, KEY_RIGHT_SHIFT, GAMEPAD_BUTTON_MIDDLE_LEFT },
+	{ PAD_START, KEY_ENTER, GAMEPAD_BUTTON_MIDDLE_RIGHT },
+	{ PAD_UP, KEY_UP, GAMEPAD_BUTTON_LEFT_FACE_UP },
+	{ PAD_DOWN, KEY_DOWN, GAMEPAD_BUTTON_LEFT_FACE_DOWN },
+	{ PAD_LEFT, KEY_LEFT, GAMEPAD_BUTTON_LEFT_FACE_LEFT },
+	{ PAD_RIGHT, KEY_RIGHT, GAMEPAD_BUTTON_LEFT_FACE_RIGHT }
+};
+
+uint8_t
+input_read(int port)
+{
+	uint8_t buttons = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(bindings) / sizeof(bindings[0]); i++) {
+		if (port == 0 && IsKeyDown(bindings[i].key)) {
+			buttons |= bindings[i].button;
+		}
+
+		if (IsGamepadAvailable(port) && IsGamepadButtonDown(port, bindings[i].gamepad)) {
+			buttons |= bindings[i].button;
+		}
+	}
+
+	/* NOTE: a real D-pad can't press opposite directions, some games
+	 * break if it happens */
+	if ((buttons & (PAD_UP | PAD_DOWN)) == (PAD_UP | PAD_DOWN)) {
+		buttons &= (uint8_t)~(PAD_UP | PAD_DOWN);
+	}
+
+	if ((buttons & (PAD_LEFT | PAD_RIGHT)) == (PAD_LEFT | PAD_RIGHT)) {
+		buttons &= (uint8_t)~(PAD_LEFT | PAD_RIGHT);
+	}
+
+	return buttons;
+}
+
+/* frontend actions, not seen by the console */
+int
+input_hotkey(void)
+{
+	if (IsKeyPressed(KEY_F5)) {
+		return INPUT_SAVE_STATE;
+	}
+
+	if (IsKeyPressed(KEY_F7)) {
+		return INPUT_LOAD_STATE;
+	}
+
+	return INPUT_NONE;
+}
+
+/* held, not pressed */
+int
+input_rewind(void)
+{
+	return IsKeyDown(KEY_BACKSPACE);
+}
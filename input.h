@@ -0,0 +1,16 @@
+#ifndef NES_INPUT_H
+#define NES_INPUT_H
+
+#include <stdint.h>
+
+enum {
+	INPUT_NONE,
+	INPUT_SAVE_STATE,
+	INPUT_LOAD_STATE
+};
+
+uint8_t input_read(int);
+int input_hotkey(void);
+int input_rewind(void);
+
+#endif /* NES_INPUT_H */
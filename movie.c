@@ -0,0 +1,277 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h> /* memcpy, memcmp */
+
+#include "hash.h"
+#include "movie.h"
+
+static const uint8_t
+movie_magic[4] = { 'F', 'A', 'M', 'V' };
+
+static const uint8_t
+checkpoints_magic[4] = { 'F', 'A', 'M', 'C' };
+
+/* Returns 0 on success. start may be NULL. */
+int
+movie_init(movie *m, uint64_t rom_hash, const state *start)
+{
+	memset(m, 0, sizeof(*m));
+	memcpy(m->header.magic, movie_magic, sizeof(m->header.magic));
+	m->header.version = MOVIE_VERSION;
+	m->header.rom_hash = rom_hash;
+
+	if (start != NULL) {
+		m->start = malloc(sizeof(*m->start));
+		if (m->start == NULL) {
+			return -1;
+		}
+		memcpy(m->start, start, sizeof(*m->start));
+		m->header.from_state = 1;
+	}
+
+	return 0;
+}
+
+void
+movie_free(movie *m)
+{
+	free(m->start);
+	free(m->frames);
+	m->start = NULL;
+	m->frames = NULL;
+	m->cap = 0;
+}
+
+/* Returns 0 on success. */
+int
+movie_add(movie *m, const uint8_t *input, uint64_t hash)
+{
+	movie_frame *frames;
+	size_t cap;
+
+	if (m->header.frames == m->cap) {
+		cap = m->cap ? m->cap * 2 : 4096;
+		frames = realloc(m->frames, cap * sizeof(*frames));
+		if (frames == NULL) {
+			return -1;
+		}
+		m->frames = frames;
+		m->cap = cap;
+	}
+
+	memset(&m->frames[m->header.frames], 0, sizeof(m->frames[0]));
+	memcpy(m->frames[m->header.frames].input, input, 2);
+	m->frames[m->header.frames].hash = hash;
+	m->header.frames++;
+
+	return 0;
+}
+
+/* Returns 0 on success. */
+int
+movie_write(const movie *m, const char *path)
+{
+	FILE *f;
+	int ok;
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "Can't create movie %s.\n", path);
+		return -1;
+	}
+
+	ok = fwrite(&m->header, sizeof(m->header), 1, f) == 1;
+	if (ok && m->start != NULL) {
+		ok = fwrite(m->start, sizeof(*m->start), 1, f) == 1;
+	}
+	if (ok && m->header.frames > 0) {
+		ok = fwrite(m->frames, sizeof(m->frames[0]), m->header.frames, f) == m->header.frames;
+	}
+
+	if (fclose(f) != 0 || !ok) {
+		fprintf(stderr, "Can't write movie %s.\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns 0 on success. */
+int
+movie_read(movie *m, const char *path)
+{
+	FILE *f;
+	int ok;
+
+	memset(m, 0, sizeof(*m));
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Can't open movie %s.\n", path);
+		return -1;
+	}
+
+	ok = fread(&m->header, sizeof(m->header), 1, f) == 1 &&
+	     memcmp(m->header.magic, movie_magic, sizeof(movie_magic)) == 0 &&
+	     m->header.version == MOVIE_VERSION;
+
+	if (ok && m->header.from_state) {
+		m->start = malloc(sizeof(*m->start));
+		ok = m->start != NULL && fread(m->start, sizeof(*m->start), 1, f) == 1 &&
+		     state_valid(m->start);
+	}
+
+	if (ok && m->header.frames > 0) {
+		m->cap = m->header.frames;
+		m->frames = malloc(m->cap * sizeof(m->frames[0]));
+		ok = m->frames != NULL &&
+		     fread(m->frames, sizeof(m->frames[0]), m->cap, f) == m->cap;
+	}
+
+	fclose(f);
+
+	if (!ok) {
+		fprintf(stderr, "%s is not a movie of this version.\n", path);
+		movie_free(m);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the ROM, the start and every frame of input */
+uint64_t
+movie_hash(const movie *m)
+{
+	uint64_t h = m->header.rom_hash;
+
+	if (m->start != NULL) {
+		h = hash64(m->start, sizeof(*m->start), h);
+	}
+
+	return hash64(m->frames, m->header.frames * sizeof(m->frames[0]), h);
+}
+
+void
+checkpoints_init(checkpoints *c, const movie *m, uint32_t every)
+{
+	memset(c, 0, sizeof(*c));
+	memcpy(c->header.magic, checkpoints_magic, sizeof(c->header.magic));
+	c->header.version = STATE_VERSION;
+	c->header.movie_hash = movie_hash(m);
+	c->header.every = every;
+}
+
+void
+checkpoints_free(checkpoints *c)
+{
+	free(c->states);
+	c->states = NULL;
+	c->cap = 0;
+}
+
+/* Returns 0 on success. */
+int
+checkpoints_add(checkpoints *c, const state *s)
+{
+	state *states;
+	size_t cap;
+
+	if (c->header.count == c->cap) {
+		cap = c->cap ? c->cap * 2 : 64;
+		states = realloc(c->states, cap * sizeof(*states));
+		if (states == NULL) {
+			return -1;
+		}
+		c->states = states;
+		c->cap = cap;
+	}
+
+	memcpy(&c->states[c->header.count++], s, sizeof(*s));
+	return 0;
+}
+
+/* Returns 0 on success. */
+int
+checkpoints_write(const checkpoints *c, const char *path)
+{
+	FILE *f;
+	int ok;
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "Can't create checkpoints %s.\n", path);
+		return -1;
+	}
+
+	ok = fwrite(&c->header, sizeof(c->header), 1, f) == 1 &&
+	     fwrite(c->states, sizeof(c->states[0]), c->header.count, f) == c->header.count;
+
+	if (fclose(f) != 0 || !ok) {
+		fprintf(stderr, "Can't write checkpoints %s.\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns 0 on success. */
+int
+checkpoints_read(checkpoints *c, const movie *m, const char *path)
+{
+	FILE *f;
+	uint64_t need;
+	uint32_t i;
+	int ok;
+
+	memset(c, 0, sizeof(*c));
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Can't open checkpoints %s.\n", path);
+		return -1;
+	}
+
+	ok = fread(&c->header, sizeof(c->header), 1, f) == 1 &&
+	     memcmp(c->header.magic, checkpoints_magic, sizeof(checkpoints_magic)) == 0 &&
+	     c->header.version == STATE_VERSION && c->header.every > 0 && c->header.count > 0;
+
+	if (ok) {
+		c->cap = c->header.count;
+		c->states = malloc(c->cap * sizeof(c->states[0]));
+		ok = c->states != NULL &&
+		     fread(c->states, sizeof(c->states[0]), c->cap, f) == c->cap;
+	}
+
+	for (i = 0; ok && i < c->header.count; i++) {
+		ok = state_valid(&c->states[i]);
+	}
+
+	fclose(f);
+
+	if (!ok) {
+		fprintf(stderr, "%s are not checkpoints of this version.\n", path);
+		checkpoints_free(c);
+		return -1;
+	}
+
+	if (c->header.movie_hash != movie_hash(m)) {
+		fprintf(stderr, "%s belongs to another movie.\n", path);
+		checkpoints_free(c);
+		return -1;
+	}
+
+	/* NOTE: one at the start of every segment, a short file would leave
+	 * the frames after its last segment unchecked */
+	need = ((uint64_t)m->header.frames + c->header.every - 1) / c->header.every;
+	if (c->header.count != need) {
+		fprintf(stderr, "%s has %u checkpoints, the movie needs %llu.\n",
+		        path, c->header.count, (unsigned long long)need);
+		checkpoints_free(c);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef NES_MOVIE_H
+#define NES_MOVIE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "state.h"
+
+enum {
+	MOVIE_VERSION = 6 /* 2: XXH3-style state hashes, 3: CHR-RAM in states, 4: four-screen VRAM, 5: no bg_line in states, 6: 5B noise and envelope */
+};
+
+/* NOTE: input movie. The header names the ROM by hash and says where the
+ * run starts: power-on, or a save state stored right after the header.
+ * Every frame records the buttons held on both ports and the hash of the
+ * state at its end, so playback can tell the first frame that went a
+ * different way. Host byte order, like save states. */
+typedef struct {
+	uint8_t magic[4];
+	uint32_t version;
+	uint64_t rom_hash;
+	uint32_t frames;
+	uint32_t from_state;
+} movie_header;
+
+typedef struct {
+	uint8_t input[2];
+	uint8_t reserved[6];
+	uint64_t hash; /* state_hash at the end of the frame */
+} movie_frame;
+
+typedef struct {
+	movie_header header;
+	state *start; /* NULL when the movie starts at power-on */
+	movie_frame *frames;
+	size_t cap;
+} movie;
+
+/* NOTE: checkpoints of a movie. The state at the start of frame 0,
+ * every, 2 * every... so every segment between two of them can be
+ * replayed on its own. They belong to the movie frames they were made
+ * from and to the state layout of the build that made them. */
+typedef struct {
+	uint8_t magic[4];
+	uint32_t version;
+	uint64_t movie_hash;
+	uint32_t every;
+	uint32_t count;
+} checkpoints_header;
+
+typedef struct {
+	checkpoints_header header;
+	state *states;
+	size_t cap;
+} checkpoints;
+
+int movie_init(movie *, uint64_t, const state *);
+void movie_free(movie *);
+int movie_add(movie *, const uint8_t *, uint64_t);
+int movie_write(const movie *, const char *);
+int movie_read(movie *, const char *);
+uint64_t movie_hash(const movie *);
+
+void checkpoints_init(checkpoints *, const movie *, uint32_t);
+void checkpoints_free(checkpoints *);
+int checkpoints_add(checkpoints *, const state *);
+int checkpoints_write(const checkpoints *, const char *);
+int checkpoints_read(checkpoints *, const movie *, const char *);
+
+#endif /* NES_MOVIE_H */
@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <string.h> /* memcpy */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mux.h"
+
+/* NOTE: background/sprite multiplexer.
+ * See: https://www.nesdev.org/wiki/PPU_rendering#Preliminary_notes
+ *
+ * For every pixel:
+ *   bg   spr  behind   result
+ *   0    0    -        backdrop ($3F00)
+ *   0    1-3  -        sprite
+ *   1-3  0    -        background
+ *   1-3  1-3  0        sprite
+ *   1-3  1-3  1        background
+ * Sprite 0 hit happens when both pixels are opaque, except at x = 255.
+ *
+ * The vector paths (AVX2 when the compiler targets it, SSE2 otherwise)
+ * process a whole block of pixels at once and produce a bitmask of
+ * sprite 0 hits; mux_line_scalar is the reference and the fallback. */
+
+enum { LINE_WIDTH = 256 };
+
+#if defined(__AVX2__)
+enum { BLOCK_SIZE = 32 };
+#elif defined(__SSE2__)
+enum { BLOCK_SIZE = 16 };
+#else
+enum { BLOCK_SIZE = 8 };
+#endif
+
+static inline uint8_t
+mux_pixel(uint8_t bg, uint8_t spr, uint8_t *hit)
+{
+	int bg_opaque = (bg & 0x03) != 0;
+	int spr_opaque = (spr & 0x03) != 0;
+
+	*hit = bg_opaque && spr_opaque && (spr & MUX_SPR_ZERO);
+
+	if (spr_opaque && (!bg_opaque || !(spr & MUX_SPR_BEHIND))) {
+		return spr & 0x1F;
+	}
+
+	return bg_opaque ? bg : 0;
+}
+
+static uint32_t
+mux_block_scalar(const uint8_t *bg, const uint8_t *spr, uint8_t *out, int n)
+{
+	uint32_t hits = 0;
+	uint8_t hit;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		out[i] = mux_pixel(bg[i], spr[i], &hit);
+		hits |= (uint32_t)hit << i;
+	}
+
+	return hits;
+}
+
+#if defined(__AVX2__)
+static uint32_t
+mux_block(const uint8_t *bg, const uint8_t *spr, uint8_t *out)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i ones = _mm256_set1_epi8(-1);
+	const __m256i color_mask = _mm256_set1_epi8(0x03);
+	const __m256i behind_mask = _mm256_set1_epi8(MUX_SPR_BEHIND);
+	const __m256i zero_mask = _mm256_set1_epi8(MUX_SPR_ZERO);
+	const __m256i spr_idx_mask = _mm256_set1_epi8(0x1F);
+
+	__m256i b = _mm256_loadu_si256((const __m256i *)bg);
+	__m256i s = _mm256_loadu_si256((const __m256i *)spr);
+
+	__m256i bg_clear = _mm256_cmpeq_epi8(_mm256_and_si256(b, color_mask), zero);
+	__m256i spr_clear = _mm256_cmpeq_epi8(_mm256_and_si256(s, color_mask), zero);
+	__m256i behind = _mm256_cmpeq_epi8(_mm256_and_si256(s, behind_mask), behind_mask);
+	__m256i sprite0 = _mm256_cmpeq_epi8(_mm256_and_si256(s, zero_mask), zero_mask);
+
+	__m256i hit = _mm256_andnot_si256(_mm256_or_si256(bg_clear, spr_clear), sprite0);
+	__m256i use_spr = _mm256_andnot_si256(spr_clear, _mm256_or_si256(bg_clear, _mm256_xor_si256(behind, ones)));
+
+	__m256i res = _mm256_or_si256(
+		_mm256_and_si256(use_spr, _mm256_and_si256(s, spr_idx_mask)),
+		_mm256_andnot_si256(use_spr, _mm256_andnot_si256(bg_clear, b)));
+
+	_mm256_storeu_si256((__m256i *)out, res);
+	return (uint32_t)_mm256_movemask_epi8(hit);
+}
+#elif defined(__SSE2__)
+static uint32_t
+mux_block(const uint8_t *bg, const uint8_t *spr, uint8_t *out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i ones = _mm_set1_epi8(-1);
+	const __m128i color_mask = _mm_set1_epi8(0x03);
+	const __m128i behind_mask = _mm_set1_epi8(MUX_SPR_BEHIND);
+	const __m128i zero_mask = _mm_set1_epi8(MUX_SPR_ZERO);
+	const __m128i spr_idx_mask = _mm_set1_epi8(0x1F);
+
+	__m128i b = _mm_loadu_si128((const __m128i *)bg);
+	__m128i s = _mm_loadu_si128((const __m128i *)spr);
+
+	__m128i bg_clear = _mm_cmpeq_epi8(_mm_and_si128(b, color_mask), zero);
+	__m128i spr_clear = _mm_cmpeq_epi8(_mm_and_si128(s, color_mask), zero);
+	__m128i behind = _mm_cmpeq_epi8(_mm_and_si128(s, behind_mask), behind_mask);
+	__m128i sprite0 = _mm_cmpeq_epi8(_mm_and_si128(s, zero_mask), zero_mask);
+
+	__m128i hit = _mm_andnot_si128(_mm_or_si128(bg_clear, spr_clear), sprite0);
+	__m128i use_spr = _mm_andnot_si128(spr_clear, _mm_or_si128(bg_clear, _mm_xor_si128(behind, ones)));
+
+	__m128i res = _mm_or_si128(
+		_mm_and_si128(use_spr, _mm_and_si128(s, spr_idx_mask)),
+		_mm_andnot_si128(use_spr, _mm_andnot_si128(bg_clear, b)));
+
+	_mm_storeu_si128((__m128i *)out, res);
+	return (uint32_t)_mm_movemask_epi8(hit);
+}
+#else
+static uint32_t
+mux_block(const uint8_t *bg, const uint8_t *spr, uint8_t *out)
+{
+	return mux_block_scalar(bg, spr, out, BLOCK_SIZE);
+}
+#endif
+
+static inline int
+first_hit(uint32_t hits, int x)
+{
+	while (!(hits & 1)) {
+		hits >>= 1;
+		x++;
+	}
+
+	return x;
+}
+
+/* copies the first pixels of the line with the left column masks applied */
+static void
+mask_left_col(const uint8_t *bg, const uint8_t *spr, uint8_t *bg0, uint8_t *spr0, int n, uint8_t flags)
+{
+	memcpy(bg0, bg, (size_t)n);
+	memcpy(spr0, spr, (size_t)n);
+
+	if (!(flags & MUX_BG_LEFT_COL)) {
+		memset(bg0, 0, 8);
+	}
+
+	if (!(flags & MUX_SPR_LEFT_COL)) {
+		memset(spr0, 0, 8);
+	}
+}
+
+/* Merges a background and a sprite line into palette indices (0..0x1F).
+ * Returns x of the first sprite 0 hit or -1. */
+int
+mux_line(const uint8_t *bg, const uint8_t *spr, uint8_t *out, uint8_t flags)
+{
+	uint8_t bg0[BLOCK_SIZE], spr0[BLOCK_SIZE];
+	uint32_t hits;
+	int x, hit_x = -1;
+
+	mask_left_col(bg, spr, bg0, spr0, BLOCK_SIZE, flags);
+	hits = mux_block(bg0, spr0, out);
+
+	if (hits) {
+		hit_x = first_hit(hits, 0);
+	}
+
+	for (x = BLOCK_SIZE; x < LINE_WIDTH; x += BLOCK_SIZE) {
+		hits = mux_block(bg + x, spr + x, out + x);
+
+		if (x + BLOCK_SIZE == LINE_WIDTH) {
+			hits &= ~(1u << (BLOCK_SIZE - 1)); /* no hit at x = 255 */
+		}
+
+		if (hits && hit_x < 0) {
+			hit_x = first_hit(hits, x);
+		}
+	}
+
+	return hit_x;
+}
+
+int
+mux_line_scalar(const uint8_t *bg, const uint8_t *spr, uint8_t *out, uint8_t flags)
+{
+	uint8_t bg0[8], spr0[8];
+	uint32_t hits;
+	int x, hit_x = -1;
+
+	mask_left_col(bg, spr, bg0, spr0, 8, flags);
+	hits = mux_block_scalar(bg0, spr0, out, 8);
+
+	if (hits) {
+		hit_x = first_hit(hits, 0);
+	}
+
+	for (x = 8; x < LINE_WIDTH; x += 8) {
+		hits = mux_block_scalar(bg + x, spr + x, out + x, 8);
+
+		if (x + 8 == LINE_WIDTH) {
+			hits &= ~(1u << 7);
+		}
+
+		if (hits && hit_x < 0) {
+			hit_x = first_hit(hits, x);
+		}
+	}
+
+	return hit_x;
+}
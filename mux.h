@@ -0,0 +1,24 @@
+#ifndef NES_MUX_H
+#define NES_MUX_H
+
+#include <stdint.h>
+
+/* NOTE: line buffer formats.
+ * background: palette index 0..15, 0 if the pixel is transparent.
+ * sprites:    bits 0-1 colour, bits 2-3 palette, bit 4 always set
+ *             (sprite palettes live at $3F10), bit 5 behind background,
+ *             bit 6 pixel belongs to sprite 0. 0 if there is no sprite. */
+enum {
+	MUX_SPR_BEHIND = 0x20,
+	MUX_SPR_ZERO = 0x40
+};
+
+enum {
+	MUX_BG_LEFT_COL = 0x01, /* show background in pixels 0-7 */
+	MUX_SPR_LEFT_COL = 0x02 /* show sprites in pixels 0-7 */
+};
+
+int mux_line(const uint8_t *, const uint8_t *, uint8_t *, uint8_t);
+int mux_line_scalar(const uint8_t *, const uint8_t *, uint8_t *, uint8_t);
+
+#endif /* NES_MUX_H */
@@ -0,0 +1,83 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+
+#include "mux.c"
+
+static uint8_t bg[LINE_WIDTH];
+static uint8_t spr[LINE_WIDTH];
+static uint8_t out[LINE_WIDTH];
+
+static void
+clear_lines(void)
+{
+	memset(bg, 0, sizeof(bg));
+	memset(spr, 0, sizeof(spr));
+	memset(out, 0xAA, sizeof(out));
+}
+
+Test(mux, backdrop) {
+	clear_lines();
+
+	cr_assert(eq(int, mux_line(bg, spr, out, MUX_BG_LEFT_COL | MUX_SPR_LEFT_COL), -1));
+	cr_assert(eq(u8, out[0], 0));
+	cr_assert(eq(u8, out[255], 0));
+}
+
+Test(mux, priority) {
+	clear_lines();
+
+	bg[10] = 0x05;                          /* opaque bg, sprite in front */
+	spr[10] = 0x10 | 0x02;
+	bg[11] = 0x05;                          /* opaque bg, sprite behind */
+	spr[11] = 0x10 | 0x02 | MUX_SPR_BEHIND;
+	bg[12] = 0x04;                          /* transparent bg, sprite behind */
+	spr[12] = 0x10 | 0x0C | 0x01 | MUX_SPR_BEHIND;
+
+	mux_line(bg, spr, out, MUX_BG_LEFT_COL | MUX_SPR_LEFT_COL);
+	cr_assert(eq(u8, out[10], 0x12));
+	cr_assert(eq(u8, out[11], 0x05));
+	cr_assert(eq(u8, out[12], 0x1D));
+}
+
+Test(mux, left_column) {
+	clear_lines();
+
+	bg[3] = 0x01;
+	spr[3] = 0x11 | MUX_SPR_ZERO;
+	bg[9] = 0x01;
+	spr[9] = 0x11 | MUX_SPR_ZERO;
+
+	cr_assert(eq(int, mux_line(bg, spr, out, MUX_SPR_LEFT_COL), 9));
+	cr_assert(eq(u8, out[3], 0x11));
+	cr_assert(eq(int, mux_line(bg, spr, out, MUX_BG_LEFT_COL), 9));
+	cr_assert(eq(u8, out[3], 0x01));
+	cr_assert(eq(int, mux_line(bg, spr, out, MUX_BG_LEFT_COL | MUX_SPR_LEFT_COL), 3));
+}
+
+Test(mux, sprite_zero_last_pixel) {
+	clear_lines();
+
+	bg[255] = 0x01;
+	spr[255] = 0x11 | MUX_SPR_ZERO;
+
+	cr_assert(eq(int, mux_line(bg, spr, out, MUX_BG_LEFT_COL | MUX_SPR_LEFT_COL), -1));
+}
+
+Test(mux, matches_scalar) {
+	uint8_t ref[LINE_WIDTH];
+	uint32_t seed = 1;
+	int i, n;
+	uint8_t flags;
+
+	for (n = 0; n < 64; n++) {
+		for (i = 0; i < LINE_WIDTH; i++) {
+			seed = seed * 1103515245 + 12345;
+			bg[i] = (uint8_t)((seed >> 16) & 0x0F);
+			spr[i] = (seed >> 8) & 0x1 ? (uint8_t)(0x10 | ((seed >> 20) & 0x6F)) : 0;
+		}
+
+		flags = (uint8_t)(n & 0x3);
+		cr_assert(eq(int, mux_line(bg, spr, out, flags), mux_line_scalar(bg, spr, ref, flags)));
+		cr_assert(eq(int, memcmp(out, ref, LINE_WIDTH), 0));
+	}
+}
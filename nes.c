@@ -1,43 +1,293 @@
+#define _POSIX_C_SOURCE 200112L /* clock_gettime, access */
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "audio.h"
 #include "bus.h"
+#include "explore.h"
 //#include "cartrige.h"
 #include "gfx.h"
+#include "hash.h"
+#include "history.h"
+#include "input.h"
+#include "movie.h"
+#include "net.h"
+#include "nsf.h"
+#include "pool.h"
+#include "resample.h"
+#include "rollback.h"
+#include "state.h"
+#include "wav.h"
+
+#define NES_FRAME_MS (1e3 / 60.0988) /* NTSC */
+
+enum {
+	AUDIO_FRAME_SAMPLES = 4096,
+	NSF_FRAME_CYCLES = 29781, /* NSF mode has no PPU to end frames */
+	RUN_AHEAD_MAX = 8,
+	REWIND_MB = 32 /* default rewind buffer of the window mode */
+};
 
 typedef struct {
-	/* r2A03 apu */
 	bus bus;
 	r2A03 cpu;
 	r2C02 ppu;
+	apu apu;
 	cartrige rom;
 	uint8_t ram[RAM_SIZE];
+	resampler resampler;
+	int audio_rate;
+	int audio_quality;
+	nsf nsf;
+	int is_nsf;
+	int song;
+	uint8_t input[2]; /* buttons held during the next frame */
+	uint32_t frame_buf[SCREEN_WIDTH * SCREEN_HEIGHT];
+	int run_ahead;    /* frames emulated ahead of the one shown */
+	state snap;       /* end of the last real frame */
+	uint32_t snap_epoch;
+	double ahead_time;
+	long ahead_frames;
+	history history;
+	int rewind_mb;
+	double rewind_time;
+	long rewind_frames;
+	char state_file[4096]; /* F5/F7 */
+	movie movie;
+	const char *record; /* movie file being recorded, NULL if not */
+	net *net;           /* netplay, NULL if not */
+	rollback rollback;
+	int player;         /* port of the local player */
+	uint32_t net_epochs[ROLLBACK_WINDOW]; /* of the rollback snapshots */
+	double redo_time;
 } nes;
 
 static void
 nes_cleanup(nes *n)
 {
 	cartrige_free(&n->rom);
-	gfx_destroy();
+	history_free(&n->history);
+	movie_free(&n->movie);
+	rollback_free(&n->rollback);
 }
 
-static void
+static int
 nes_loadrom(nes *n, const char *path)
 {
-	n->rom = cartrige_create(path);
-	// TODO: handle invalid result
+	n->is_nsf = nsf_probe(path);
+	n->rom = n->is_nsf ? nsf_load(&n->nsf, path) : cartrige_create(path);
+
+	return n->rom.invalid ? -1 : 0;
+}
+
+/* NOTE: the PPU only reaches the CPU through its registers, which catch
+ * it up themselves, and through the NMI at vblank. So the CPU runs an
+ * instruction at a time, up to the next scheduler deadline, and the PPU
+ * runs whatever it owes at once when the CPU looks and at vblank.
+ * TODO: mappers that watch the PPU's reads (MMC2, MMC3) need a deadline
+ * of their own */
+static void
+nes_run_to_vblank(nes *n)
+{
+	bus *b = &n->bus;
+	uint64_t vblank = bus_ppu_next_vblank(b);
+
+	while (n->cpu.total < vblank) {
+		if (sched_due(&b->sched, n->cpu.total)) {
+			bus_sched_run(b);
+		}
+
+		bus_cpu_tick(b);
+		cpu_idle_until(&n->cpu, vblank < b->sched.next ? vblank : b->sched.next);
+	}
+
+	bus_ppu_run_until(b, n->cpu.total);
+}
+
+/* runs until the PPU has a complete picture, drawn into frame_buf only if
+ * somebody is going to look at it */
+static void
+nes_frame(nes *n, int draw)
+{
+	bus_pad_set(&n->bus, 0, n->input[0]);
+	bus_pad_set(&n->bus, 1, n->input[1]);
+
+	if (n->is_nsf) {
+		nsf_run_until(&n->nsf, &n->bus, n->cpu.total + NSF_FRAME_CYCLES);
+		return;
+	}
+
+	ppu_set_frame_buf(&n->ppu, draw ? n->frame_buf : NULL);
+
+	while (!bus_ppu_get_frame_ready_flag(&n->bus)) {
+		nes_run_to_vblank(n);
+	}
+
+	bus_ppu_unset_frame_ready_flag(&n->bus);
+}
+
+/* the frame's audio at the host rate */
+static int
+nes_mix(nes *n, int16_t *out)
+{
+	int16_t samples[AUDIO_FRAME_SAMPLES];
+	int count;
+
+	bus_apu_end_frame(&n->bus);
+	count = bus_apu_read_samples(&n->bus, samples, AUDIO_FRAME_SAMPLES);
+
+	return resample_run(&n->resampler, samples, count, out, AUDIO_FRAME_SAMPLES);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* the audio of frames that are never heard */
+static void
+nes_drop_audio(nes *n)
+{
+	int16_t drop[AUDIO_FRAME_SAMPLES];
+
+	bus_apu_end_frame(&n->bus);
+	bus_apu_read_samples(&n->bus, drop, AUDIO_FRAME_SAMPLES);
+}
+
+/* the console as it is now in n->snap, only the memory written since the
+ * last time is copied */
+static void
+nes_snap(nes *n)
+{
+	n->snap_epoch = state_update(&n->snap, &n->bus, n->snap_epoch);
+}
+
+/* NOTE: run-ahead hides the game's own input lag. After the real frame
+ * the next run_ahead frames are emulated with the same input, only the
+ * last one is drawn and its audio is dropped, then the console is rolled
+ * back to the end of the real frame. */
+static void
+nes_run_ahead(nes *n)
+{
+	double start;
+	int i;
+
+	if (n->run_ahead == 0) {
+		return;
+	}
+
+	start = now();
+	nes_snap(n);
+
+	for (i = 1; i <= n->run_ahead; i++) {
+		nes_frame(n, i == n->run_ahead);
+		nes_drop_audio(n);
+	}
+
+	state_load(&n->bus, &n->snap);
+
+	n->ahead_time += now() - start;
+	n->ahead_frames += n->run_ahead;
+}
+
+static void
+nes_report_run_ahead(const nes *n)
+{
+	double ms;
+
+	if (n->ahead_frames == 0) {
+		return;
+	}
+
+	ms = n->ahead_time * 1e3 / (double)n->ahead_frames;
+	printf("run-ahead %d: %.3f ms per extra frame (%.1f%% of a frame)\n",
+	       n->run_ahead, ms, 100 * ms / NES_FRAME_MS);
+}
+
+/* every real frame goes into the rewind buffer. Run-ahead already took
+ * the snapshot. */
+static void
+nes_record(nes *n)
+{
+	double start;
+
+	if (n->history.size == 0) {
+		return;
+	}
+
+	start = now();
+	if (n->run_ahead == 0) {
+		nes_snap(n);
+	}
+	history_push(&n->history, &n->snap);
+
+	n->rewind_time += now() - start;
+	n->rewind_frames++;
+}
+
+/* the input of every real frame and the state it ended in */
+static void
+nes_record_movie(nes *n)
+{
+	if (n->record == NULL) {
+		return;
+	}
+
+	nes_snap(n);
+	if (movie_add(&n->movie, n->input, state_hash(&n->snap)) != 0) {
+		fprintf(stderr, "No memory for the movie, recording stopped.\n");
+		n->record = NULL;
+	}
+}
+
+/* NOTE: the state hash covers everything the console determines (see
+ * state_save), the frame hash only the picture, for video-only checks.
+ * Both take microseconds. */
+static void
+nes_print_hashes(nes *n, long frame)
+{
+	nes_snap(n);
+	printf("frame %ld state %016llx video %016llx\n", frame,
+	       (unsigned long long)state_hash(&n->snap),
+	       (unsigned long long)hash64(n->frame_buf, sizeof(n->frame_buf), 0));
 }
 
+/* one frame back in time. The frame after the restored state is run
+ * again (silently) to have something to show. */
 static void
-nes_tick(nes *n)
+nes_rewind(nes *n)
 {
-	/* bus_apu_tick(&n->bus); */
-	bus_cpu_tick(&n->bus);
+	if (history_back(&n->history, &n->snap) != 0) {
+		return; /* reached the oldest frame */
+	}
+
+	state_load(&n->bus, &n->snap);
+	nes_frame(n, 1);
+	nes_drop_audio(n);
+}
+
+static void
+nes_report_rewind(const nes *n)
+{
+	double ms;
+
+	if (n->rewind_frames == 0) {
+		return;
+	}
 
-	bus_ppu_tick(&n->bus);
-	bus_ppu_tick(&n->bus);
-	bus_ppu_tick(&n->bus);
+	ms = n->rewind_time * 1e3 / (double)n->rewind_frames;
+	printf("rewind: %.3f ms per frame (%.1f%% of a frame), %zu frames in %.1f MB\n",
+	       ms, 100 * ms / NES_FRAME_MS, n->history.count,
+	       (double)history_used(&n->history) / (1 << 20));
 }
 
 static uint8_t
@@ -47,49 +297,996 @@ nes_should_exit(nes *n)
 }
 
 static void
-nes_draw(nes *n)
+nes_play(nes *n)
 {
-	uint8_t flag = bus_ppu_get_frame_ready_flag(&n->bus);
+	int16_t out[AUDIO_FRAME_SAMPLES];
 
-	if (flag) {
-		bus_ppu_unset_frame_ready_flag(&n->bus);
-		gfx_draw_frame(n->ppu.frame_buf);
+	resample_set_ratio(&n->resampler, audio_rate_ratio());
+	audio_push(out, nes_mix(n, out));
+}
+
+static int
+nes_save_state(nes *n, const char *path)
+{
+	static state s;
+
+	if (n->is_nsf) {
+		fprintf(stderr, "NSF player has no states.\n");
+		return -1;
+	}
+
+	state_save(&s, &n->bus);
+	return state_write(&s, path);
+}
+
+static int
+nes_load_state(nes *n, const char *path)
+{
+	static state s;
+
+	if (n->is_nsf) {
+		fprintf(stderr, "NSF player has no states.\n");
+		return -1;
+	}
+
+	if (n->record != NULL) {
+		fprintf(stderr, "Can't load a state while recording a movie.\n");
+		return -1;
+	}
+
+	if (state_read(&s, path) != 0) {
+		return -1;
+	}
+
+	state_load(&n->bus, &s);
+	return 0;
+}
+
+/* NOTE: netplay. The local player's input goes into the next frame right
+ * away, the remote one is guessed (see rollback.h). A frame run on a
+ * guess starts by saving the state, so a wrong guess costs a state_load
+ * and a few frames that are neither drawn nor heard. Frames whose remote
+ * input is known are never run again and save nothing. */
+static void
+nes_net_run(nes *n, uint32_t f, int draw)
+{
+	rollback *r = &n->rollback;
+
+	if (f >= r->confirmed) {
+		n->net_epochs[f % ROLLBACK_WINDOW] =
+			state_update(rollback_snap(r, f), &n->bus, n->net_epochs[f % ROLLBACK_WINDOW]);
+	}
+	n->input[n->player] = r->local[f % ROLLBACK_WINDOW];
+	n->input[!n->player] = rollback_remote_input(r, f);
+	nes_frame(n, draw);
+}
+
+/* everything the peer said by t, then the frames guessed wrong again */
+static void
+nes_net_sync(nes *n, double t)
+{
+	rollback *r = &n->rollback;
+	net_packet p;
+	uint32_t f, i;
+	double start;
+
+	while (net_recv(n->net, &p, t)) {
+		if (p.count == 0 || p.count > NET_INPUTS || p.frame + 1 < p.count) {
+			continue;
+		}
+		for (i = 0; i < p.count; i++) {
+			rollback_remote(r, p.frame + 1 - p.count + i, p.input[i]);
+		}
+	}
+
+	f = rollback_redo(r);
+	if (f == r->frame) {
+		return;
+	}
+
+	start = now();
+	state_load(&n->bus, rollback_snap(r, f));
+	for (; f < r->frame; f++) {
+		nes_net_run(n, f, 0);
+		nes_drop_audio(n);
+	}
+	n->redo_time += now() - start;
+}
+
+/* our inputs so far, again and again until the peer has them */
+static void
+nes_net_send(nes *n)
+{
+	rollback *r = &n->rollback;
+	net_packet p = {0};
+	uint32_t i;
+
+	if (r->frame == 0) {
+		return;
+	}
+
+	p.frame = r->frame - 1;
+	p.count = r->frame < NET_INPUTS ? r->frame : NET_INPUTS;
+	for (i = 0; i < p.count; i++) {
+		p.input[i] = r->local[(r->frame - p.count + i) % ROLLBACK_WINDOW];
+	}
+
+	net_send(n->net, &p);
+}
+
+/* Runs the next frame with the local input and returns 1, or 0 if it has
+ * to wait for the peer. Its audio is left to the caller. */
+static int
+nes_net_step(nes *n, uint8_t input, int draw)
+{
+	rollback *r = &n->rollback;
+	int ran = 0;
+
+	if (rollback_can_run(r)) {
+		r->local[r->frame % ROLLBACK_WINDOW] = input;
+		nes_net_run(n, r->frame, draw);
+		rollback_done(r);
+		ran = 1;
+	}
+
+	nes_net_send(n);
+	return ran;
+}
+
+static int
+nes_net_start(nes *n, net *net, int player)
+{
+	if (n->is_nsf) {
+		fprintf(stderr, "NSF player has no netplay.\n");
+		return -1;
+	}
+
+	if (rollback_init(&n->rollback, sizeof(state)) != 0) {
+		fprintf(stderr, "No memory for netplay.\n");
+		return -1;
+	}
+
+	n->net = net;
+	n->player = player;
+	return 0;
+}
+
+static void
+nes_report_net(const nes *n)
+{
+	const rollback *r = &n->rollback;
+	double ms;
+
+	if (r->redone == 0) {
+		printf("netplay: %u frames, no rollbacks\n", r->frame);
+		return;
 	}
+
+	ms = n->redo_time * 1e3 / (double)r->redone;
+	printf("netplay: %u frames, %llu rollbacks, %llu frames run again (%u at most)\n",
+	       r->frame, (unsigned long long)r->rollbacks,
+	       (unsigned long long)r->redone, r->longest);
+	printf("netplay: %.3f ms per frame run again, %d take %.1f%% of a frame\n",
+	       ms, ROLLBACK_FRAMES, 100 * ms * ROLLBACK_FRAMES / NES_FRAME_MS);
+}
+
+static uint64_t
+nes_state_hash(nes *n)
+{
+	nes_snap(n);
+	return state_hash(&n->snap);
 }
 
 static void
 nes_runloop(nes *n)
 {
+	char title[128];
+
+	gfx_init(); // TODO: create layer for holding array
+	audio_init(n->audio_rate);
+
+	if (n->is_nsf) {
+		snprintf(title, sizeof(title), "%s - %s (%d/%d)",
+		         n->nsf.artist, n->nsf.name, n->song, n->nsf.songs);
+		gfx_set_title(title);
+	}
+
 	while (!nes_should_exit(n)) {
-		nes_tick(n);
-		nes_draw(n);
+		/* NOTE: no states and no rewind, the peer wouldn't follow */
+		if (n->net != NULL) {
+			nes_net_sync(n, now());
+			if (nes_net_step(n, input_read(0), 1)) {
+				nes_play(n);
+			}
+			gfx_draw_frame(n->frame_buf);
+			continue;
+		}
+
+		n->input[0] = input_read(0);
+		n->input[1] = input_read(1);
+
+		switch (input_hotkey()) {
+			case INPUT_SAVE_STATE:
+				nes_save_state(n, n->state_file);
+				break;
+			case INPUT_LOAD_STATE:
+				nes_load_state(n, n->state_file);
+				break;
+		}
+
+		if (n->history.size != 0 && input_rewind()) {
+			nes_rewind(n);
+			gfx_draw_frame(n->frame_buf);
+			continue;
+		}
+
+		nes_frame(n, n->run_ahead == 0);
+		nes_play(n);
+		nes_run_ahead(n);
+		nes_record(n);
+		nes_record_movie(n);
+		cartrige_flush(&n->bus.rom);
+		gfx_draw_frame(n->frame_buf);
+	}
+
+	audio_destroy();
+	gfx_destroy();
+	nes_report_run_ahead(n);
+	nes_report_rewind(n);
+	if (n->net != NULL) {
+		nes_report_net(n);
+	}
+}
+
+/* NOTE: no window, no audio device and no frame pacing. The emulation runs
+ * as fast as it can, the WAV file (if any) is written by another thread. */
+static int
+nes_run_headless(nes *n, long frames, const char *wavfile, const char *save, int hashes)
+{
+	static wav_writer wav;
+	int16_t out[AUDIO_FRAME_SAMPLES];
+	uint64_t samples = 0;
+	double start, elapsed;
+	int count;
+	long f;
+
+	if (wavfile != NULL && wav_open(&wav, wavfile, n->audio_rate) != 0) {
+		return -1;
+	}
+
+	start = now();
+
+	for (f = 0; f < frames; f++) {
+		nes_frame(n, n->run_ahead == 0);
+		count = nes_mix(n, out);
+		nes_run_ahead(n);
+		nes_record(n);
+		nes_record_movie(n);
+		cartrige_flush(&n->bus.rom);
+		samples += (uint64_t)count;
+
+		if (hashes) {
+			nes_print_hashes(n, f);
+		}
+
+		if (wavfile != NULL) {
+			wav_write(&wav, out, count);
+		}
+	}
+
+	if (wavfile != NULL && wav_close(&wav) != 0) {
+		fprintf(stderr, "%s: write failed\n", wavfile);
+		return -1;
 	}
+
+	elapsed = now() - start;
+	printf("%ld frames, %llu samples in %.3f s: %.0f samples/s (%.1fx realtime)\n",
+	       frames, (unsigned long long)samples, elapsed,
+	       (double)samples / elapsed, (double)samples / n->audio_rate / elapsed);
+	nes_report_run_ahead(n);
+	nes_report_rewind(n);
+
+	return save != NULL ? nes_save_state(n, save) : 0;
+}
+
+/* the movie starts here, from power-on or from the state just loaded */
+static int
+nes_start_movie(nes *n, const char *path, int from_state)
+{
+	if (n->is_nsf) {
+		fprintf(stderr, "NSF player can't record movies.\n");
+		return -1;
+	}
+
+	nes_snap(n);
+	if (movie_init(&n->movie, cartrige_hash(&n->rom), from_state ? &n->snap : NULL) != 0) {
+		fprintf(stderr, "No memory for the movie.\n");
+		return -1;
+	}
+
+	n->record = path;
+	return 0;
 }
 
 static void
 nes_init(nes *n)
 {
-	bus_init(&n->bus, &n->cpu, &n->ppu, n->ram, n->rom);
+	/* NOTE: NSF tunes run without a PPU */
+	bus_init(&n->bus, &n->cpu, n->is_nsf ? NULL : &n->ppu, &n->apu, n->ram, n->rom);
 	bus_ram_reset(&n->bus);
 	bus_cpu_reset(&n->bus);
-	bus_ppu_reset(&n->bus);
-	gfx_init(); // TODO: create layer for holding array
+	if (!n->is_nsf) {
+		bus_ppu_reset(&n->bus);
+	}
+	bus_apu_reset(&n->bus);
+	resample_init(&n->resampler, n->audio_quality, APU_SAMPLE_RATE, n->audio_rate);
+
+	if (n->rewind_mb > 0 && !n->is_nsf &&
+	    history_init(&n->history, sizeof(state), (size_t)n->rewind_mb << 20) != 0) {
+		fprintf(stderr, "No memory for %d MB of rewind, disabled.\n", n->rewind_mb);
+	}
+
+	if (n->is_nsf) {
+		n->run_ahead = 0; /* nothing to see */
+		n->rewind_mb = 0;
+		if (n->song < 1 || n->song > n->nsf.songs) {
+			n->song = n->nsf.start_song;
+		}
+		nsf_start(&n->nsf, &n->bus, n->song);
+	}
+}
+
+/* NOTE: movie replay. Nothing is drawn or heard, the end state of every
+ * frame is hashed and compared with the recording. Returns the first
+ * frame in [from, to) that differs, -1 if none, -2 if the checkpoints
+ * ran out of memory. The state at the start of every c->header.every'th
+ * frame goes into the checkpoints, if any. */
+static long
+nes_replay(nes *n, const movie *m, uint32_t from, uint32_t to, checkpoints *c)
+{
+	uint32_t f;
+
+	for (f = from; f < to; f++) {
+		if (c != NULL && f % c->header.every == 0) {
+			nes_snap(n);
+			if (checkpoints_add(c, &n->snap) != 0) {
+				fprintf(stderr, "No memory for checkpoints.\n");
+				return -2;
+			}
+		}
+
+		memcpy(n->input, m->frames[f].input, sizeof(n->input));
+		nes_frame(n, 0);
+		nes_drop_audio(n);
+
+		nes_snap(n);
+		if (state_hash(&n->snap) != m->frames[f].hash) {
+			return (long)f;
+		}
+	}
+
+	return -1;
+}
+
+/* a console of its own for a worker thread, on the same ROM */
+static nes *
+nes_clone(const nes *base)
+{
+	nes *n = calloc(1, sizeof(*n));
+
+	if (n == NULL) {
+		return NULL;
+	}
+
+	n->rom = cartrige_clone(&base->rom);
+	n->audio_rate = base->audio_rate;
+	n->audio_quality = base->audio_quality;
+	nes_init(n);
+
+	return n;
+}
+
+static void
+nes_clone_free(nes *n)
+{
+	if (n != NULL) {
+		nes_cleanup(n);
+		free(n);
+	}
+}
+
+typedef struct {
+	const movie *movie;
+	const checkpoints *ckpt;
+	nes **consoles; /* one per worker */
+	long *bad;      /* first bad frame of every segment, -1 if none */
+} verify_job;
+
+/* one segment starts at its checkpoint and has to arrive at the next */
+static void
+nes_verify_segment(void *arg, int seg, int worker)
+{
+	verify_job *j = arg;
+	nes *n = j->consoles[worker];
+	uint32_t every = j->ckpt->header.every;
+	uint32_t from = (uint32_t)seg * every;
+	uint32_t to = from + every < j->movie->header.frames ? from + every : j->movie->header.frames;
+	long bad;
+
+	state_load(&n->bus, &j->ckpt->states[seg]);
+	bad = nes_replay(n, j->movie, from, to, NULL);
+
+	if (bad < 0 && (uint32_t)seg + 1 < j->ckpt->header.count &&
+	    state_hash(&n->snap) != state_hash(&j->ckpt->states[seg + 1])) {
+		bad = (long)to - 1;
+	}
+
+	j->bad[seg] = bad;
+}
+
+/* Returns the first bad frame of all segments, -1 if none, -2 if the
+ * consoles couldn't be made. */
+static long
+nes_verify_parallel(nes *n, const movie *m, const checkpoints *c, int threads)
+{
+	verify_job j;
+	long bad = -1;
+	uint32_t i;
+	int w;
+
+	j.movie = m;
+	j.ckpt = c;
+	j.consoles = calloc((size_t)threads, sizeof(nes *));
+	j.bad = calloc(c->header.count, sizeof(long));
+
+	for (w = 0; j.consoles != NULL && w < threads; w++) {
+		if ((j.consoles[w] = nes_clone(n)) == NULL) {
+			break;
+		}
+	}
+
+	if (j.consoles == NULL || j.bad == NULL || w < threads) {
+		fprintf(stderr, "No memory for %d consoles.\n", threads);
+		bad = -2;
+	} else {
+		pool_run(threads, (int)c->header.count, nes_verify_segment, &j);
+
+		for (i = 0; i < c->header.count && bad < 0; i++) {
+			bad = j.bad[i];
+		}
+	}
+
+	for (w = 0; j.consoles != NULL && w < threads; w++) {
+		nes_clone_free(j.consoles[w]);
+	}
+	free(j.consoles);
+	free(j.bad);
+
+	return bad;
+}
+
+/* NOTE: plays a movie back headless as fast as possible. With a
+ * checkpoint file that doesn't exist yet the replay is serial and drops
+ * a checkpoint every 'every' frames. Once it exists, the segments between
+ * checkpoints are verified in parallel on 'threads' threads. */
+static int
+nes_play_movie(nes *n, const char *path, const char *ckpt_path, uint32_t every, int threads)
+{
+	movie m;
+	checkpoints c = {0};
+	double start, elapsed;
+	int parallel = 0;
+	long bad;
+
+	if (movie_read(&m, path) != 0) {
+		return -1;
+	}
+
+	if (m.header.rom_hash != cartrige_hash(&n->rom)) {
+		fprintf(stderr, "%s was recorded with another ROM.\n", path);
+		movie_free(&m);
+		return -1;
+	}
+
+	if (m.start != NULL) {
+		state_load(&n->bus, m.start);
+	}
+
+	if (ckpt_path != NULL && access(ckpt_path, F_OK) == 0) {
+		if (checkpoints_read(&c, &m, ckpt_path) != 0) {
+			movie_free(&m);
+			return -1;
+		}
+		parallel = 1;
+	} else if (ckpt_path != NULL) {
+		checkpoints_init(&c, &m, every);
+	}
+
+	start = now();
+	if (parallel) {
+		bad = nes_verify_parallel(n, &m, &c, threads);
+	} else {
+		bad = nes_replay(n, &m, 0, m.header.frames, ckpt_path != NULL ? &c : NULL);
+	}
+	elapsed = now() - start;
+
+	if (bad >= 0) {
+		printf("desync at frame %ld\n", bad);
+	} else if (bad == -1 && parallel) {
+		printf("%u frames in %u segments verified on %d threads in %.3f s (%.0f fps)\n",
+		       m.header.frames, c.header.count, threads, elapsed, m.header.frames / elapsed);
+	} else if (bad == -1) {
+		printf("%u frames verified in %.3f s (%.0f fps)\n",
+		       m.header.frames, elapsed, m.header.frames / elapsed);
+	}
+
+	if (bad == -1 && ckpt_path != NULL && !parallel) {
+		bad = checkpoints_write(&c, ckpt_path) == 0 ? -1 : -2;
+	}
+
+	checkpoints_free(&c);
+	movie_free(&m);
+
+	return bad == -1 ? 0 : -1;
+}
+
+typedef struct {
+	nes *nes;
+	int depth;        /* frames of every branch */
+	uint16_t addr;    /* RAM address of the objective */
+	int bytes;        /* little endian, 1 to 4 */
+} explore_job;
+
+/* NOTE: branch inputs are made up, not stored: new buttons every 8
+ * frames, the same ones for the same branch and frame every time */
+static uint8_t
+nes_branch_input(int branch, int frame)
+{
+	int32_t key[2] = { branch, frame / 8 };
+	uint8_t b = (uint8_t)hash64(key, sizeof(key), 0);
+
+	if ((b & (PAD_UP | PAD_DOWN)) == (PAD_UP | PAD_DOWN)) {
+		b &= (uint8_t)~PAD_DOWN;
+	}
+	if ((b & (PAD_LEFT | PAD_RIGHT)) == (PAD_LEFT | PAD_RIGHT)) {
+		b &= (uint8_t)~PAD_RIGHT;
+	}
+
+	return b;
+}
+
+static void
+nes_run_branch(nes *n, int branch, int depth)
+{
+	int f;
+
+	for (f = 0; f < depth; f++) {
+		n->input[0] = nes_branch_input(branch, f);
+		n->input[1] = 0;
+		nes_frame(n, 0);
+		nes_drop_audio(n);
+		nes_record_movie(n);
+	}
+}
+
+/* runs in the child */
+static int64_t
+nes_explore_branch(void *arg, int branch)
+{
+	explore_job *j = arg;
+	int64_t score = 0;
+	int i;
+
+	j->nes->record = NULL;
+	cartrige_detach(&j->nes->bus.rom);
+	nes_run_branch(j->nes, branch, j->depth);
+
+	for (i = j->bytes - 1; i >= 0; i--) {
+		score = score << 8 | j->nes->ram[(j->addr + i) & (RAM_SIZE - 1)];
+	}
+
+	return score;
+}
+
+/* NOTE: input search. Tries 'branches' input sequences of 'depth' frames
+ * from here, each in a forked copy of the emulator, scores them by a
+ * value in RAM and goes on with the best one, so a save state or movie
+ * gets the winner. */
+static int
+nes_explore(nes *n, int branches, const explore_job *job, int jobs)
+{
+	explore_job j = *job;
+	int64_t *scores;
+	double start, elapsed;
+	int i, best = -1, done;
+
+	if (n->is_nsf) {
+		fprintf(stderr, "NSF player has nothing to explore.\n");
+		return -1;
+	}
+
+	if ((scores = malloc((size_t)branches * sizeof(*scores))) == NULL) {
+		fprintf(stderr, "No memory for %d branches.\n", branches);
+		return -1;
+	}
+
+	j.nes = n;
+	start = now();
+	done = explore_run(branches, jobs, nes_explore_branch, &j, scores);
+	elapsed = now() - start;
+
+	for (i = 0; i < branches; i++) {
+		if (scores[i] != EXPLORE_FAILED && (best < 0 || scores[i] > scores[best])) {
+			best = i;
+		}
+	}
+
+	if (best < 0) {
+		fprintf(stderr, "No branch finished.\n");
+		free(scores);
+		return -1;
+	}
+
+	printf("%d of %d branches of %d frames in %.3f s (%.0f branches/s)\n",
+	       done, branches, j.depth, elapsed, done / elapsed);
+	printf("best: branch %d, $%04X = %lld\n",
+	       best, j.addr, (long long)scores[best]);
+
+	nes_run_branch(n, best, j.depth);
+	free(scores);
+
+	return 0;
+}
+
+/* NOTE: headless netplay against another process, paced at 60 fps like
+ * the real thing. Made up input (see nes_branch_input), one sequence per
+ * player, so both ends and a plain run can be compared. Once all frames
+ * are confirmed we keep sending for a while in case the peer still needs
+ * our last inputs. */
+static int
+nes_run_net_headless(nes *n, uint32_t frames)
+{
+	rollback *r = &n->rollback;
+	struct timespec ts;
+	double next = now(), wait;
+	int linger = 30;
+
+	while (r->frame < frames || r->confirmed < frames || linger-- > 0) {
+		nes_net_sync(n, now());
+		if (r->frame < frames) {
+			if (nes_net_step(n, nes_branch_input(n->player, (int)r->frame), 0)) {
+				nes_drop_audio(n);
+			}
+		} else {
+			nes_net_send(n);
+		}
+
+		next += NES_FRAME_MS / 1e3;
+		if ((wait = next - now()) > 0) {
+			ts.tv_sec = (time_t)wait;
+			ts.tv_nsec = (long)((wait - (double)ts.tv_sec) * 1e9);
+			nanosleep(&ts, NULL);
+		}
+	}
+
+	printf("frame %u state %016llx\n", frames, (unsigned long long)nes_state_hash(n));
+	nes_report_net(n);
+	return 0;
+}
+
+/* NOTE: both players in this process over the loopback transport, on a
+ * clock of their own so latency and jitter are the same on every run.
+ * Both have to end where one console given both inputs in time does. */
+static int
+nes_run_net_loopback(nes *n, uint32_t frames, double latency, double jitter)
+{
+	static net ends[2];
+	nes *peers[2] = { n, NULL }, *ref = NULL;
+	uint64_t hashes[3];
+	uint32_t f;
+	double t;
+	int i, res = -1;
+
+	net_loopback(&ends[0], &ends[1]);
+	for (i = 0; i < 2; i++) {
+		net_simulate(&ends[i], latency, jitter, (uint32_t)i + 1);
+	}
+
+	if ((peers[1] = nes_clone(n)) == NULL || (ref = nes_clone(n)) == NULL ||
+	    nes_net_start(peers[0], &ends[0], 0) != 0 ||
+	    nes_net_start(peers[1], &ends[1], 1) != 0) {
+		goto out;
+	}
+
+	for (t = 0; peers[0]->rollback.confirmed < frames || peers[1]->rollback.confirmed < frames ||
+	            peers[0]->rollback.frame < frames || peers[1]->rollback.frame < frames;
+	     t += NES_FRAME_MS / 1e3) {
+		for (i = 0; i < 2; i++) {
+			nes_net_sync(peers[i], t);
+			if (peers[i]->rollback.frame < frames) {
+				if (nes_net_step(peers[i], nes_branch_input(i, (int)peers[i]->rollback.frame), 0)) {
+					nes_drop_audio(peers[i]);
+				}
+			} else {
+				nes_net_send(peers[i]);
+			}
+		}
+	}
+
+	for (f = 0; f < frames; f++) {
+		ref->input[0] = nes_branch_input(0, (int)f);
+		ref->input[1] = nes_branch_input(1, (int)f);
+		nes_frame(ref, 0);
+		nes_drop_audio(ref);
+	}
+
+	hashes[0] = nes_state_hash(peers[0]);
+	hashes[1] = nes_state_hash(peers[1]);
+	hashes[2] = nes_state_hash(ref);
+	printf("frame %u state %016llx %016llx, without netplay %016llx\n", frames,
+	       (unsigned long long)hashes[0], (unsigned long long)hashes[1],
+	       (unsigned long long)hashes[2]);
+	nes_report_net(peers[0]);
+
+	if (hashes[0] == hashes[2] && hashes[1] == hashes[2]) {
+		res = 0;
+	} else {
+		fprintf(stderr, "netplay: consoles went different ways.\n");
+	}
+
+out:
+	n->net = NULL;
+	nes_clone_free(peers[1]);
+	nes_clone_free(ref);
+	return res;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: ./fami [--palette file.pal] [--audio-rate hz]\n"
+	                "              [--audio-quality low|medium|high]\n"
+	                "              [--frames n [--wav out.wav]] [--track n]\n"
+	                "              [--run-ahead n] [--load-state file]\n"
+	                "              [--save-state file] [--rewind-mb n]\n"
+	                "              [--record movie | --play movie] [--hash]\n"
+	                "              [--checkpoints file [--every n] [--jobs n]]\n"
+	                "              [--explore n --objective addr[:bytes] [--depth n]]\n"
+	                "              [--netplay loopback|port:peerport [--player 1|2]\n"
+	                "               [--latency ms] [--jitter ms]]\n"
+	                "              romfile|nsffile\n");
+	exit(EXIT_FAILURE);
 }
 
 int
 main(int argc, char **argv)
 {
 	nes n = {0};
+	const char *romfile = NULL;
+	const char *wavfile = NULL;
+	const char *load = NULL, *save = NULL;
+	const char *record = NULL, *play = NULL, *ckpt = NULL;
+	long frames = 0, every = 600;
+	explore_job job = { NULL, 60, 0, 0 };
+	int jobs = 0, branches = 0;
+	const char *netplay = NULL;
+	int port = 0, peer = 0, player = 1;
+	double latency = 0, jitter = 0;
+	net link;
+	char *end;
+	int i, hashes = 0, res = 0;
+
+	n.audio_rate = AUDIO_SAMPLE_RATE;
+	n.audio_quality = RESAMPLE_MEDIUM;
+	n.rewind_mb = -1;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--palette") == 0 && i + 1 < argc) {
+			if (ppu_load_palette(argv[++i]) != 0) {
+				exit(EXIT_FAILURE);
+			}
+		} else if (strcmp(argv[i], "--audio-rate") == 0 && i + 1 < argc) {
+			n.audio_rate = atoi(argv[++i]);
+			if (n.audio_rate < 8000 || n.audio_rate > APU_SAMPLE_RATE) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--audio-quality") == 0 && i + 1 < argc) {
+			n.audio_quality = resample_quality(argv[++i]);
+			if (n.audio_quality < 0) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frames = atol(argv[++i]);
+			if (frames <= 0) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--track") == 0 && i + 1 < argc) {
+			n.song = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+			n.run_ahead = atoi(argv[++i]);
+			if (n.run_ahead < 0 || n.run_ahead > RUN_AHEAD_MAX) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--rewind-mb") == 0 && i + 1 < argc) {
+			n.rewind_mb = atoi(argv[++i]);
+			if (n.rewind_mb < 0 || n.rewind_mb > 4096) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--load-state") == 0 && i + 1 < argc) {
+			load = argv[++i];
+		} else if (strcmp(argv[i], "--save-state") == 0 && i + 1 < argc) {
+			save = argv[++i];
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			record = argv[++i];
+		} else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+			play = argv[++i];
+		} else if (strcmp(argv[i], "--checkpoints") == 0 && i + 1 < argc) {
+			ckpt = argv[++i];
+		} else if (strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+			every = atol(argv[++i]);
+			if (every < 1 || every > UINT32_MAX) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+			jobs = atoi(argv[++i]);
+			if (jobs < 1) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--explore") == 0 && i + 1 < argc) {
+			branches = atoi(argv[++i]);
+			if (branches < 1) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+			job.depth = atoi(argv[++i]);
+			if (job.depth < 1) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--objective") == 0 && i + 1 < argc) {
+			long addr = strtol(argv[++i], &end, 0);
+
+			job.bytes = *end == ':' ? atoi(end + 1) : 1;
+			if (addr < 0 || addr >= RAM_SIZE || job.bytes < 1 || job.bytes > 4) {
+				usage();
+			}
+			job.addr = (uint16_t)addr;
+		} else if (strcmp(argv[i], "--netplay") == 0 && i + 1 < argc) {
+			netplay = argv[++i];
+			if (strcmp(netplay, "loopback") != 0 &&
+			    (sscanf(netplay, "%d:%d", &port, &peer) != 2 ||
+			     port < 1 || port > 65535 || peer < 1 || peer > 65535)) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--player") == 0 && i + 1 < argc) {
+			player = atoi(argv[++i]);
+			if (player < 1 || player > 2) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+			latency = atof(argv[++i]);
+			if (latency < 0 || latency > 1000) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) {
+			jitter = atof(argv[++i]);
+			if (jitter < 0 || jitter > 1000) {
+				usage();
+			}
+		} else if (strcmp(argv[i], "--hash") == 0) {
+			hashes = 1;
+		} else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
+			wavfile = argv[++i];
+		} else if (strncmp(argv[i], "--", 2) == 0) {
+			usage(); /* unknown, or missing its value */
+		} else if (romfile == NULL) {
+			romfile = argv[i];
+		} else {
+			usage();
+		}
+	}
+
+	if (romfile == NULL || ((wavfile != NULL || hashes) && frames == 0) ||
+	    (save != NULL && frames == 0 && branches == 0)) {
+		usage();
+	}
+
+	if ((branches > 0) != (job.bytes > 0) || (branches > 0 && play != NULL)) {
+		usage();
+	}
+
+	/* NOTE: a movie is played from its own start with its own input */
+	if (play != NULL && (frames > 0 || load != NULL || record != NULL)) {
+		usage();
+	}
 
-	if (argc != 2) {
-		fprintf(stderr, "usage: ./fami romfile\n");
-		exit(EXIT_FAILURE);
+	if (ckpt != NULL && play == NULL) {
+		usage();
+	}
+
+	/* NOTE: both ends start at power-on or the same state, with nothing
+	 * else going on */
+	if (netplay != NULL && (play != NULL || record != NULL || branches > 0 ||
+	                        wavfile != NULL || save != NULL || hashes)) {
+		usage();
+	}
+
+	if (netplay != NULL && strcmp(netplay, "loopback") == 0 && frames == 0) {
+		usage();
+	}
+
+	if (netplay != NULL) {
+		n.run_ahead = 0; /* TODO: run ahead of the guesses too */
+		n.rewind_mb = 0;
+	}
+
+	if (jobs == 0) {
+		jobs = pool_threads();
+	}
+
+	if (n.rewind_mb < 0) {
+		n.rewind_mb = frames > 0 || play != NULL || branches > 0 ? 0 : REWIND_MB; /* headless runs have nobody to rewind */
+	}
+
+	if (record != NULL) {
+		n.rewind_mb = 0; /* TODO: rewinding would have to cut the movie */
+	}
+
+	if (nes_loadrom(&n, romfile) != 0) {
+		return EXIT_FAILURE;
+	}
+
+	/* NOTE: movies and netplay start the same on every machine, whatever
+	 * its save file holds, and leave it alone */
+	if (n.rom.battery && (record != NULL || play != NULL || netplay != NULL)) {
+		cartrige_detach(&n.rom);
+		memset(n.rom.prg_ram, 0, n.rom.prg_ram_len);
 	}
 
-	nes_loadrom(&n, argv[1]);
 	nes_init(&n);
-	nes_runloop(&n);
+	snprintf(n.state_file, sizeof(n.state_file), "%s.state", romfile);
+
+	if (load != NULL && nes_load_state(&n, load) != 0) {
+		res = -1;
+	} else if (record != NULL && nes_start_movie(&n, record, load != NULL) != 0) {
+		res = -1;
+	} else if (play != NULL) {
+		res = nes_play_movie(&n, play, ckpt, (uint32_t)every, jobs);
+	} else if (netplay != NULL && strcmp(netplay, "loopback") == 0) {
+		res = nes_run_net_loopback(&n, (uint32_t)frames, latency / 1e3, jitter / 1e3);
+	} else if (netplay != NULL) {
+		if (net_udp(&link, port, peer) != 0) {
+			res = -1;
+		} else {
+			net_simulate(&link, latency / 1e3, jitter / 1e3, (uint32_t)port);
+			if (nes_net_start(&n, &link, player - 1) != 0) {
+				res = -1;
+			} else if (frames > 0) {
+				res = nes_run_net_headless(&n, (uint32_t)frames);
+			} else {
+				nes_runloop(&n);
+			}
+			net_close(&link);
+		}
+	} else if (branches > 0) {
+		/* NOTE: the search starts after the frames, if any */
+		res = frames > 0 ? nes_run_headless(&n, frames, wavfile, NULL, hashes) : 0;
+		if (res == 0) {
+			res = nes_explore(&n, branches, &job, jobs);
+		}
+		if (res == 0 && save != NULL) {
+			res = nes_save_state(&n, save);
+		}
+	} else if (frames > 0) {
+		res = nes_run_headless(&n, frames, wavfile, save, hashes);
+	} else {
+		nes_runloop(&n);
+	}
+
+	if (n.record != NULL && movie_write(&n.movie, n.record) != 0) {
+		res = -1;
+	}
+
 	nes_cleanup(&n);
 
-	return 0;
+	return res == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,202 @@
+#define _POSIX_C_SOURCE 200112L /* sockets */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net.h"
+
+/* NOTE: loopback. Both ends live in one thread, send puts the packet
+ * straight into the other end's inbox. A full inbox drops it, like a
+ * network would. */
+static int
+loopback_send(net *n, const net_packet *p)
+{
+	net *to = n->peer;
+
+	if (to->head - to->tail < NET_QUEUE) {
+		to->inbox[to->head++ % NET_QUEUE] = *p;
+	}
+
+	return 0;
+}
+
+static int
+loopback_recv(net *n, net_packet *p)
+{
+	if (n->head == n->tail) {
+		return 0;
+	}
+
+	*p = n->inbox[n->tail++ % NET_QUEUE];
+	return 1;
+}
+
+static void
+loopback_close(net *n)
+{
+	(void)n;
+}
+
+static const net_ops loopback_ops = {
+	loopback_send,
+	loopback_recv,
+	loopback_close
+};
+
+void
+net_loopback(net *a, net *b)
+{
+	*a = (net){ .ops = &loopback_ops, .peer = b, .fd = -1 };
+	*b = (net){ .ops = &loopback_ops, .peer = a, .fd = -1 };
+}
+
+/* NOTE: UDP. A peer that isn't up yet answers with ICMP port unreachable,
+ * which comes back as ECONNREFUSED on the next call. Both are just lost
+ * packets to us. */
+static int
+udp_send(net *n, const net_packet *p)
+{
+	if (send(n->fd, p, sizeof(*p), 0) < 0 &&
+	    errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED) {
+		perror("netplay: send");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+udp_recv(net *n, net_packet *p)
+{
+	ssize_t len;
+
+	for (;;) {
+		len = recv(n->fd, p, sizeof(*p), 0);
+		if (len == (ssize_t)sizeof(*p)) {
+			return 1;
+		}
+		if (len < 0 && errno != ECONNREFUSED && errno != EINTR) {
+			return 0; /* EAGAIN: nothing there */
+		}
+		/* NOTE: a runt isn't ours, try the next one */
+	}
+}
+
+static void
+udp_close(net *n)
+{
+	close(n->fd);
+}
+
+static const net_ops udp_ops = {
+	udp_send,
+	udp_recv,
+	udp_close
+};
+
+/* bound to 127.0.0.1:port, talking only to 127.0.0.1:peer */
+int
+net_udp(net *n, int port, int peer)
+{
+	struct sockaddr_in addr = {0};
+
+	*n = (net){ .ops = &udp_ops };
+
+	if ((n->fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+		perror("netplay: socket");
+		return -1;
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((uint16_t)port);
+	if (bind(n->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "netplay: can't bind port %d: %s\n", port, strerror(errno));
+		close(n->fd);
+		return -1;
+	}
+
+	addr.sin_port = htons((uint16_t)peer);
+	if (connect(n->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+	    fcntl(n->fd, F_SETFL, O_NONBLOCK) != 0) {
+		perror("netplay: connect");
+		close(n->fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* packets arrive latency to latency + jitter seconds after they were
+ * received, so jitter reorders them too */
+void
+net_simulate(net *n, double latency, double jitter, uint32_t seed)
+{
+	n->latency = latency;
+	n->jitter = jitter;
+	n->seed = seed | 1;
+}
+
+static double
+net_random(net *n)
+{
+	n->seed ^= n->seed << 13;
+	n->seed ^= n->seed >> 17;
+	n->seed ^= n->seed << 5;
+	return (double)n->seed / 4294967296.0;
+}
+
+int
+net_send(net *n, const net_packet *p)
+{
+	return n->ops->send(n, p);
+}
+
+/* Returns 1 with the packet that has arrived by 'now' first, 0 if none. */
+int
+net_recv(net *n, net_packet *p, double now)
+{
+	net_delayed *d;
+	size_t i, first = 0;
+
+	while (n->delayed_count < NET_QUEUE) {
+		d = &n->delayed[n->delayed_count];
+		if (n->ops->recv(n, &d->packet) != 1) {
+			break;
+		}
+		d->at = now + n->latency + n->jitter * net_random(n);
+		n->delayed_count++;
+	}
+
+	if (n->delayed_count == 0) {
+		return 0;
+	}
+
+	for (i = 1; i < n->delayed_count; i++) {
+		if (n->delayed[i].at < n->delayed[first].at) {
+			first = i;
+		}
+	}
+
+	if (n->delayed[first].at > now) {
+		return 0;
+	}
+
+	*p = n->delayed[first].packet;
+	n->delayed[first] = n->delayed[--n->delayed_count];
+	return 1;
+}
+
+void
+net_close(net *n)
+{
+	if (n->ops != NULL) {
+		n->ops->close(n);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef NES_NET_H
+#define NES_NET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* NOTE: netplay transport. Packets carry the last NET_INPUTS inputs of
+ * the sender, so any one that arrives makes up for those that were lost
+ * or came out of order. The transports themselves only move packets:
+ * between two consoles of the same process (loopback) or over UDP on
+ * localhost. Latency and jitter are simulated on the receiving side for
+ * either of them. Host byte order, like save states. */
+enum {
+	NET_INPUTS = 32,
+	NET_QUEUE = 256 /* packets in flight per direction */
+};
+
+typedef struct {
+	uint32_t frame; /* frame of the last input */
+	uint32_t count; /* inputs, the last at input[count - 1] */
+	uint8_t input[NET_INPUTS];
+} net_packet;
+
+struct net;
+
+typedef struct {
+	int (*send)(struct net *, const net_packet *);
+	int (*recv)(struct net *, net_packet *); /* 1 if one came, 0 if none */
+	void (*close)(struct net *);
+} net_ops;
+
+typedef struct {
+	double at; /* when it arrives, seconds */
+	net_packet packet;
+} net_delayed;
+
+typedef struct net {
+	const net_ops *ops;
+	struct net *peer;               /* loopback */
+	net_packet inbox[NET_QUEUE];    /* loopback, a ring */
+	size_t head, tail;
+	int fd;                         /* udp */
+	double latency, jitter;         /* seconds */
+	uint32_t seed;
+	net_delayed delayed[NET_QUEUE]; /* received, not arrived yet */
+	size_t delayed_count;
+} net;
+
+void net_loopback(net *, net *);
+int net_udp(net *, int, int);
+void net_simulate(net *, double, double, uint32_t);
+int net_send(net *, const net_packet *);
+int net_recv(net *, net_packet *, double);
+void net_close(net *);
+
+#endif /* NES_NET_H */
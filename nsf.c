@@ -0,0 +1,271 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h> /* calloc, free */
+#include <string.h> /* memcpy, memset */
+
+#include "apu.h"
+#include "nsf.h"
+
+/* NOTE: the NSF "board". PRG is cut into 4 KB banks and each of the 8
+ * slots at $8000-$FFFF is switched by writing $5FF8-$5FFF. Tunes that
+ * aren't bankswitched get the banks the load address implies. There is
+ * 8 KB of RAM at $6000-$7FFF.
+ *
+ * INIT and PLAY are called like subroutines returning to NSF_IDLE, where
+ * the player keeps the CPU parked: instead of running an idle loop there
+ * it skips straight to the next PLAY call. */
+
+enum {
+	NSF_IDLE = 0x5FF0,     /* JMP NSF_IDLE, never actually executed */
+	NSF_BANK_REGS = 0x5FF8,
+	NSF_RAM_SIZE = 0x2000,
+	NSF_MAX_BANKS = 256,   /* what 8 bit bank registers reach */
+	NSF_INIT_CYCLES = APU_CLOCK_RATE * 2 /* INIT gets two seconds to return */
+};
+
+static const uint8_t
+idle_loop[3] = { 0x4C, NSF_IDLE & 0xFF, NSF_IDLE >> 8 };
+
+static uint8_t
+nsf_read(const cartrige *c, uint16_t addr)
+{
+	uint32_t offset;
+
+	if (addr >= 0x8000) {
+		offset = (uint32_t)c->banks[(addr - 0x8000) / NSF_BANK_SIZE] * NSF_BANK_SIZE + (addr & 0x0FFF);
+		return offset < c->prg_len ? c->prg[offset] : 0;
+	}
+
+	if (addr >= 0x6000) {
+		return c->prg_ram[addr - 0x6000];
+	}
+
+	if (addr >= NSF_IDLE && addr < NSF_IDLE + sizeof(idle_loop)) {
+		return idle_loop[addr - NSF_IDLE];
+	}
+
+	return 0;
+}
+
+static void
+nsf_write(cartrige *c, uint16_t addr, uint8_t val)
+{
+	if (addr >= 0x6000 && addr < 0x8000) {
+		c->prg_ram[addr - 0x6000] = val;
+		dirty_mark(c->dirty, DIRTY_PRG_RAM, (uint32_t)(addr - 0x6000));
+	} else if (addr >= NSF_BANK_REGS && addr < 0x6000) {
+		c->banks[addr - NSF_BANK_REGS] = val;
+	}
+}
+
+static uint8_t
+nsf_audio(const cartrige *c)
+{
+	return c->chips;
+}
+
+static const mapper_ops
+nsf_ops = { nsf_read, nsf_write, nsf_audio };
+
+static uint16_t
+get16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static int
+is_bankswitched(const nsf *s)
+{
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		if (s->banks[i]) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+nsf_probe(const char *path)
+{
+	uint8_t magic[5];
+	FILE *f = fopen(path, "rb");
+	int res;
+
+	if (f == NULL) {
+		return 0;
+	}
+
+	res = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, "NESM\x1A", 5) == 0;
+	fclose(f);
+
+	return res;
+}
+
+cartrige
+nsf_load(nsf *s, const char *path)
+{
+	uint8_t h[NSF_HEADER_SIZE];
+	uint8_t *prg, *ram;
+	size_t pad, len;
+	long size;
+	int i;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		perror(path);
+		return (cartrige){ .invalid = 1 };
+	}
+
+	fseek(f, 0, SEEK_END);
+	size = ftell(f) - NSF_HEADER_SIZE;
+	fseek(f, 0, SEEK_SET);
+
+	if (size <= 0 || fread(h, 1, sizeof(h), f) != sizeof(h) || memcmp(h, "NESM\x1A", 5) != 0) {
+		fclose(f);
+		fprintf(stderr, "%s is not an NSF file.\n", path);
+		return (cartrige){ .invalid = 1 };
+	}
+
+	memset(s, 0, sizeof(*s));
+	memcpy(s->name, h + 0x0E, 32);
+	memcpy(s->artist, h + 0x2E, 32);
+	memcpy(s->copyright, h + 0x4E, 32);
+	s->songs = h[0x06];
+	s->start_song = h[0x07];
+	s->load_addr = get16(h + 0x08);
+	s->init_addr = get16(h + 0x0A);
+	s->play_addr = get16(h + 0x0C);
+	s->speed = get16(h + 0x6E);
+	memcpy(s->banks, h + 0x70, 8);
+	s->chips = h[0x7B];
+
+	if (s->speed == 0) {
+		s->speed = 16639; /* 60.1 Hz */
+	}
+
+	s->play_period = (double)s->speed * APU_CLOCK_RATE / 1000000;
+
+	/* the data starts load_addr & 0xFFF bytes into its first bank */
+	if (is_bankswitched(s)) {
+		pad = s->load_addr & 0x0FFF;
+	} else if (s->load_addr >= 0x8000) {
+		pad = s->load_addr - 0x8000u;
+		for (i = 0; i < 8; i++) {
+			s->banks[i] = (uint8_t)i;
+		}
+	} else {
+		fclose(f);
+		fprintf(stderr, "%s: load address $%04X is below $8000.\n", path, s->load_addr);
+		return (cartrige){ .invalid = 1 };
+	}
+
+	if ((size_t)size > (size_t)NSF_MAX_BANKS * NSF_BANK_SIZE - pad) {
+		fclose(f);
+		fprintf(stderr, "%s: too big for an NSF.\n", path);
+		return (cartrige){ .invalid = 1 };
+	}
+
+	len = (pad + (size_t)size + NSF_BANK_SIZE - 1) / NSF_BANK_SIZE * NSF_BANK_SIZE;
+	prg = calloc(len, 1);
+	ram = calloc(NSF_RAM_SIZE, 1);
+	if (prg == NULL || ram == NULL) {
+		exit(1);
+	}
+
+	if (fread(prg + pad, 1, (size_t)size, f) != (size_t)size) {
+		fprintf(stderr, "%s: short read.\n", path);
+	}
+
+	fclose(f);
+
+	return (cartrige){
+		.prg = prg,
+		.prg_ram = ram,
+		.prg_ram_len = NSF_RAM_SIZE,
+		.prg_len = (uint32_t)len,
+		.chips = s->chips,
+		.ops = &nsf_ops
+	};
+}
+
+static int
+is_parked(bus *b)
+{
+	return b->cpu->PC == NSF_IDLE && cpu_at_boundary(b->cpu);
+}
+
+/* runs the CPU until it is parked again or until the given cycle */
+static void
+run_routine(bus *b, uint64_t until)
+{
+	while (!is_parked(b) && b->cpu->total < until) {
+		if (sched_due(&b->sched, b->cpu->total)) {
+			bus_sched_run(b);
+		}
+		bus_cpu_tick(b);
+	}
+}
+
+/* song is 1-based */
+void
+nsf_start(nsf *s, bus *b, int song)
+{
+	uint16_t addr;
+	int i;
+
+	bus_ram_reset(b);
+	memset(b->rom.prg_ram, 0, NSF_RAM_SIZE);
+
+	for (addr = 0x4000; addr <= 0x4013; addr++) {
+		bus_write(b, addr, 0);
+	}
+	bus_write(b, 0x4015, 0x00);
+	bus_write(b, 0x4015, 0x0F);
+	bus_write(b, 0x4017, 0x40);
+
+	for (i = 0; i < 8; i++) {
+		bus_write(b, (uint16_t)(NSF_BANK_REGS + i), s->banks[i]);
+	}
+
+	b->cpu->A = (uint8_t)(song - 1);
+	b->cpu->X = 0; /* NTSC */
+	b->cpu->SP = 0xFD;
+	b->cpu->P = (uint8_t)(b->cpu->P | 0x04); /* no IRQs */
+	cpu_call(b->cpu, s->init_addr, NSF_IDLE);
+	run_routine(b, b->cpu->total + NSF_INIT_CYCLES);
+
+	s->next_play = (double)b->cpu->total;
+}
+
+void
+nsf_run_until(nsf *s, bus *b, uint64_t until)
+{
+	uint64_t next;
+
+	while (b->cpu->total < until) {
+		if (sched_due(&b->sched, b->cpu->total)) {
+			bus_sched_run(b);
+		}
+
+		if (!is_parked(b)) {
+			bus_cpu_tick(b);
+			continue;
+		}
+
+		if (s->next_play <= (double)b->cpu->total) {
+			/* NOTE: a PLAY that overruns its period delays the next one */
+			s->next_play += s->play_period;
+			cpu_call(b->cpu, s->play_addr, NSF_IDLE);
+			continue;
+		}
+
+		next = (uint64_t)s->next_play + 1;
+		next = next < until ? next : until;
+		next = next < b->sched.next ? next : b->sched.next;
+		cpu_skip_until(b->cpu, next);
+	}
+}
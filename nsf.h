@@ -0,0 +1,38 @@
+#ifndef NES_NSF_H
+#define NES_NSF_H
+
+#include <stdint.h>
+
+#include "bus.h"
+#include "cartrige.h"
+
+/* see to https://www.nesdev.org/wiki/NSF */
+
+enum {
+	NSF_HEADER_SIZE = 0x80,
+	NSF_BANK_SIZE = 0x1000
+};
+
+typedef struct {
+	char name[33];
+	char artist[33];
+	char copyright[33];
+	uint8_t songs;
+	uint8_t start_song; /* 1-based */
+	uint16_t load_addr;
+	uint16_t init_addr;
+	uint16_t play_addr;
+	uint16_t speed;     /* NTSC PLAY period in microseconds */
+	uint8_t banks[8];   /* initial $5FF8-$5FFF values, all zero if not bankswitched */
+	uint8_t chips;      /* expansion audio */
+
+	double play_period; /* CPU cycles between PLAY calls */
+	double next_play;   /* CPU cycle of the next PLAY call */
+} nsf;
+
+int nsf_probe(const char *);
+cartrige nsf_load(nsf *, const char *);
+void nsf_start(nsf *, bus *, int);
+void nsf_run_until(nsf *, bus *, uint64_t);
+
+#endif /* NES_NSF_H */
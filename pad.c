@@ -0,0 +1,42 @@
+#include <stdint.h>
+
+#include "pad.h"
+
+/* NOTE: while strobe is high the shift register keeps reloading, so reads
+ * return the state of A. Once it goes low every read shifts out the next
+ * button, and an official controller returns 1 after the eighth. */
+
+void
+pad_set(pad *p, uint8_t buttons)
+{
+	p->buttons = buttons;
+
+	if (p->strobe) {
+		p->shift = buttons;
+	}
+}
+
+void
+pad_write(pad *p, uint8_t val)
+{
+	p->strobe = val & 0x1;
+
+	if (p->strobe) {
+		p->shift = p->buttons;
+	}
+}
+
+uint8_t
+pad_read(pad *p)
+{
+	uint8_t bit;
+
+	if (p->strobe) {
+		return p->buttons & 0x1;
+	}
+
+	bit = p->shift & 0x1;
+	p->shift = (uint8_t)(p->shift >> 1 | 0x80);
+
+	return bit;
+}
@@ -0,0 +1,29 @@
+#ifndef NES_PAD_H
+#define NES_PAD_H
+
+#include <stdint.h>
+
+/* standard controller. See: https://www.nesdev.org/wiki/Standard_controller */
+
+enum {
+	PAD_A = 0x01,
+	PAD_B = 0x02,
+	PAD_SELECT = 0x04,
+	PAD_START = 0x08,
+	PAD_UP = 0x10,
+	PAD_DOWN = 0x20,
+	PAD_LEFT = 0x40,
+	PAD_RIGHT = 0x80
+};
+
+typedef struct {
+	uint8_t buttons; /* latched once per frame by the frontend */
+	uint8_t shift;
+	uint8_t strobe;
+} pad;
+
+void pad_set(pad *, uint8_t);
+void pad_write(pad *, uint8_t);
+uint8_t pad_read(pad *);
+
+#endif /* NES_PAD_H */
@@ -0,0 +1,86 @@
+#define _POSIX_C_SOURCE 200112L /* sysconf */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "pool.h"
+
+enum {
+	POOL_MAX_THREADS = 256
+};
+
+typedef struct {
+	pool_task task;
+	void *arg;
+	int tasks;
+	atomic_int next;
+} pool;
+
+typedef struct {
+	pool *pool;
+	int id;
+} pool_worker;
+
+static void *
+worker(void *p)
+{
+	pool_worker *w = p;
+	int i;
+
+	while ((i = atomic_fetch_add(&w->pool->next, 1)) < w->pool->tasks) {
+		w->pool->task(w->pool->arg, i, w->id);
+	}
+
+	return NULL;
+}
+
+/* online CPUs */
+int
+pool_threads(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n < 1 ? 1 : n > POOL_MAX_THREADS ? POOL_MAX_THREADS : (int)n;
+}
+
+/* Returns the number of threads that worked, the calling thread is
+ * worker 0. If threads can't be created the others do all the tasks. */
+int
+pool_run(int threads, int tasks, pool_task task, void *arg)
+{
+	pthread_t tid[POOL_MAX_THREADS];
+	pool_worker workers[POOL_MAX_THREADS];
+	pool p;
+	int i, started;
+
+	if (threads < 1) {
+		threads = 1;
+	} else if (threads > POOL_MAX_THREADS) {
+		threads = POOL_MAX_THREADS;
+	}
+
+	p.task = task;
+	p.arg = arg;
+	p.tasks = tasks;
+	atomic_init(&p.next, 0);
+
+	for (i = 0; i < threads; i++) {
+		workers[i].pool = &p;
+		workers[i].id = i;
+	}
+
+	for (started = 1; started < threads; started++) {
+		if (pthread_create(&tid[started], NULL, worker, &workers[started]) != 0) {
+			break;
+		}
+	}
+
+	worker(&workers[0]);
+
+	for (i = 1; i < started; i++) {
+		pthread_join(tid[i], NULL);
+	}
+
+	return started;
+}
@@ -0,0 +1,12 @@
+#ifndef NES_POOL_H
+#define NES_POOL_H
+
+/* runs task(arg, i, worker) for i in [0, tasks) on a number of threads.
+ * Workers take the next task as soon as they are free, so uneven tasks
+ * still keep every thread busy. Returns when all are done. */
+typedef void (*pool_task)(void *, int, int);
+
+int pool_threads(void);
+int pool_run(int, int, pool_task, void *);
+
+#endif /* NES_POOL_H */
@@ -1,8 +1,10 @@
 #include "ines.h"
+#include "mux.h"
 #include "ppu.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h> /* memset */
 
 enum {
 	PPUCTRL = 0x2000,
@@ -50,11 +52,54 @@ enum {
 	FINE_Y_SCROLL = 0x7000    /* 0111 0000 0000 0000 */
 };
 
-static uint8_t
-ppu_palette[0x20] = {0};
+/* NOTE: per-dot actions, see dot_table_build */
+enum {
+	ACT_FETCH_NT = 0x0001,
+	ACT_FETCH_AT = 0x0002,
+	ACT_FETCH_LO = 0x0004,
+	ACT_FETCH_HI = 0x0008,
+	ACT_INC_X = 0x0010,
+	ACT_INC_Y = 0x0020,
+	ACT_COPY_X = 0x0040,
+	ACT_COPY_Y = 0x0080,
+	ACT_SHIFT = 0x0100,
+	ACT_RELOAD = 0x0200,
+	ACT_RENDER = 0x0400,
+	ACT_SPR_CLEAR = 0x0800,
+	ACT_SPR_EVAL = 0x1000,
+	ACT_SPR_FETCH = 0x2000,
+	ACT_VBLANK_SET = 0x4000,
+	ACT_VBLANK_CLEAR = 0x8000,
+	ACT_RENDER_LINE = 0x10000,
+
+	/* actions that only happen while rendering is enabled */
+	ACT_RENDERING = ACT_FETCH_NT | ACT_FETCH_AT | ACT_FETCH_LO | ACT_FETCH_HI |
+		ACT_INC_X | ACT_INC_Y | ACT_COPY_X | ACT_COPY_Y | ACT_SHIFT | ACT_RELOAD
+};
+
+typedef enum {
+	SCANLINE_VISIBLE,      /* 0..239 */
+	SCANLINE_PRERENDER,    /* -1 */
+	SCANLINE_VBLANK_START, /* 241 */
+	SCANLINE_IDLE,         /* 240, 242..260 */
+	SCANLINE_CLASSES
+} scanline_class;
+
+enum { DOTS_PER_SCANLINE = 341, DOTS_PER_FRAME = 262 * 341 };
 
 static uint32_t
-ppu_colors[0x40] = {
+ppu_dot_actions[SCANLINE_CLASSES][DOTS_PER_SCANLINE];
+
+static int
+ppu_dot_actions_ready = 0;
+
+enum {
+	PALETTE_COLORS = 0x40,
+	PALETTE_EMPHASIS_SETS = 8
+};
+
+static uint32_t
+ppu_colors[PALETTE_COLORS] = {
 	0x666666FF, 0x002A88FF, 0x1412A7FF, 0x3B00A4FF,
 	0x5C007EFF, 0x6E0040FF, 0x6C0600FF, 0x561D00FF,
 	0x333500FF, 0x0B4800FF, 0x005200FF, 0x004F08FF,
@@ -76,6 +121,15 @@ ppu_colors[0x40] = {
 	0xB5EBF2FF, 0xB8B8B8FF, 0x000000FF, 0x000000FF
 };
 
+/* NOTE: host colours for every PPUMASK emphasis combination (bits 5-7),
+ * filled by ppu_load_palette or from ppu_colors on the first reset.
+ * Changing emphasis only swaps r2C02.colors to another row. */
+static uint32_t
+ppu_colors_lut[PALETTE_EMPHASIS_SETS][PALETTE_COLORS];
+
+static int
+ppu_colors_lut_ready = 0;
+
 static inline uint8_t get_color_idx_in_palette(uint8_t lo, uint8_t hi) { return (lo & 0x1) << 1 | (hi & 0x1); }  /* from 0 to 3 */
 
 static inline int in_range(int num, int lo, int hi) { return (num >= lo) && (num <= hi); };
@@ -105,103 +159,162 @@ static inline void loopy_set_nametable_y(uint16_t *reg, uint16_t val)
 static inline void loopy_toggle_nametable_x(uint16_t *reg) { *reg ^= NAMETABLE_X; }
 static inline void loopy_toggle_nametable_y(uint16_t *reg) { *reg ^= NAMETABLE_Y; }
 
-static inline void
-set_pixel(r2C02 *ppu, int x, int y, uint32_t color)
+/* converts 0xRRGGBBAA from ppu_colors into the byte order of frame_buf */
+static inline uint32_t
+rgba_to_host(uint32_t color)
 {
-	uint8_t r = (color >> 24) & 0xFF;
-	uint8_t g = (color >> 16) & 0xFF;
-	uint8_t b = (color >> 8) & 0xFF;
-	uint8_t a = color & 0xFF;
-	uint32_t rgba = (a << 24) | (b << 16) | (g << 8) | r;
-
-	ppu->frame_buf[x + y * 256] = rgba;
-}
+	uint32_t r = (color >> 24) & 0xFF;
+	uint32_t g = (color >> 16) & 0xFF;
+	uint32_t b = (color >> 8) & 0xFF;
+	uint32_t a = color & 0xFF;
 
-static inline uint8_t
-multiplex_pixels(uint8_t bg_pixel, uint8_t fg_pixel)
-{
-	return (fg_pixel == 0) ? bg_pixel : fg_pixel;
-	/* TODO: add sprite priority */
+	return (a << 24) | (b << 16) | (g << 8) | r;
 }
 
-static uint8_t
-nametable_read(r2C02 *ppu, uint16_t addr)
+/* $2000-$2FFF to an offset in vram. NOTE: four-screen boards carry the
+ * other 2 KB themselves, we keep it in vram too. */
+static uint16_t
+nametable_addr(r2C02 *ppu, uint16_t addr)
 {
-	mirroring_type mt = bus_cartrige_get_mirroring(ppu->bus);
-
-	switch (mt) {
+	switch (bus_cartrige_get_mirroring(ppu->bus)) {
 		case HORIZONTAL_MIRRORING:
-			addr = ((addr / 2) & 0x400) + (addr % 0x400);
-			break;
+			return ((addr / 2) & 0x400) + (addr % 0x400);
 		case VERTICAL_MIRRORING:
-			addr %= 0x800;
-			break;
+			return addr % 0x800;
 		case SINGLE_SCREEN_A:
+			return addr % 0x400;
 		case SINGLE_SCREEN_B:
+			return 0x400 + addr % 0x400;
 		case FOUR_SCREEN:
-		case INVALID_MIRRORING: // TODO:
 		default:
-			addr -= 0x2000;
+			return (addr - 0x2000) & 0xFFF;
 	}
+}
 
-	return ppu->vram[addr];
+static uint8_t
+nametable_read(r2C02 *ppu, uint16_t addr)
+{
+	return ppu->vram[nametable_addr(ppu, addr)];
 }
 
 static void
 nametable_write(r2C02 *ppu, uint16_t addr, uint8_t val)
 {
-	mirroring_type mt = bus_cartrige_get_mirroring(ppu->bus);
+	addr = nametable_addr(ppu, addr);
+	ppu->vram[addr] = val;
+	dirty_mark(ppu->dirty, DIRTY_VRAM, addr);
+}
 
-	switch (mt) {
-		case HORIZONTAL_MIRRORING:
-			addr = ((addr / 2) & 0x400) + (addr % 0x400);
-			break;
-		case VERTICAL_MIRRORING:
-			addr %= 0x800;
-			break;
-		case SINGLE_SCREEN_A:
-		case SINGLE_SCREEN_B:
-		case FOUR_SCREEN:
-		case INVALID_MIRRORING: // TODO:
-		default:
-			addr -= 0x2000;
+/* $3F10/$3F14/$3F18/$3F1C are mirrors of $3F00/$3F04/$3F08/$3F0C */
+static inline uint8_t
+palette_idx(uint16_t addr)
+{
+	uint8_t idx = addr & 0x1F;
+
+	if ((idx & 0x13) == 0x10) {
+		idx &= 0x0F;
 	}
 
-	ppu->vram[addr] = val;
+	return idx;
 }
 
 static inline uint8_t
-palette_read(uint16_t addr)
+emphasis_channel(uint32_t c, uint8_t shift, uint8_t attenuated)
 {
-	switch (addr) {
-		case 0x3F10:
-		case 0x3F14:
-		case 0x3F18:
-		case 0x3F1C:
-			addr -= 0x10;
+	uint32_t val = (c >> shift) & 0xFF;
+
+	/* NOTE: ~0.75 is the usual approximation of the NTSC attenuation */
+	return (uint8_t)(attenuated ? val * 3 / 4 : val);
+}
+
+/* builds an emphasised variant of rgba: every emphasis bit attenuates
+ * the other two channels, so all three darken the whole colour. Bits are
+ * R = 0x1, G = 0x2, B = 0x4. */
+static uint32_t
+emphasize_color(uint32_t rgba, uint8_t idx, uint8_t emphasis)
+{
+	uint8_t r, g, b;
+
+	/* colours $xE/$xF are black and don't respond to emphasis */
+	if (emphasis == 0 || (idx & 0x0F) >= 0x0E) {
+		return rgba;
 	}
 
-	addr -= 0x3F00;
-	addr %= 0x20;
+	r = emphasis_channel(rgba, 24, (emphasis & 0x6) != 0);
+	g = emphasis_channel(rgba, 16, (emphasis & 0x5) != 0);
+	b = emphasis_channel(rgba, 8, (emphasis & 0x3) != 0);
 
-	return ppu_palette[addr];
+	return (uint32_t)r << 24 | (uint32_t)g << 16 | (uint32_t)b << 8 | (rgba & 0xFF);
 }
 
-static inline void
-palette_write(uint16_t addr, uint8_t val)
+static void
+colors_lut_build(const uint32_t *base)
 {
-	switch (addr) {
-		case 0x3F10:
-		case 0x3F14:
-		case 0x3F18:
-		case 0x3F1C:
-			addr -= 0x10;
+	uint8_t e, i;
+
+	for (e = 0; e < PALETTE_EMPHASIS_SETS; e++) {
+		for (i = 0; i < PALETTE_COLORS; i++) {
+			ppu_colors_lut[e][i] = rgba_to_host(emphasize_color(base[i], i, e));
+		}
+	}
+
+	ppu_colors_lut_ready = 1;
+}
+
+static inline uint32_t
+nes_palette_to_rgb(r2C02 *ppu, uint8_t color_idx)
+{
+	if (ppu->ppu_mask & PPUMASK_GREYSCALE) {
+		color_idx &= 0x30;
+	}
+
+	return ppu->colors[color_idx & 0x3F];
+}
+
+static void
+colors_select(r2C02 *ppu)
+{
+	ppu->colors = ppu_colors_lut[(ppu->ppu_mask & PPUMASK_BGR) >> 5];
+}
+
+/* NOTE: palette_cache holds host colours for all 32 palette entries,
+ * so render_pixel doesn't have to go through vram_data_read. It is
+ * updated on palette writes and on PPUMASK colour bit changes. */
+static void
+palette_cache_update(r2C02 *ppu, uint8_t idx)
+{
+	uint32_t color = nes_palette_to_rgb(ppu, ppu->palette[idx]);
+
+	ppu->palette_cache[idx] = color;
+
+	if ((idx & 0x13) == 0) {
+		ppu->palette_cache[idx | 0x10] = color;
 	}
+}
+
+static void
+palette_cache_refresh(r2C02 *ppu)
+{
+	uint8_t i;
+
+	for (i = 0; i < 0x20; i++) {
+		ppu->palette_cache[i] = nes_palette_to_rgb(ppu, ppu->palette[palette_idx(i)]);
+	}
+}
+
+static inline uint8_t
+palette_read(r2C02 *ppu, uint16_t addr)
+{
+	return ppu->palette[palette_idx(addr)];
+}
 
-	addr -= 0x3F00;
-	addr %= 0x20;
+static inline void
+palette_write(r2C02 *ppu, uint16_t addr, uint8_t val)
+{
+	uint8_t idx = palette_idx(addr);
 
-	ppu_palette[addr] = val;
+	ppu->palette[idx] = val;
+	palette_cache_update(ppu, idx);
 }
 
 static inline void
@@ -235,10 +348,6 @@ render_bg_pixel(r2C02 *ppu)
 		return 0;
 	}
 
-	if (!(ppu->ppu_mask & PPUMASK_BACKGROUND_LEFT_COL_ENABLE) && ppu->cycle < 9) {
-		return 0;
-	}
-
 	bit_hi = ((ppu->shift.tile_hi & mask) >> (15 - x_scroll)) & 0x01;
 	bit_lo = ((ppu->shift.tile_lo & mask) >> (15 - x_scroll)) & 0x01;
 	color = (bit_hi << 1) | bit_lo;
@@ -254,13 +363,6 @@ render_bg_pixel(r2C02 *ppu)
 	return palette * 4 + color;
 }
 
-static uint8_t
-render_fg_pixel(r2C02 *ppu)
-{
-	/* TODO: */
-	return 0x0;
-}
-
 static void
 scroll_reg_write(r2C02 *ppu, uint8_t val)
 {
@@ -291,7 +393,7 @@ scroll_reg_write(r2C02 *ppu, uint8_t val)
 static void
 vblank_end(r2C02 *ppu)
 {
-	ppu->ppu_status &= ~PPUSTATUS_VBLANK_ENABLED;
+	ppu->ppu_status &= (uint8_t)~(PPUSTATUS_VBLANK_ENABLED | PPUSTATUS_SPRITE_ZERO_HIT | PPUSTATUS_SPRITE_OVERFLOW);
 }
 
 static void
@@ -332,7 +434,7 @@ vram_data_read(r2C02 *ppu, uint16_t addr)
 	}
 
 	if (addr < 0x4000) {
-		return palette_read(addr);
+		return palette_read(ppu, addr);
 	}
 
 	fprintf(stderr, "invalid vram_data_read\n");
@@ -348,7 +450,7 @@ vram_data_write(r2C02 *ppu, uint16_t addr, uint8_t val)
 	} else if (addr < 0x3F00) {
 		nametable_write(ppu, addr, val);
 	} else if (addr < 0x4000) {
-		palette_write(addr, val);
+		palette_write(ppu, addr, val);
 	}
 }
 
@@ -367,40 +469,104 @@ vram_reg_write(r2C02 *ppu, uint8_t val)
 	}
 }
 
-static inline uint32_t
-nes_palette_to_rgb(uint16_t color_idx)
+/* NOTE: sprite 0 hit is raised at the dot of the first pixel where sprite
+ * 0 and the background are both opaque, the rule mux_line applies to a
+ * whole line: not at x = 255, nor in pixels 0-7 unless both show there */
+static void
+sprite_zero_check(r2C02 *ppu, int x, uint8_t bg)
 {
-	return ppu_colors[color_idx & 0x3F];
+	uint8_t spr = ppu->spr_line[x];
+	uint8_t left = PPUMASK_BACKGROUND_LEFT_COL_ENABLE | PPUMASK_SPRITE_LEFT_COL_ENABLE;
+
+	if (!(spr & MUX_SPR_ZERO) || !(spr & 0x03) || !(bg & 0x03) || x == 255) {
+		return;
+	}
+
+	if (x < 8 && (ppu->ppu_mask & left) != left) {
+		return;
+	}
+
+	if (is_bg_rendering_enabled(ppu->ppu_mask) && is_fg_rendering_enabled(ppu->ppu_mask)) {
+		ppu->ppu_status |= PPUSTATUS_SPRITE_ZERO_HIT;
+	}
 }
 
 static void
 render_pixel(r2C02 *ppu)
 {
-	int bg_rendering_enabled = is_bg_rendering_enabled(ppu->ppu_mask);
-	int fg_rendering_enabled = is_fg_rendering_enabled(ppu->ppu_mask);
-
 	int x = ppu->cycle - 1;
-	int y = ppu->scanline;
+	uint8_t bg = render_bg_pixel(ppu);
+
+	ppu->bg_line[x] = bg;
+
+	if (ppu->sprite_zero_line) {
+		sprite_zero_check(ppu, x, bg);
+	}
+}
 
-	uint8_t bg_color = 0;
-	uint8_t fg_color = 0;
-	uint8_t final_color = 0;
-	uint32_t rgb_color = 0;
+/* NOTE: the background is collected into bg_line dot by dot, sprites are
+ * prepared into spr_line on the previous scanline. Both are merged here
+ * once the last visible dot of the line has been rendered. Only frames
+ * somebody looks at get here, sprite 0 hit is render_pixel's. */
+static void
+render_line(r2C02 *ppu)
+{
+	uint8_t colors[SCREEN_WIDTH];
+	uint32_t *line;
+	uint8_t flags = 0;
+	int x;
+
+	if (ppu->ppu_mask & PPUMASK_BACKGROUND_LEFT_COL_ENABLE) {
+		flags |= MUX_BG_LEFT_COL;
+	}
 
-	if (bg_rendering_enabled) {
-		bg_color = render_bg_pixel(ppu);
+	if (ppu->ppu_mask & PPUMASK_SPRITE_LEFT_COL_ENABLE) {
+		flags |= MUX_SPR_LEFT_COL;
 	}
 
-	if (fg_rendering_enabled) {
-		fg_color = render_fg_pixel(ppu);
+	mux_line(ppu->bg_line, ppu->spr_line, colors, flags);
+
+	line = ppu->frame_buf + ppu->scanline * SCREEN_WIDTH;
+	for (x = 0; x < SCREEN_WIDTH; x++) {
+		line[x] = ppu->palette_cache[colors[x]];
+	}
+}
+
+static inline int
+sprite_height(uint8_t ctrl)
+{
+	return (ctrl & PPUCTRL_SPRITE_HEIGHT) ? 16 : 8;
+}
+
+static inline uint8_t
+flip_byte(uint8_t b)
+{
+	b = (uint8_t)((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+	b = (uint8_t)((b & 0xCC) >> 2 | (b & 0x33) << 2);
+	b = (uint8_t)((b & 0xAA) >> 1 | (b & 0x55) << 1);
+	return b;
+}
+
+static uint16_t
+sprite_pattern_addr(r2C02 *ppu, uint8_t tile, int row)
+{
+	uint16_t table;
+
+	if (sprite_height(ppu->ppu_ctrl) == 8) {
+		table = (ppu->ppu_ctrl & PPUCTRL_SPRITE_TILE_SELECT) ? 0x1000 : 0;
+		return (uint16_t)(table + tile * 0x10 + row);
 	}
 
-	final_color = multiplex_pixels(bg_color, fg_color);
-	uint16_t color_idx = 0x3F00 + final_color;
-	color_idx = vram_data_read(ppu, color_idx);
+	/* 8x16: bit 0 of tile selects the pattern table */
+	table = (tile & 0x1) ? 0x1000 : 0;
+	tile &= 0xFE;
+
+	if (row >= 8) {
+		tile++;
+		row -= 8;
+	}
 
-	rgb_color = nes_palette_to_rgb(color_idx);
-	set_pixel(ppu, x, y, rgb_color);
+	return (uint16_t)(table + tile * 0x10 + row);
 }
 
 static void
@@ -408,28 +574,110 @@ clear_sprites(r2C02 *ppu)
 {
 	int i;
 	for (i = 0; i < OAM2_SIZE; i++) {
-		ppu->oam2[i] = 0;
+		ppu->oam2[i] = 0xFF;
 	}
+	ppu->oam2_count = 0;
 }
 
+/* Finds the first eight sprites that are on the next scanline and copies
+ * them into secondary OAM. Unlike the real PPU, the overflow flag is set
+ * without the diagonal OAM read bug. */
 static void
 evaluate_sprites(r2C02 *ppu)
 {
-	/* TODO: here we should search OAM in order to find
-	 * sprites that will be on current scanline. We choose
-	 * the first eight.
-	 * If eight sprites were found, it checks (in a wrongly-implemented fashion)
-	 * for further sprites on the scanline to see if the sprite overflow flag
-	 * should be set. Then, using the details for the eight (or fewer) sprites
-	 * chosen, it determines which pixels each has on the scanline and where
-	 * to draw them.
-	 */
+	int height = sprite_height(ppu->ppu_ctrl);
+	int i, row;
+	uint8_t n = 0;
+	const uint8_t *s;
+
+	ppu->sprite_zero_next = 0;
+
+	if (!is_rendering_enabled(ppu->ppu_mask)) {
+		return;
+	}
+
+	for (i = 0; i < OAM_SIZE / 4; i++) {
+		s = ppu->oam + i * 4;
+		row = ppu->scanline - s[0];
+
+		if (row < 0 || row >= height) {
+			continue;
+		}
+
+		if (n == OAM2_SIZE / 4) {
+			ppu->ppu_status |= PPUSTATUS_SPRITE_OVERFLOW;
+			break;
+		}
+
+		if (i == 0) {
+			ppu->sprite_zero_next = 1;
+		}
+
+		memcpy(ppu->oam2 + n * 4, s, 4);
+		n++;
+	}
+
+	ppu->oam2_count = n;
 }
 
+/* Fetches patterns of the sprites in secondary OAM and draws them into
+ * spr_line for the next scanline (see mux.h for the pixel format). */
 static void
 fetch_sprites(r2C02 *ppu)
 {
+	int height = sprite_height(ppu->ppu_ctrl);
+	int i, p, row, x;
+	uint8_t lo, hi, color, pixel;
+	uint16_t addr;
+	const uint8_t *s;
+
+	memset(ppu->spr_line, 0, SCREEN_WIDTH);
+	ppu->sprite_zero_line = 0;
+
+	if (!is_fg_rendering_enabled(ppu->ppu_mask)) {
+		return;
+	}
+
+	for (i = 0; i < ppu->oam2_count; i++) {
+		s = ppu->oam2 + i * 4;
+		row = ppu->scanline - s[0];
+
+		if (s[2] & 0x80) {
+			row = height - 1 - row;
+		}
+
+		addr = sprite_pattern_addr(ppu, s[1], row);
+		lo = vram_data_read(ppu, addr);
+		hi = vram_data_read(ppu, addr + 8);
+
+		if (s[2] & 0x40) {
+			lo = flip_byte(lo);
+			hi = flip_byte(hi);
+		}
+
+		pixel = (uint8_t)(0x10 | (s[2] & 0x03) << 2);
+
+		if (s[2] & 0x20) {
+			pixel |= MUX_SPR_BEHIND;
+		}
 
+		if (i == 0 && ppu->sprite_zero_next) {
+			pixel |= MUX_SPR_ZERO;
+			ppu->sprite_zero_line = 1;
+		}
+
+		for (p = 0; p < 8; p++) {
+			x = s[3] + p;
+			color = (uint8_t)(((hi >> (7 - p)) & 0x1) << 1 | ((lo >> (7 - p)) & 0x1));
+
+			/* lower OAM index wins */
+			if (x >= SCREEN_WIDTH || color == 0 || (ppu->spr_line[x] & 0x03)) {
+				continue;
+			}
+
+			ppu->spr_line[x] = pixel | color;
+		}
+	}
 }
 
 static uint8_t
@@ -519,6 +767,143 @@ fetch_hi_tile(r2C02 *ppu)
 	return vram_data_read(ppu, addr + 8);
 }
 
+static inline scanline_class
+get_scanline_class(int scanline)
+{
+	if (scanline < 0) {
+		return SCANLINE_PRERENDER;
+	}
+
+	if (scanline < 240) {
+		return SCANLINE_VISIBLE;
+	}
+
+	return scanline == 241 ? SCANLINE_VBLANK_START : SCANLINE_IDLE;
+}
+
+/* NOTE: evaluates the rendering predicates once for every (scanline class,
+ * dot) pair, so ppu_tick only has to load a bitmask.
+ * See: https://www.nesdev.org/wiki/PPU_rendering
+ * See: https://www.nesdev.org/w/images/default/4/4f/Ppu.svg */
+static void
+dot_table_build(void)
+{
+	int c, dot;
+	uint32_t act;
+
+	for (c = 0; c < SCANLINE_CLASSES; c++) {
+		int render_scanline = c == SCANLINE_VISIBLE || c == SCANLINE_PRERENDER;
+
+		for (dot = 0; dot < DOTS_PER_SCANLINE; dot++) {
+			act = 0;
+
+			if (render_scanline) {
+				if (in_range(dot, 1, 256) || in_range(dot, 321, 336)) {
+					switch (dot % 8) {
+						case 0: act |= ACT_INC_X; break;
+						case 1: act |= ACT_FETCH_NT; break;
+						case 3: act |= ACT_FETCH_AT; break;
+						case 5: act |= ACT_FETCH_LO; break;
+						case 7: act |= ACT_FETCH_HI; break;
+					}
+				}
+
+				if (in_range(dot, 2, 257) || in_range(dot, 322, 337)) {
+					act |= ACT_SHIFT;
+
+					if (dot % 8 == 1) {
+						act |= ACT_RELOAD;
+					}
+				}
+
+				if (dot == 256) {
+					act |= ACT_INC_Y;
+				}
+
+				if (dot == 257) {
+					act |= ACT_COPY_X;
+				}
+
+				/* NOTE: sprite evaluation
+				 * See: https://www.nesdev.org/wiki/PPU_sprite_evaluation
+				 * cycle 1-64:      clear sprites                   (use cycle == 1)
+				 * cycle 65-256:    evaluate sprites                (use cycle == 65)
+				 * cycle 257-320:   fetch sprites                   (use cycle == 257)
+				 * cycle 321-340+0: background render pipeline init (use cycle == 321)
+				 */
+				switch (dot) {
+					case 1: act |= ACT_SPR_CLEAR; break;
+					case 65: act |= ACT_SPR_EVAL; break;
+					case 257: act |= ACT_SPR_FETCH; break;
+				}
+			}
+
+			if (c == SCANLINE_VISIBLE && in_range(dot, 1, 256)) {
+				act |= ACT_RENDER;
+			}
+
+			if (c == SCANLINE_VISIBLE && dot == 256) {
+				act |= ACT_RENDER_LINE;
+			}
+
+			if (c == SCANLINE_PRERENDER && in_range(dot, 280, 304)) {
+				act |= ACT_COPY_Y;
+			}
+
+			if (c == SCANLINE_PRERENDER && dot == 1) {
+				act |= ACT_VBLANK_CLEAR;
+			}
+
+			if (c == SCANLINE_VBLANK_START && dot == 1) {
+				act |= ACT_VBLANK_SET;
+			}
+
+			ppu_dot_actions[c][dot] = act;
+		}
+	}
+
+	ppu_dot_actions_ready = 1;
+}
+
+/* Loads a .pal file: either 64 RGB triplets or 8 * 64 triplets with
+ * the emphasis variants already included. Returns 0 on success. */
+int
+ppu_load_palette(const char *path)
+{
+	uint8_t raw[PALETTE_EMPHASIS_SETS * PALETTE_COLORS * 3];
+	uint32_t base[PALETTE_COLORS];
+	size_t n, i;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Can't open palette %s.\n", path);
+		return -1;
+	}
+
+	n = fread(raw, sizeof(uint8_t), sizeof(raw), f);
+	fclose(f);
+
+	if (n == PALETTE_COLORS * 3) {
+		for (i = 0; i < PALETTE_COLORS; i++) {
+			base[i] = (uint32_t)raw[i * 3] << 24 | (uint32_t)raw[i * 3 + 1] << 16 | (uint32_t)raw[i * 3 + 2] << 8 | 0xFF;
+		}
+		colors_lut_build(base);
+		return 0;
+	}
+
+	if (n == sizeof(raw)) {
+		for (i = 0; i < PALETTE_EMPHASIS_SETS * PALETTE_COLORS; i++) {
+			ppu_colors_lut[i / PALETTE_COLORS][i % PALETTE_COLORS] = 0xFF000000 | (uint32_t)raw[i * 3 + 2] << 16 | (uint32_t)raw[i * 3 + 1] << 8 | raw[i * 3];
+		}
+		ppu_colors_lut_ready = 1;
+		return 0;
+	}
+
+	fprintf(stderr, "Invalid palette size: %zu bytes.\n", n);
+	return -1;
+}
+
 uint8_t
 ppu_get_frame_ready_flag(r2C02 *ppu)
 {
@@ -536,6 +921,17 @@ ppu_reset(r2C02 *ppu, struct bus *bus)
 {
 	ppu->bus = bus;
 
+	if (!ppu_colors_lut_ready) {
+		colors_lut_build(ppu_colors);
+	}
+
+	if (!ppu_dot_actions_ready) {
+		dot_table_build();
+	}
+
+	colors_select(ppu);
+	palette_cache_refresh(ppu);
+
 	/* TODO: do we need these lines?
 	ppu->frame = 0;
 	ppu->scanline = 0;
@@ -544,6 +940,20 @@ ppu_reset(r2C02 *ppu, struct bus *bus)
 	*/
 }
 
+void
+ppu_set_frame_buf(r2C02 *ppu, uint32_t *frame_buf)
+{
+	ppu->frame_buf = frame_buf;
+}
+
+/* host colours are derived from PPU registers, not part of saved state */
+void
+ppu_refresh_colors(r2C02 *ppu)
+{
+	colors_select(ppu);
+	palette_cache_refresh(ppu);
+}
+
 /* TODO: only for debug */
 static void
 disasm(r2C02 *ppu)
@@ -562,10 +972,7 @@ disasm(r2C02 *ppu)
 void
 ppu_tick(r2C02 *ppu)
 {
-	int visible_scanline, visible_pixel;
-	int enter_vblank, exit_vblank;
-	int prerender_scanline, render_scanline, postrender_scanline;
-	int rendering_enabled;
+	uint32_t act;
 
 	//disasm(ppu);
 
@@ -573,7 +980,7 @@ ppu_tick(r2C02 *ppu)
 
 	/* TODO: check odd frame? */
 
-	if (ppu->cycle == 341) {
+	if (ppu->cycle == DOTS_PER_SCANLINE) {
 		ppu->cycle = 0;
 		ppu->scanline++;
 
@@ -583,111 +990,168 @@ ppu_tick(r2C02 *ppu)
 		}
 	}
 
-	/* See: https://www.nesdev.org/wiki/PPU_rendering */
-	visible_scanline = in_range(ppu->scanline, 0, 239);
-	visible_pixel = in_range(ppu->cycle, 1, 256);
+	act = ppu_dot_actions[get_scanline_class(ppu->scanline)][ppu->cycle];
 
-	prerender_scanline = ppu->scanline == -1;
-	render_scanline = visible_scanline || prerender_scanline;
-	/* postrender_scanline = ppu->scanline == 240; */
+	if (!is_rendering_enabled(ppu->ppu_mask)) {
+		act &= (uint32_t)~ACT_RENDERING;
+	}
 
-	enter_vblank = ppu->scanline == 241 && ppu->cycle == 1;
-	exit_vblank = ppu->scanline == 261 && ppu->cycle == 1;
+	/* NOTE: frames nobody looks at only need the pixels for sprite 0 hit */
+	if (ppu->frame_buf == NULL) {
+		act &= (uint32_t)~(ppu->sprite_zero_line ? ACT_RENDER_LINE : ACT_RENDER | ACT_RENDER_LINE);
+	}
 
-	rendering_enabled = is_rendering_enabled(ppu->ppu_mask);
-	//new_pixel_group = ppu->cycle % 8 == 1;
+	if (act == 0) {
+		return;
+	}
 
-	/* NOTE: sprite evaluation
-	 * See: https://www.nesdev.org/wiki/PPU_sprite_evaluation
-	 * cycle 1-64:      clear sprites                   (use cycle == 1)
-	 * cycle 65-256:    evaluate sprites                (use cycle == 65)
-	 * cycle 257-320:   fetch sprites                   (use cycle == 257)
-	 * cycle 321-340+0: background render pipeline init (use cycle == 321)
-	 */
-	switch (ppu->cycle) {
-		case 1:
-			clear_sprites(ppu);
-			break;
-		case 65:
-			evaluate_sprites(ppu);
-			break;
-		case 257:
-			fetch_sprites(ppu);
-			break;
+	if (act & ACT_SPR_CLEAR) {
+		clear_sprites(ppu);
+	}
+
+	if (act & ACT_SPR_EVAL) {
+		evaluate_sprites(ppu);
+	}
+
+	if (act & ACT_SPR_FETCH) {
+		fetch_sprites(ppu);
 	}
 
 	/* TODO: rewrite like fetch conveyor */
-	if (rendering_enabled && render_scanline) {
-		if (visible_pixel || in_range(ppu->cycle, 321, 336)) {
-			switch (ppu->cycle % 8) {
-				case 0:
-					ppu->vram_reg.curr_addr.whole = update_x_scroll(ppu);
-					break;
-				case 1:
-					ppu->next_tile.tile_id = fetch_tile_id(ppu);
-					break;
-				case 3:
-					ppu->next_tile.attr = fetch_attr_table(ppu);
-					break;
-				case 5:
-					ppu->next_tile.tile_lo = fetch_lo_tile(ppu);
-					break;
-				case 7:
-					ppu->next_tile.tile_hi = fetch_hi_tile(ppu);
-					break;
-			}
-		}
+	if (act & ACT_INC_X) {
+		ppu->vram_reg.curr_addr.whole = update_x_scroll(ppu);
+	}
 
-		if (in_range(ppu->cycle, 2, 257) || in_range(ppu->cycle, 322, 337)) {
-			update_shift(ppu);
-		
-			if (ppu->cycle % 8 == 1) {
-			  load_next_tile(ppu);
-			}
-		}
+	if (act & ACT_FETCH_NT) {
+		ppu->next_tile.tile_id = fetch_tile_id(ppu);
+	}
 
-		if (ppu->cycle == 256) {
-			ppu->vram_reg.curr_addr.whole = update_y_scroll(ppu);
-		}
+	if (act & ACT_FETCH_AT) {
+		ppu->next_tile.attr = fetch_attr_table(ppu);
+	}
 
-		if (ppu->cycle == 257) {
-			/* TODO: implement update from tmp wrappers:
-			loopy_upd_from_tmp_coarse_x(&ppu->vram_reg);
-			loopy_upd_from_tmp_nametable_x(&ppu->vram_reg);
-			*/
+	if (act & ACT_FETCH_LO) {
+		ppu->next_tile.tile_lo = fetch_lo_tile(ppu);
+	}
 
-			/* Copy X: v: ....F.. ...EDCBA = t: ....F.. ...EDCBA */
-			loopy_set_coarse_x(&ppu->vram_reg.curr_addr.whole, loopy_get_coarse_x(ppu->vram_reg.tmp_addr.whole));
-			loopy_set_nametable_x(&ppu->vram_reg.curr_addr.whole, loopy_get_nametable_x(ppu->vram_reg.tmp_addr.whole));
-		}
+	if (act & ACT_FETCH_HI) {
+		ppu->next_tile.tile_hi = fetch_hi_tile(ppu);
+	}
+
+	if (act & ACT_SHIFT) {
+		update_shift(ppu);
+	}
+
+	if (act & ACT_RELOAD) {
+		load_next_tile(ppu);
 	}
 
-	if (visible_scanline && visible_pixel) {
+	if (act & ACT_INC_Y) {
+		ppu->vram_reg.curr_addr.whole = update_y_scroll(ppu);
+	}
+
+	if (act & ACT_COPY_X) {
+		/* TODO: implement update from tmp wrappers:
+		loopy_upd_from_tmp_coarse_x(&ppu->vram_reg);
+		loopy_upd_from_tmp_nametable_x(&ppu->vram_reg);
+		*/
+
+		/* Copy X: v: ....F.. ...EDCBA = t: ....F.. ...EDCBA */
+		loopy_set_coarse_x(&ppu->vram_reg.curr_addr.whole, loopy_get_coarse_x(ppu->vram_reg.tmp_addr.whole));
+		loopy_set_nametable_x(&ppu->vram_reg.curr_addr.whole, loopy_get_nametable_x(ppu->vram_reg.tmp_addr.whole));
+	}
+
+	if (act & ACT_RENDER) {
 		render_pixel(ppu);
 	}
 
-	if (enter_vblank) {
+	if (act & ACT_RENDER_LINE) {
+		render_line(ppu);
+	}
+
+	if (act & ACT_VBLANK_SET) {
 		vblank_start(ppu);
 	}
 
-	if (ppu->scanline == -1) {
-		if (ppu->cycle == 1) {
-			vblank_end(ppu);
-		}
+	if (act & ACT_VBLANK_CLEAR) {
+		vblank_end(ppu);
+	}
 
-		if (rendering_enabled && in_range(ppu->cycle, 280, 304)) {
-			/* TODO: implement update from tmp wrappers:
-			loopy_upd_from_tmp_coarse_y(&ppu->vram_reg);
-			loopy_upd_from_tmp_fine_y(&ppu->vram_reg);
-			loopy_upd_from_tmp_nametable_y(&ppu->vram_reg);
-			*/
+	if (act & ACT_COPY_Y) {
+		/* TODO: implement update from tmp wrappers:
+		loopy_upd_from_tmp_coarse_y(&ppu->vram_reg);
+		loopy_upd_from_tmp_fine_y(&ppu->vram_reg);
+		loopy_upd_from_tmp_nametable_y(&ppu->vram_reg);
+		*/
+
+		loopy_set_coarse_y(&ppu->vram_reg.curr_addr.whole, loopy_get_coarse_y(ppu->vram_reg.tmp_addr.whole));
+		loopy_set_fine_y(&ppu->vram_reg.curr_addr.whole, loopy_get_fine_y(ppu->vram_reg.tmp_addr.whole));
+		loopy_set_nametable_y(&ppu->vram_reg.curr_addr.whole, loopy_get_nametable_y(ppu->vram_reg.tmp_addr.whole));
+	}
+}
+
+/* NOTE: forced blank fast path. With rendering disabled nothing happens
+ * between the per-scanline events (dots 1, 65, 256, 257 and the scanline
+ * wrap) except that visible dots output the backdrop colour. So we jump
+ * straight to the dot before the next event and clear the skipped span
+ * of bg_line in one pass; render_line turns it into backdrop pixels.
+ * Returns the number of dots consumed. */
+static int
+blank_skip(r2C02 *ppu, int dots)
+{
+	int from = ppu->cycle;
+	int to;
+
+	if (from < 1) {
+		to = 0;
+	} else if (from < 65) {
+		to = 64;
+	} else if (from < 256) {
+		to = 255;
+	} else if (from < 257) {
+		to = 256;
+	} else {
+		to = 340;
+	}
 
-			loopy_set_coarse_y(&ppu->vram_reg.curr_addr.whole, loopy_get_coarse_y(ppu->vram_reg.tmp_addr.whole));
-			loopy_set_fine_y(&ppu->vram_reg.curr_addr.whole, loopy_get_fine_y(ppu->vram_reg.tmp_addr.whole));
-			loopy_set_nametable_y(&ppu->vram_reg.curr_addr.whole, loopy_get_nametable_y(ppu->vram_reg.tmp_addr.whole));
+	if (to - from > dots) {
+		to = from + dots;
+	}
+
+	if (to == from) {
+		ppu_tick(ppu);
+		return 1;
+	}
+
+	if (in_range(ppu->scanline, 0, 239) && from < 256) {
+		memset(ppu->bg_line + from, 0, (size_t)(to - from));
+	}
+
+	ppu->cycle = to;
+	return to - from;
+}
+
+void
+ppu_run(r2C02 *ppu, int dots)
+{
+	while (dots > 0) {
+		if (is_rendering_enabled(ppu->ppu_mask)) {
+			ppu_tick(ppu);
+			dots--;
+		} else {
+			dots -= blank_skip(ppu, dots);
 		}
 	}
+}
+
+/* dots to run until vblank starts, the dot that starts it included */
+int
+ppu_dots_to_vblank(r2C02 *ppu)
+{
+	int at = (ppu->scanline + 1) * DOTS_PER_SCANLINE + ppu->cycle;
+	int dots = (241 + 1) * DOTS_PER_SCANLINE + 1 - at;
 
+	return dots > 0 ? dots : dots + DOTS_PER_FRAME;
 }
 
 uint8_t
@@ -713,6 +1177,8 @@ ppu_read(r2C02 *ppu, uint16_t addr)
 void
 ppu_write(r2C02 *ppu, uint16_t addr, uint8_t val)
 {
+	uint8_t changed;
+
 	switch (addr) {
 		case PPUCTRL:
 			if (!is_nmi_enabled(ppu->ppu_ctrl) && is_vblank_enabled(ppu->ppu_status)) {
@@ -724,7 +1190,13 @@ ppu_write(r2C02 *ppu, uint16_t addr, uint8_t val)
 			loopy_set_nametable_y(&ppu->vram_reg.tmp_addr.whole, (val & 0x2) >> 1);
 			break;
 		case PPUMASK:
+			changed = ppu->ppu_mask ^ val;
 			ppu->ppu_mask = val;
+
+			if (changed & (PPUMASK_BGR | PPUMASK_GREYSCALE)) {
+				colors_select(ppu);
+				palette_cache_refresh(ppu);
+			}
 			break;
 		case OAMADDR:
 			ppu->oam_addr = val;
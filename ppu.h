@@ -3,8 +3,10 @@
 
 #include <stdint.h>
 
+#include "dirty.h"
+
 enum {
-	VRAM_SIZE = 2048,
+	VRAM_SIZE = 0x1000, /* 2 KB on the console, 4 KB with four-screen boards */
 	OAM_SIZE = 256,
 	OAM2_SIZE = 32
 };
@@ -54,8 +56,12 @@ typedef struct {
 	uint8_t write_buffer;
 	uint8_t frame_ready_flag;
 	uint8_t suppress_nmi_flag;
+	uint8_t oam2_count;       /* sprites found for the next scanline */
+	uint8_t sprite_zero_next; /* sprite 0 is among them */
+	uint8_t sprite_zero_line; /* sprite 0 is in spr_line */
 
 	uint8_t vram[VRAM_SIZE];
+	uint8_t palette[0x20];
 	uint8_t oam[OAM_SIZE];
 	uint8_t oam2[OAM2_SIZE];
 
@@ -64,7 +70,12 @@ typedef struct {
 	int frame;
 
 	sprite sprite_table[8];
-	uint32_t frame_buf[SCREEN_WIDTH * SCREEN_HEIGHT];
+	uint8_t bg_line[SCREEN_WIDTH];  /* background palette indices */
+	uint8_t spr_line[SCREEN_WIDTH]; /* sprite pixels, see mux.h */
+	uint32_t palette_cache[0x20];   /* host colours of palette entries */
+	const uint32_t *colors;         /* ppu_colors_lut row for current emphasis */
+	uint32_t *frame_buf; /* owned by the frontend, NULL skips drawing */
+	dirty *dirty;        /* of the bus, VRAM writes are tracked */
 
 	struct {
 		uint16_t tile_lo;
@@ -90,10 +101,15 @@ typedef struct {
 	struct bus *bus;
 } r2C02;
 
+int ppu_load_palette(const char *);
 uint8_t ppu_get_frame_ready_flag(r2C02 *);
 void ppu_unset_frame_ready_flag(r2C02 *);
 void ppu_reset(r2C02 *, struct bus *);
+void ppu_set_frame_buf(r2C02 *, uint32_t *);
+void ppu_refresh_colors(r2C02 *);
 void ppu_tick(r2C02 *);
+void ppu_run(r2C02 *, int);
+int ppu_dots_to_vblank(r2C02 *);
 uint8_t ppu_read(r2C02 *, uint16_t);
 void ppu_write(r2C02 *, uint16_t, uint8_t);
 
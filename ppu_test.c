@@ -0,0 +1,135 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+
+#include "ppu.c"
+
+/* NOTE: the PPU without a cartrige. Every pattern byte reads $FF, so the
+ * background is opaque wherever it is shown. */
+uint8_t
+bus_cartrige_get_mirroring(struct bus *bus)
+{
+	(void)bus;
+	return 0;
+}
+
+uint8_t
+bus_cartrige_read(struct bus *bus, uint16_t addr)
+{
+	(void)bus;
+	(void)addr;
+	return 0xFF;
+}
+
+void
+bus_cartrige_write(struct bus *bus, uint16_t addr, uint8_t val)
+{
+	(void)bus;
+	(void)addr;
+	(void)val;
+}
+
+void
+bus_cpu_trigger_nmi(struct bus *bus)
+{
+	(void)bus;
+}
+
+/* R, G and B of an RGBA colour */
+static uint8_t
+channel(uint32_t rgba, int i)
+{
+	return (uint8_t)(rgba >> (24 - 8 * i));
+}
+
+Test(emphasis, darkens_other_channels)
+{
+	const uint32_t grey = 0x808080FF;
+	uint32_t c;
+	int e, i;
+
+	cr_assert(eq(u32, emphasize_color(grey, 0x10, 0), grey));
+
+	for (e = 1; e < PALETTE_EMPHASIS_SETS; e++) {
+		c = emphasize_color(grey, 0x10, (uint8_t)e);
+		for (i = 0; i < 3; i++) {
+			/* a channel keeps its level only if its own bit is the only one */
+			cr_assert(eq(u8, channel(c, i), e == 1 << i ? 0x80 : 0x60),
+			          "emphasis %d, channel %d", e, i);
+		}
+		cr_assert(eq(u8, (uint8_t)c, 0xFF));
+	}
+}
+
+Test(emphasis, all_bits_darken_everything)
+{
+	uint32_t c = emphasize_color(0xC0A040FF, 0x2A, 7);
+
+	cr_assert(eq(u8, channel(c, 0), 0xC0 * 3 / 4));
+	cr_assert(eq(u8, channel(c, 1), 0xA0 * 3 / 4));
+	cr_assert(eq(u8, channel(c, 2), 0x40 * 3 / 4));
+}
+
+Test(emphasis, black_is_untouched)
+{
+	cr_assert(eq(u32, emphasize_color(0x101010FF, 0x0E, 7), 0x101010FF));
+}
+
+/* a visible scanline about to start, sprite 0 covering x in spr_line */
+static void
+sprite_zero_line(r2C02 *ppu, int x, uint8_t mask)
+{
+	memset(ppu, 0, sizeof(*ppu));
+	ppu_reset(ppu, NULL);
+	ppu->ppu_mask = mask;
+	ppu->scanline = 10;
+	ppu->cycle = 0;
+	ppu->spr_line[x] = 0x10 | MUX_SPR_ZERO | 0x01;
+	ppu->sprite_zero_line = 1;
+}
+
+static int
+hit(const r2C02 *ppu)
+{
+	return (ppu->ppu_status & PPUSTATUS_SPRITE_ZERO_HIT) != 0;
+}
+
+/* raised at the dot of the pixel, not when the line is done */
+Test(sprite_zero, hit_at_its_dot)
+{
+	static r2C02 ppu;
+
+	sprite_zero_line(&ppu, 100, PPUMASK_BACKGROUND_ENABLE | PPUMASK_SPRITE_ENABLE);
+
+	while (ppu.cycle < 100) {
+		ppu_tick(&ppu);
+	}
+	cr_assert(eq(int, hit(&ppu), 0));
+
+	ppu_tick(&ppu);
+	cr_assert(eq(int, hit(&ppu), 1));
+}
+
+Test(sprite_zero, hidden_left_column)
+{
+	static r2C02 ppu;
+
+	sprite_zero_line(&ppu, 4, PPUMASK_BACKGROUND_ENABLE | PPUMASK_SPRITE_ENABLE);
+	ppu.shift.tile_lo = ppu.shift.tile_hi = 0xFFFF; /* opaque from the first pixel */
+	ppu_run(&ppu, 256);
+	cr_assert(eq(int, hit(&ppu), 0));
+
+	sprite_zero_line(&ppu, 4, PPUMASK_BACKGROUND_ENABLE | PPUMASK_SPRITE_ENABLE |
+	                 PPUMASK_BACKGROUND_LEFT_COL_ENABLE | PPUMASK_SPRITE_LEFT_COL_ENABLE);
+	ppu.shift.tile_lo = ppu.shift.tile_hi = 0xFFFF;
+	ppu_run(&ppu, 5);
+	cr_assert(eq(int, hit(&ppu), 1));
+}
+
+Test(sprite_zero, not_at_x_255)
+{
+	static r2C02 ppu;
+
+	sprite_zero_line(&ppu, 255, PPUMASK_BACKGROUND_ENABLE | PPUMASK_SPRITE_ENABLE);
+	ppu_run(&ppu, 256);
+	cr_assert(eq(int, hit(&ppu), 0));
+}
@@ -0,0 +1,221 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h> /* memmove, strcmp */
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "resample.h"
+
+/* NOTE: every output sample is a dot product of taps queued input samples
+ * with one row of a windowed-sinc kernel. The kernel is tabulated at
+ * phases fractional offsets and the two rows around the exact offset are
+ * blended linearly. The cutoff follows the output rate, so the filter
+ * also removes what the output can't represent.
+ *
+ * Taps are always a multiple of 8: the inner loop runs 8 (AVX) or 4 (SSE)
+ * floats at a time, dot2_scalar is the reference and the fallback. */
+
+static const struct {
+	const char *name;
+	int taps;
+	int phases;
+} qualities[RESAMPLE_QUALITIES] = {
+	[RESAMPLE_LOW]    = { "low",     8,  32 },
+	[RESAMPLE_MEDIUM] = { "medium", 16,  64 },
+	[RESAMPLE_HIGH]   = { "high",   32, 256 }
+};
+
+int
+resample_quality(const char *name)
+{
+	int i;
+
+	for (i = 0; i < RESAMPLE_QUALITIES; i++) {
+		if (strcmp(name, qualities[i].name) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void
+kernel_build(resampler *r, double cutoff)
+{
+	const double pi = 3.14159265358979323846;
+	const int half = r->taps / 2;
+	float *row;
+	double x, w, sum;
+	int p, k;
+
+	for (p = 0; p <= r->phases; p++) {
+		row = r->kernel + p * r->taps;
+		sum = 0;
+
+		for (k = 0; k < r->taps; k++) {
+			x = k - (half - 1) - (double)p / r->phases;
+			w = 0.42 + 0.5 * cos(pi * x / half) + 0.08 * cos(2 * pi * x / half);
+			row[k] = (float)(w * (x == 0 ? cutoff : sin(pi * cutoff * x) / (pi * x)));
+			sum += row[k];
+		}
+
+		/* unity gain at DC for every phase */
+		for (k = 0; k < r->taps; k++) {
+			row[k] = (float)(row[k] / sum);
+		}
+	}
+}
+
+void
+resample_init(resampler *r, int quality, double in_rate, double out_rate)
+{
+	double cutoff = out_rate < in_rate ? out_rate / in_rate : 1;
+
+	memset(r, 0, sizeof(*r));
+
+	r->quality = quality;
+	r->taps = qualities[quality].taps;
+	r->phases = qualities[quality].phases;
+	r->base_step = (uint64_t)(in_rate / out_rate * (double)((uint64_t)1 << RESAMPLE_FRAC_BITS));
+	r->step = r->base_step;
+
+	/* leave some room for the transition band below the output Nyquist */
+	kernel_build(r, cutoff * 0.90);
+}
+
+/* ratio > 1 produces more output samples for the same input */
+void
+resample_set_ratio(resampler *r, double ratio)
+{
+	r->step = (uint64_t)((double)r->base_step / ratio);
+}
+
+static inline void
+dot2_scalar(const float *x, const float *k0, const float *k1, int taps, float *a, float *b)
+{
+	float sa = 0, sb = 0;
+	int i;
+
+	for (i = 0; i < taps; i++) {
+		sa += x[i] * k0[i];
+		sb += x[i] * k1[i];
+	}
+
+	*a = sa;
+	*b = sb;
+}
+
+#if defined(__AVX__)
+static inline float
+hsum(__m256 v)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+	return _mm_cvtss_f32(s);
+}
+
+static inline void
+dot2(const float *x, const float *k0, const float *k1, int taps, float *a, float *b)
+{
+	__m256 sa = _mm256_setzero_ps();
+	__m256 sb = _mm256_setzero_ps();
+	__m256 v;
+	int i;
+
+	for (i = 0; i < taps; i += 8) {
+		v = _mm256_loadu_ps(x + i);
+		sa = _mm256_add_ps(sa, _mm256_mul_ps(v, _mm256_loadu_ps(k0 + i)));
+		sb = _mm256_add_ps(sb, _mm256_mul_ps(v, _mm256_loadu_ps(k1 + i)));
+	}
+
+	*a = hsum(sa);
+	*b = hsum(sb);
+}
+#elif defined(__SSE__)
+static inline float
+hsum(__m128 s)
+{
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+	return _mm_cvtss_f32(s);
+}
+
+static inline void
+dot2(const float *x, const float *k0, const float *k1, int taps, float *a, float *b)
+{
+	__m128 sa = _mm_setzero_ps();
+	__m128 sb = _mm_setzero_ps();
+	__m128 v;
+	int i;
+
+	for (i = 0; i < taps; i += 4) {
+		v = _mm_loadu_ps(x + i);
+		sa = _mm_add_ps(sa, _mm_mul_ps(v, _mm_loadu_ps(k0 + i)));
+		sb = _mm_add_ps(sb, _mm_mul_ps(v, _mm_loadu_ps(k1 + i)));
+	}
+
+	*a = hsum(sa);
+	*b = hsum(sb);
+}
+#else
+static inline void
+dot2(const float *x, const float *k0, const float *k1, int taps, float *a, float *b)
+{
+	dot2_scalar(x, k0, k1, taps, a, b);
+}
+#endif
+
+/* queues count input samples and writes up to max output samples.
+ * Input that doesn't fit the queue is dropped. */
+int
+resample_run(resampler *r, const int16_t *in, int count, int16_t *out, int max)
+{
+	const uint64_t frac_mask = ((uint64_t)1 << RESAMPLE_FRAC_BITS) - 1;
+	const float *k0;
+	uint64_t phase;
+	uint32_t idx;
+	float a, b, s;
+	int i, n = 0;
+
+	if (count > RESAMPLE_BUF_SIZE - r->count) {
+		count = RESAMPLE_BUF_SIZE - r->count;
+	}
+
+	for (i = 0; i < count; i++) {
+		r->buf[r->count + i] = in[i];
+	}
+	r->count += count;
+
+	for (; n < max; n++) {
+		idx = (uint32_t)(r->pos >> RESAMPLE_FRAC_BITS);
+		if (idx + (uint32_t)r->taps > (uint32_t)r->count) {
+			break;
+		}
+
+		phase = (r->pos & frac_mask) * (uint64_t)r->phases;
+		k0 = r->kernel + (phase >> RESAMPLE_FRAC_BITS) * (uint64_t)r->taps;
+
+		dot2(r->buf + idx, k0, k0 + r->taps, r->taps, &a, &b);
+		s = a + (b - a) * (float)(phase & frac_mask) * (1.0f / 4294967296.0f);
+
+		out[n] = (int16_t)(s > INT16_MAX ? INT16_MAX : s < INT16_MIN ? INT16_MIN : lrintf(s));
+		r->pos += r->step;
+	}
+
+	/* drop the input no future output sample can reach */
+	idx = (uint32_t)(r->pos >> RESAMPLE_FRAC_BITS);
+	if (idx > (uint32_t)r->count) {
+		idx = (uint32_t)r->count;
+	}
+
+	memmove(r->buf, r->buf + idx, (size_t)(r->count - (int)idx) * sizeof(r->buf[0]));
+	r->count -= (int)idx;
+	r->pos -= (uint64_t)idx << RESAMPLE_FRAC_BITS;
+
+	return n;
+}
@@ -0,0 +1,40 @@
+#ifndef NES_RESAMPLE_H
+#define NES_RESAMPLE_H
+
+#include <stdint.h>
+
+/* polyphase FIR resampler from the APU output rate to the host rate */
+
+enum {
+	RESAMPLE_LOW,
+	RESAMPLE_MEDIUM,
+	RESAMPLE_HIGH,
+	RESAMPLE_QUALITIES
+};
+
+enum {
+	RESAMPLE_MAX_TAPS = 32,
+	RESAMPLE_MAX_PHASES = 256,
+	RESAMPLE_BUF_SIZE = 8192, /* input samples that can be queued */
+	RESAMPLE_FRAC_BITS = 32
+};
+
+typedef struct {
+	int quality;
+	int taps;
+	int phases;
+	uint64_t base_step; /* input samples per output sample, RESAMPLE_FRAC_BITS fixed point */
+	uint64_t step;      /* base_step after rate control */
+	uint64_t pos;       /* input position of the next output sample */
+	int count;          /* queued input samples */
+	float buf[RESAMPLE_BUF_SIZE + RESAMPLE_MAX_TAPS];
+	/* phases + 1 rows, so phase p can always be blended with p + 1 */
+	float kernel[(RESAMPLE_MAX_PHASES + 1) * RESAMPLE_MAX_TAPS];
+} resampler;
+
+int resample_quality(const char *);
+void resample_init(resampler *, int, double, double);
+void resample_set_ratio(resampler *, double);
+int resample_run(resampler *, const int16_t *, int, int16_t *, int);
+
+#endif /* NES_RESAMPLE_H */
@@ -0,0 +1,87 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+
+#include "resample.c"
+
+enum { CHUNK = 1600 };
+
+static resampler r;
+static int16_t in[CHUNK];
+static int16_t out[CHUNK];
+
+Test(resample, output_rate) {
+	int f, total = 0;
+
+	resample_init(&r, RESAMPLE_HIGH, 96000, 44100);
+	for (f = 0; f < 60; f++) {
+		total += resample_run(&r, in, CHUNK, out, CHUNK);
+	}
+
+	/* one second of input minus the filter delay */
+	cr_assert(ge(int, total, 44100 - 32));
+	cr_assert(le(int, total, 44100));
+}
+
+Test(resample, dc_gain) {
+	int q, i, n;
+
+	for (q = 0; q < RESAMPLE_QUALITIES; q++) {
+		for (i = 0; i < CHUNK; i++) {
+			in[i] = 10000;
+		}
+
+		resample_init(&r, q, 96000, 48000);
+		n = resample_run(&r, in, CHUNK, out, CHUNK);
+
+		for (i = 0; i < n; i++) {
+			cr_assert(eq(int, out[i], 10000));
+		}
+	}
+}
+
+Test(resample, passband_and_stopband) {
+	double pass = 0, stop = 0;
+	int i, n;
+
+	/* 1 kHz is kept, 40 kHz is above the 24 kHz output Nyquist */
+	for (i = 0; i < CHUNK; i++) {
+		in[i] = (int16_t)(10000 * sin(2 * 3.14159265358979 * 1000 * i / 96000));
+	}
+
+	resample_init(&r, RESAMPLE_HIGH, 96000, 48000);
+	n = resample_run(&r, in, CHUNK, out, CHUNK);
+	for (i = 100; i < n; i++) {
+		pass = fmax(pass, abs(out[i]));
+	}
+
+	for (i = 0; i < CHUNK; i++) {
+		in[i] = (int16_t)(10000 * sin(2 * 3.14159265358979 * 40000 * i / 96000));
+	}
+
+	resample_init(&r, RESAMPLE_HIGH, 96000, 48000);
+	n = resample_run(&r, in, CHUNK, out, CHUNK);
+	for (i = 100; i < n; i++) {
+		stop = fmax(stop, abs(out[i]));
+	}
+
+	cr_assert(gt(dbl, pass, 9900.0));
+	cr_assert(lt(dbl, stop, 100.0));
+}
+
+Test(resample, matches_scalar) {
+	float x[RESAMPLE_MAX_TAPS];
+	float a, b, ra, rb;
+	int i, p;
+
+	resample_init(&r, RESAMPLE_HIGH, 96000, 48000);
+	for (i = 0; i < RESAMPLE_MAX_TAPS; i++) {
+		x[i] = (float)(i * 37 % 101 - 50);
+	}
+
+	for (p = 0; p < r.phases; p++) {
+		dot2(x, r.kernel + p * r.taps, r.kernel + (p + 1) * r.taps, r.taps, &a, &b);
+		dot2_scalar(x, r.kernel + p * r.taps, r.kernel + (p + 1) * r.taps, r.taps, &ra, &rb);
+		cr_assert(lt(dbl, fabs(a - ra), 1e-3));
+		cr_assert(lt(dbl, fabs(b - rb), 1e-3));
+	}
+}
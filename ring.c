@@ -0,0 +1,90 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h> /* memcpy */
+
+#include "ring.h"
+
+/* NOTE: head and tail only ever grow and are masked on access, so
+ * head - tail is the fill level even after they wrap around. */
+
+void
+ring_init(ring *r, int16_t *buf, size_t size)
+{
+	r->buf = buf;
+	r->mask = size - 1;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+}
+
+size_t
+ring_count(ring *r)
+{
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+	return head - tail;
+}
+
+/* copies count samples starting at index pos, wrapping at the end */
+static void
+copy_in(ring *r, size_t pos, const int16_t *src, size_t count)
+{
+	size_t at = pos & r->mask;
+	size_t first = r->mask + 1 - at;
+
+	if (first > count) {
+		first = count;
+	}
+
+	memcpy(r->buf + at, src, first * sizeof(src[0]));
+	memcpy(r->buf, src + first, (count - first) * sizeof(src[0]));
+}
+
+static void
+copy_out(ring *r, size_t pos, int16_t *dst, size_t count)
+{
+	size_t at = pos & r->mask;
+	size_t first = r->mask + 1 - at;
+
+	if (first > count) {
+		first = count;
+	}
+
+	memcpy(dst, r->buf + at, first * sizeof(dst[0]));
+	memcpy(dst + first, r->buf, (count - first) * sizeof(dst[0]));
+}
+
+/* producer side. Returns how many samples fit, the rest is dropped. */
+size_t
+ring_write(ring *r, const int16_t *src, size_t count)
+{
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	size_t space = r->mask + 1 - (head - tail);
+
+	if (count > space) {
+		count = space;
+	}
+
+	copy_in(r, head, src, count);
+	atomic_store_explicit(&r->head, head + count, memory_order_release);
+
+	return count;
+}
+
+/* consumer side. Returns how many samples were available. */
+size_t
+ring_read(ring *r, int16_t *dst, size_t count)
+{
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+	if (count > head - tail) {
+		count = head - tail;
+	}
+
+	copy_out(r, tail, dst, count);
+	atomic_store_explicit(&r->tail, tail + count, memory_order_release);
+
+	return count;
+}
@@ -0,0 +1,27 @@
+#ifndef NES_RING_H
+#define NES_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* single-producer/single-consumer sample queue. One thread writes, another
+ * reads, neither ever blocks: each side only stores its own index and
+ * loads the other one. The caller owns the storage, its size must be a
+ * power of two. */
+
+enum { RING_CACHE_LINE = 64 };
+
+typedef struct {
+	int16_t *buf;
+	size_t mask;
+	_Alignas(RING_CACHE_LINE) atomic_size_t head; /* written by the producer */
+	_Alignas(RING_CACHE_LINE) atomic_size_t tail; /* written by the consumer */
+} ring;
+
+void ring_init(ring *, int16_t *, size_t);
+size_t ring_count(ring *);
+size_t ring_write(ring *, const int16_t *, size_t);
+size_t ring_read(ring *, int16_t *, size_t);
+
+#endif /* NES_RING_H */
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+
+#include "rollback.h"
+
+enum {
+	MASK = ROLLBACK_WINDOW - 1
+};
+
+int
+rollback_init(rollback *r, size_t size)
+{
+	*r = (rollback){0};
+
+	if ((r->snaps = malloc(size * ROLLBACK_WINDOW)) == NULL) {
+		return -1;
+	}
+
+	r->size = size;
+	return 0;
+}
+
+void
+rollback_free(rollback *r)
+{
+	free(r->snaps);
+	*r = (rollback){0};
+}
+
+/* not without the snapshot to go back to when the guesses are wrong */
+int
+rollback_can_run(const rollback *r)
+{
+	return r->frame < r->confirmed + ROLLBACK_FRAMES;
+}
+
+/* where the state at the start of frame f goes */
+void *
+rollback_snap(rollback *r, uint32_t f)
+{
+	return r->snaps + (f & MASK) * r->size;
+}
+
+/* the remote input frame f is run with, a guess if it isn't known */
+uint8_t
+rollback_remote_input(rollback *r, uint32_t f)
+{
+	if (f >= r->confirmed) {
+		r->remote[f & MASK] = r->confirmed > 0 ? r->remote[(r->confirmed - 1) & MASK] : 0;
+	}
+
+	return r->remote[f & MASK];
+}
+
+/* NOTE: remote input has to arrive in order, the transport sends enough
+ * of the past with every packet to make up for the lost and reordered
+ * ones. Anything else is old news. */
+void
+rollback_remote(rollback *r, uint32_t f, uint8_t input)
+{
+	if (f != r->confirmed ||
+	    (f > r->frame && f - r->frame >= ROLLBACK_WINDOW - ROLLBACK_FRAMES)) {
+		return;
+	}
+
+	if (f < r->frame && r->remote[f & MASK] != input && f < r->redo) {
+		r->redo = f;
+	}
+
+	r->remote[f & MASK] = input;
+	r->confirmed++;
+}
+
+/* the next frame has been run */
+void
+rollback_done(rollback *r)
+{
+	if (r->redo == r->frame) {
+		r->redo++;
+	}
+	r->frame++;
+}
+
+/* Returns the first frame to run again, frame if none, and takes it as
+ * done. */
+uint32_t
+rollback_redo(rollback *r)
+{
+	uint32_t f = r->redo;
+
+	if (f < r->frame) {
+		r->rollbacks++;
+		r->redone += r->frame - f;
+		if (r->frame - f > r->longest) {
+			r->longest = r->frame - f;
+		}
+	}
+
+	r->redo = r->frame;
+	return f;
+}
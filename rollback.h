@@ -0,0 +1,41 @@
+#ifndef NES_ROLLBACK_H
+#define NES_ROLLBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* NOTE: rollback bookkeeping for two players. Frames run as soon as the
+ * local input is there, the remote input is guessed to be the last one
+ * we know. Once the real one arrives and differs, every frame from the
+ * first wrong guess on is run again from the snapshot taken at its start
+ * (redo), and the console ends up where it would have been had the input
+ * been there in time. Guessing is limited to ROLLBACK_FRAMES frames;
+ * beyond that the game waits for the peer. */
+enum {
+	ROLLBACK_FRAMES = 8,
+	ROLLBACK_WINDOW = 32 /* frames of input and snapshots kept, power of two */
+};
+
+typedef struct {
+	uint8_t local[ROLLBACK_WINDOW];
+	uint8_t remote[ROLLBACK_WINDOW]; /* known or guessed */
+	uint8_t *snaps;     /* state at the start of frame f, by f % window */
+	size_t size;        /* bytes per snapshot */
+	uint32_t frame;     /* next frame to run */
+	uint32_t confirmed; /* remote input known for frames before it */
+	uint32_t redo;      /* first frame to run again, frame if none */
+	uint64_t rollbacks;
+	uint64_t redone;    /* frames run again */
+	uint32_t longest;   /* most frames run again at once */
+} rollback;
+
+int rollback_init(rollback *, size_t);
+void rollback_free(rollback *);
+int rollback_can_run(const rollback *);
+void *rollback_snap(rollback *, uint32_t);
+uint8_t rollback_remote_input(rollback *, uint32_t);
+void rollback_remote(rollback *, uint32_t, uint8_t);
+void rollback_done(rollback *);
+uint32_t rollback_redo(rollback *);
+
+#endif /* NES_ROLLBACK_H */
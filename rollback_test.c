@@ -0,0 +1,103 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <string.h>
+
+#include "rollback.c"
+
+enum {
+	FRAMES = 200
+};
+
+/* a game whose state depends on every input of both players, in order */
+static uint32_t
+step(uint32_t s, uint8_t local, uint8_t remote)
+{
+	return s * 31 + local + 7u * remote;
+}
+
+static uint8_t
+input(int player, uint32_t f)
+{
+	return (uint8_t)((f / 5 + (uint32_t)player * 3) % 4);
+}
+
+static void
+run(rollback *r, uint32_t *s, uint32_t f)
+{
+	memcpy(rollback_snap(r, f), s, sizeof(*s));
+	*s = step(*s, r->local[f % ROLLBACK_WINDOW], rollback_remote_input(r, f));
+}
+
+static void
+sync(rollback *r, uint32_t *s)
+{
+	uint32_t f = rollback_redo(r);
+
+	if (f < r->frame) {
+		memcpy(s, rollback_snap(r, f), sizeof(*s));
+	}
+	for (; f < r->frame; f++) {
+		run(r, s, f);
+	}
+}
+
+/* remote input shows up a few frames after it was needed, the wrong
+ * guesses are redone and the game ends where it would have without */
+Test(rollback, late_input) {
+	rollback r;
+	uint32_t s = 0, want = 0, f, late = 5;
+
+	cr_assert(eq(int, rollback_init(&r, sizeof(s)), 0));
+
+	for (f = 0; f < FRAMES + late; f++) {
+		if (f >= late) {
+			rollback_remote(&r, f - late, input(1, f - late));
+		}
+		sync(&r, &s);
+
+		if (f < FRAMES) {
+			cr_assert(eq(int, rollback_can_run(&r), 1));
+			r.local[r.frame % ROLLBACK_WINDOW] = input(0, r.frame);
+			run(&r, &s, r.frame);
+			rollback_done(&r);
+		}
+	}
+
+	for (f = 0; f < FRAMES; f++) {
+		want = step(want, input(0, f), input(1, f));
+	}
+
+	cr_assert(eq(u32, s, want));
+	cr_assert(gt(u64, r.rollbacks, 0));
+	cr_assert(le(u32, r.longest, late));
+
+	rollback_free(&r);
+}
+
+/* no guessing further than ROLLBACK_FRAMES, and only in order */
+Test(rollback, waits) {
+	rollback r;
+	uint32_t s = 0, f;
+
+	cr_assert(eq(int, rollback_init(&r, sizeof(s)), 0));
+
+	for (f = 0; f < ROLLBACK_FRAMES; f++) {
+		cr_assert(eq(int, rollback_can_run(&r), 1));
+		run(&r, &s, r.frame);
+		rollback_done(&r);
+	}
+	cr_assert(eq(int, rollback_can_run(&r), 0));
+
+	rollback_remote(&r, 1, 1);
+	cr_assert(eq(u32, r.confirmed, 0));
+
+	rollback_remote(&r, 0, 0);
+	cr_assert(eq(u32, r.confirmed, 1));
+	cr_assert(eq(u32, r.redo, r.frame)); /* guessed right */
+	cr_assert(eq(int, rollback_can_run(&r), 1));
+
+	rollback_remote(&r, 1, 1);
+	cr_assert(eq(u32, r.redo, 1));
+
+	rollback_free(&r);
+}
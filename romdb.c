@@ -0,0 +1,48 @@
+#include <stdlib.h> /* bsearch */
+
+#include "romdb.h"
+
+/* NOTE: sorted by crc. Only add entries checked against a known good
+ * dump, a wrong one breaks a game that had a fine header.
+ * TODO: fill from a verified NES 2.0 database, nestest is only here to
+ * catch a copy of it with a broken header. */
+static const romdb_entry
+romdb[] = {
+	{ 0x158B0388, 0, 0, HORIZONTAL_MIRRORING, 0, INES_NTSC, 0, "nestest" },
+};
+
+static int
+romdb_cmp(const void *key, const void *elem)
+{
+	uint32_t crc = *(const uint32_t *)key;
+	uint32_t other = ((const romdb_entry *)elem)->crc;
+
+	return crc < other ? -1 : crc > other;
+}
+
+/* Returns NULL if the ROM isn't known. */
+const romdb_entry *
+romdb_find(uint32_t crc)
+{
+	return bsearch(&crc, romdb, sizeof(romdb) / sizeof(romdb[0]), sizeof(romdb[0]), romdb_cmp);
+}
+
+/* puts the known values over the header ones, returns 1 if any differed */
+int
+romdb_apply(const romdb_entry *e, ines_info *info)
+{
+	ines_info old = *info;
+
+	info->mapper = e->mapper;
+	info->submapper = e->submapper;
+	info->mirroring = (mirroring_type)e->mirroring;
+	info->battery = e->battery;
+	info->timing = (ines_timing)e->timing;
+	info->prg_ram = e->battery ? 0 : e->prg_ram;
+	info->prg_nvram = e->battery ? e->prg_ram : 0;
+
+	return old.mapper != info->mapper || old.submapper != info->submapper ||
+	       old.mirroring != info->mirroring || old.battery != info->battery ||
+	       old.timing != info->timing || old.prg_ram != info->prg_ram ||
+	       old.prg_nvram != info->prg_nvram;
+}
@@ -0,0 +1,24 @@
+#ifndef NES_ROMDB_H
+#define NES_ROMDB_H
+
+#include <stdint.h>
+
+#include "ines.h"
+
+/* NOTE: what known dumps really are, for headers that lie. Keyed by the
+ * CRC32 of PRG ROM followed by CHR ROM, the way ROM databases list them. */
+typedef struct {
+	uint32_t crc;
+	int16_t mapper;
+	uint8_t submapper;
+	uint8_t mirroring; /* mirroring_type */
+	uint8_t battery;
+	uint8_t timing;    /* ines_timing */
+	uint32_t prg_ram;  /* bytes, nvram if battery */
+	const char *name;
+} romdb_entry;
+
+const romdb_entry *romdb_find(uint32_t);
+int romdb_apply(const romdb_entry *, ines_info *);
+
+#endif /* NES_ROMDB_H */
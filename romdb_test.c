@@ -0,0 +1,46 @@
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+
+#include "romdb.c"
+
+Test(romdb, unknown)
+{
+	cr_assert(romdb_find(0) == NULL);
+	cr_assert(romdb_find(0xFFFFFFFF) == NULL);
+}
+
+/* a dump with the mirroring bit, battery and upper mapper nibble wrong */
+Test(romdb, corrects_bad_header)
+{
+	const romdb_entry *e = romdb_find(0x158B0388);
+	ines_info info = {
+		.version = 1,
+		.mapper = 0x40,
+		.mirroring = VERTICAL_MIRRORING,
+		.battery = 1,
+		.prg_rom = 0x4000,
+		.chr_rom = 0x2000,
+		.prg_nvram = 0x2000
+	};
+
+	cr_assert(e != NULL);
+	cr_assert(eq(int, romdb_apply(e, &info), 1));
+	cr_assert(eq(int, info.mapper, 0));
+	cr_assert(eq(int, info.mirroring, HORIZONTAL_MIRRORING));
+	cr_assert(eq(int, info.battery, 0));
+	cr_assert(eq(u32, info.prg_nvram, 0));
+	cr_assert(eq(u32, info.prg_rom, 0x4000));
+
+	/* nothing left to correct */
+	cr_assert(eq(int, romdb_apply(e, &info), 0));
+}
+
+/* bsearch needs the table sorted */
+Test(romdb, sorted)
+{
+	size_t i;
+
+	for (i = 1; i < sizeof(romdb) / sizeof(romdb[0]); i++) {
+		cr_assert(lt(u32, romdb[i - 1].crc, romdb[i].crc));
+	}
+}
@@ -0,0 +1,58 @@
+#include <stdint.h>
+
+#include "sched.h"
+
+static void
+update_next(sched *s)
+{
+	int i;
+
+	s->next = SCHED_NEVER;
+
+	for (i = 0; i < SCHED_EVENTS; i++) {
+		if (s->when[i] < s->next) {
+			s->next = s->when[i];
+		}
+	}
+}
+
+void
+sched_reset(sched *s)
+{
+	int i;
+
+	for (i = 0; i < SCHED_EVENTS; i++) {
+		s->when[i] = SCHED_NEVER;
+	}
+
+	s->next = SCHED_NEVER;
+}
+
+/* replaces the previous deadline of the event, SCHED_NEVER cancels it */
+void
+sched_post(sched *s, int id, uint64_t when)
+{
+	s->when[id] = when;
+	update_next(s);
+}
+
+/* returns an event that is due at now and removes it, or -1 */
+int
+sched_pop(sched *s, uint64_t now)
+{
+	int i;
+
+	if (now < s->next) {
+		return -1;
+	}
+
+	for (i = 0; i < SCHED_EVENTS; i++) {
+		if (s->when[i] <= now) {
+			s->when[i] = SCHED_NEVER;
+			update_next(s);
+			return i;
+		}
+	}
+
+	return -1;
+}
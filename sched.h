@@ -0,0 +1,33 @@
+#ifndef NES_SCHED_H
+#define NES_SCHED_H
+
+#include <stdint.h>
+
+/* NOTE: components that don't need to run every cycle post the CPU cycle
+ * they next need attention at, and the main loop only compares the
+ * current cycle with the earliest deadline. */
+
+#define SCHED_NEVER UINT64_MAX
+
+enum {
+	SCHED_APU, /* next APU frame IRQ */
+	SCHED_DMC, /* next DMC sample fetch */
+	SCHED_EVENTS
+};
+
+typedef struct {
+	uint64_t when[SCHED_EVENTS];
+	uint64_t next; /* earliest of when[] */
+} sched;
+
+void sched_reset(sched *);
+void sched_post(sched *, int, uint64_t);
+int sched_pop(sched *, uint64_t);
+
+static inline int
+sched_due(const sched *s, uint64_t now)
+{
+	return now >= s->next;
+}
+
+#endif /* NES_SCHED_H */
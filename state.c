@@ -0,0 +1,257 @@
+#include <stddef.h> /* offsetof */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h> /* memcpy, memcmp, memset */
+
+#include "hash.h"
+#include "state.h"
+
+static const uint8_t
+state_magic[4] = { 'F', 'A', 'M', 'S' };
+
+static const struct {
+	uint8_t id[4];
+	size_t offset; /* of the chunk header */
+	uint32_t size;
+} state_chunks[] = {
+	{ { 'C', 'P', 'U', ' ' }, offsetof(state, cpu_chunk), sizeof(r2A03) },
+	{ { 'P', 'P', 'U', ' ' }, offsetof(state, ppu_chunk), sizeof(r2C02) },
+	{ { 'A', 'P', 'U', ' ' }, offsetof(state, apu_chunk), sizeof(apu) },
+	{ { 'B', 'U', 'S', ' ' }, offsetof(state, bus_chunk), sizeof(((state *)0)->bus) },
+	{ { 'R', 'A', 'M', ' ' }, offsetof(state, ram_chunk), STATE_RAM_SIZE },
+	{ { 'M', 'A', 'P', 'R' }, offsetof(state, mapper_chunk), sizeof(((state *)0)->mapper) }
+};
+
+enum {
+	STATE_CHUNKS = sizeof(state_chunks) / sizeof(state_chunks[0])
+};
+
+static uint32_t
+prg_ram_len(const cartrige *c)
+{
+	if (c->prg_ram == NULL) {
+		return 0;
+	}
+	return c->prg_ram_len < STATE_PRG_RAM_SIZE ? c->prg_ram_len : STATE_PRG_RAM_SIZE;
+}
+
+static uint32_t
+chr_ram_len(const cartrige *c)
+{
+	if (c->chr_ram == NULL) {
+		return 0;
+	}
+	return c->chr_ram_len < STATE_CHR_RAM_SIZE ? c->chr_ram_len : STATE_CHR_RAM_SIZE;
+}
+
+static void
+state_stamp(state *s)
+{
+	state_chunk *chunk;
+	size_t i;
+
+	memcpy(s->magic, state_magic, sizeof(s->magic));
+	s->version = STATE_VERSION;
+	s->size = sizeof(state);
+	s->chunks = STATE_CHUNKS;
+
+	for (i = 0; i < STATE_CHUNKS; i++) {
+		chunk = (state_chunk *)((uint8_t *)s + state_chunks[i].offset);
+		memcpy(chunk->id, state_chunks[i].id, sizeof(chunk->id));
+		chunk->size = state_chunks[i].size;
+	}
+}
+
+/* the pages of a memory written after epoch 'since' */
+static void
+copy_pages(uint8_t *to, const uint8_t *from, uint32_t len, const uint32_t *pages, uint32_t since)
+{
+	uint32_t p, at;
+
+	for (p = 0, at = 0; at < len; p++, at += DIRTY_PAGE_SIZE) {
+		if (pages[p] > since) {
+			memcpy(to + at, from + at, len - at < DIRTY_PAGE_SIZE ? len - at : DIRTY_PAGE_SIZE);
+		}
+	}
+}
+
+/* NOTE: host pointers and colours differ between runs and are left out,
+ * a saved state only holds what the console itself determines. The same
+ * console state always gives the same bytes, state hashes rely on it.
+ * Memories are copied where they were written after 'since', 0 copies
+ * them all. */
+static void
+state_copy(state *s, const bus *b, uint32_t since)
+{
+	const uint32_t (*pages)[DIRTY_MAX_PAGES] = b->dirty.pages;
+	size_t vram_end = offsetof(r2C02, vram) + VRAM_SIZE;
+	int i;
+
+	state_stamp(s);
+
+	memcpy(&s->cpu, b->cpu, sizeof(s->cpu));
+	s->cpu.bus = NULL;
+
+	if (b->ppu != NULL) {
+		memcpy(&s->ppu, b->ppu, offsetof(r2C02, vram));
+		memcpy((uint8_t *)&s->ppu + vram_end, (const uint8_t *)b->ppu + vram_end,
+		       sizeof(s->ppu) - vram_end);
+		copy_pages(s->ppu.vram, b->ppu->vram, VRAM_SIZE, pages[DIRTY_VRAM], since);
+		s->ppu.bus = NULL;
+		s->ppu.frame_buf = NULL;
+		s->ppu.dirty = NULL;
+		s->ppu.colors = NULL;
+		memset(s->ppu.palette_cache, 0, sizeof(s->ppu.palette_cache));
+		memset(s->ppu.bg_line, 0, sizeof(s->ppu.bg_line)); /* scratch, skipped for undrawn frames */
+	}
+
+	memcpy(&s->apu, b->apu, sizeof(s->apu));
+	s->apu.bus = NULL;
+	for (i = 0; i < APU_MAX_EXPANSIONS; i++) {
+		s->apu.exp[i].ops = NULL;
+	}
+
+	s->bus.sched = b->sched;
+	memcpy(s->bus.pads, b->pads, sizeof(s->bus.pads));
+	s->bus.dma_oam_end = b->dma_oam_end;
+	copy_pages(s->ram, b->ram, STATE_RAM_SIZE, pages[DIRTY_RAM], since);
+	memcpy(s->mapper.banks, b->rom.banks, sizeof(s->mapper.banks));
+	copy_pages(s->mapper.prg_ram, b->rom.prg_ram, prg_ram_len(&b->rom), pages[DIRTY_PRG_RAM], since);
+	copy_pages(s->mapper.chr_ram, b->rom.chr_ram, chr_ram_len(&b->rom), pages[DIRTY_CHR_RAM], since);
+}
+
+void
+state_save(state *s, const bus *b)
+{
+	state_copy(s, b, 0);
+}
+
+/* NOTE: incremental save. s has to hold a state of this console made by
+ * state_save or by state_update returning 'since' (0 for a fresh one).
+ * Only the memory pages written after that are copied again. Returns
+ * the 'since' of the next update of s. */
+uint32_t
+state_update(state *s, bus *b, uint32_t since)
+{
+	state_copy(s, b, since);
+	return b->dirty.epoch++;
+}
+
+void
+state_load(bus *b, const state *s)
+{
+	uint32_t *frame_buf;
+	expansion exp[APU_MAX_EXPANSIONS];
+	int i;
+
+	memcpy(b->cpu, &s->cpu, sizeof(s->cpu));
+	b->cpu->bus = b;
+
+	if (b->ppu != NULL) {
+		frame_buf = b->ppu->frame_buf;
+		memcpy(b->ppu, &s->ppu, sizeof(s->ppu));
+		b->ppu->bus = b;
+		b->ppu->frame_buf = frame_buf;
+		b->ppu->dirty = &b->dirty;
+		ppu_refresh_colors(b->ppu);
+	}
+
+	/* NOTE: the chips on board come from the cartrige, not the state */
+	memcpy(exp, b->apu->exp, sizeof(exp));
+	memcpy(b->apu, &s->apu, sizeof(s->apu));
+	b->apu->bus = b;
+	for (i = 0; i < APU_MAX_EXPANSIONS; i++) {
+		b->apu->exp[i].ops = exp[i].ops;
+	}
+
+	b->sched = s->bus.sched;
+	memcpy(b->pads, s->bus.pads, sizeof(b->pads));
+	b->dma_oam_end = s->bus.dma_oam_end;
+	b->ppu_time = b->cpu->total; /* saved in step */
+	memcpy(b->ram, s->ram, STATE_RAM_SIZE);
+	memcpy(b->rom.banks, s->mapper.banks, sizeof(b->rom.banks));
+	if (prg_ram_len(&b->rom)) {
+		memcpy(b->rom.prg_ram, s->mapper.prg_ram, prg_ram_len(&b->rom));
+	}
+	if (chr_ram_len(&b->rom)) {
+		memcpy(b->rom.chr_ram, s->mapper.chr_ram, chr_ram_len(&b->rom));
+	}
+
+	/* NOTE: every memory may have changed, incremental saves start over */
+	dirty_all(&b->dirty);
+}
+
+/* states from another version or build with a different layout */
+int
+state_valid(const state *s)
+{
+	const state_chunk *chunk;
+	size_t i;
+
+	if (memcmp(s->magic, state_magic, sizeof(s->magic)) != 0 ||
+	    s->version != STATE_VERSION || s->size != sizeof(state) || s->chunks != STATE_CHUNKS) {
+		return 0;
+	}
+
+	for (i = 0; i < STATE_CHUNKS; i++) {
+		chunk = (const state_chunk *)((const uint8_t *)s + state_chunks[i].offset);
+		if (memcmp(chunk->id, state_chunks[i].id, sizeof(chunk->id)) != 0 ||
+		    chunk->size != state_chunks[i].size) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+uint64_t
+state_hash(const state *s)
+{
+	return hash64(s, sizeof(*s), 0);
+}
+
+/* Returns 0 on success. */
+int
+state_write(const state *s, const char *path)
+{
+	FILE *f;
+	size_t n;
+
+	f = fopen(path, "wb");
+	if (f == NULL) {
+		fprintf(stderr, "Can't create state %s.\n", path);
+		return -1;
+	}
+
+	n = fwrite(s, sizeof(*s), 1, f);
+	if (fclose(f) != 0 || n != 1) {
+		fprintf(stderr, "Can't write state %s.\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Returns 0 on success, s is garbage otherwise. */
+int
+state_read(state *s, const char *path)
+{
+	FILE *f;
+	size_t n;
+
+	f = fopen(path, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "Can't open state %s.\n", path);
+		return -1;
+	}
+
+	n = fread(s, sizeof(*s), 1, f);
+	fclose(f);
+
+	if (n != 1 || !state_valid(s)) {
+		fprintf(stderr, "%s is not a state of this version.\n", path);
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef NES_STATE_H
+#define NES_STATE_H
+
+#include <stdint.h>
+
+#include "bus.h"
+
+enum {
+	STATE_VERSION = 5,          /* bump on any change of the layout below */
+	STATE_RAM_SIZE = 0x800,     /* reads mirror $0000-$07FF */
+	STATE_PRG_RAM_SIZE = 0x8000,
+	STATE_CHR_RAM_SIZE = 0x2000
+};
+
+typedef struct {
+	uint8_t id[4];
+	uint32_t size; /* payload following the header */
+} state_chunk;
+
+/* NOTE: a save state is one contiguous block laid out exactly like the
+ * file, so saving and loading are a handful of memcpy. Every component is
+ * a chunk, the loader rejects chunks whose id or size doesn't match this
+ * build. Pointers are copied along but never trusted, state_load takes
+ * them from the console it loads into. The frame buffer belongs to the
+ * frontend and is left out.
+ * TODO: host byte order, states don't move between architectures */
+typedef struct {
+	uint8_t magic[4];
+	uint32_t version;
+	uint32_t size; /* of the whole block */
+	uint32_t chunks;
+
+	state_chunk cpu_chunk;
+	r2A03 cpu;
+	state_chunk ppu_chunk;
+	r2C02 ppu;
+	state_chunk apu_chunk;
+	apu apu;
+	state_chunk bus_chunk;
+	struct {
+		sched sched;
+		pad pads[2];
+		uint64_t dma_oam_end;
+	} bus;
+	state_chunk ram_chunk;
+	uint8_t ram[STATE_RAM_SIZE];
+	state_chunk mapper_chunk;
+	struct {
+		uint8_t banks[8];
+		uint8_t prg_ram[STATE_PRG_RAM_SIZE];
+		uint8_t chr_ram[STATE_CHR_RAM_SIZE];
+	} mapper;
+} state;
+
+void state_save(state *, const bus *);
+uint32_t state_update(state *, bus *, uint32_t);
+void state_load(bus *, const state *);
+int state_valid(const state *);
+uint64_t state_hash(const state *);
+int state_write(const state *, const char *);
+int state_read(state *, const char *);
+
+#endif /* NES_STATE_H */
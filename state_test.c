@@ -0,0 +1,156 @@
+#define _POSIX_C_SOURCE 200809L /* mkstemp */
+
+#include <criterion/criterion.h>
+#include <criterion/new/assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bus.h"
+#include "state.h"
+
+/* NOTE: runs the real bus, PPU and cartrige, which the other tests mock,
+ * so it is a program of its own (see the Makefile). */
+
+enum {
+	FRAMES = 120,
+	SAVE_AT = 30,
+	LOAD_AT = 80
+};
+
+/* Three times a frame, with round counter C: C to RAM page 2 + C % 4,
+ * PRG-RAM page $60 + C / 8, nametable page $20 + C / 8 % 16 and CHR-RAM
+ * page C / 8, all at offset C. Most pages stay clean from one frame to
+ * the next. */
+static const uint8_t
+program[] = {
+	0x78,             /* SEI */
+	0xD8,             /* CLD */
+	0xA2, 0xFF,       /* LDX #$FF */
+	0x9A,             /* TXS */
+	0xA9, 0x00,       /* LDA #$00 */
+	0x8D, 0x00, 0x20, /* STA $2000 */
+	0x8D, 0x01, 0x20, /* STA $2001 */
+	0x85, 0x10,       /* STA $10 */
+	/* $C00F loop: */
+	0xE6, 0x10,       /* INC $10 */
+	0xA5, 0x10,       /* LDA $10 */
+	0x85, 0x00,       /* STA $00 */
+	0x29, 0x03,       /* AND #$03 */
+	0x18,             /* CLC */
+	0x69, 0x02,       /* ADC #$02 */
+	0x85, 0x01,       /* STA $01 */
+	0xA0, 0x00,       /* LDY #$00 */
+	0xA5, 0x10,       /* LDA $10 */
+	0x91, 0x00,       /* STA ($00),Y RAM */
+	0x4A, 0x4A, 0x4A, /* LSR LSR LSR */
+	0x29, 0x1F,       /* AND #$1F */
+	0x09, 0x60,       /* ORA #$60 */
+	0x85, 0x01,       /* STA $01 */
+	0xA5, 0x10,       /* LDA $10 */
+	0x91, 0x00,       /* STA ($00),Y PRG-RAM */
+	0x4A, 0x4A, 0x4A, /* LSR LSR LSR */
+	0x29, 0x0F,       /* AND #$0F */
+	0x09, 0x20,       /* ORA #$20 */
+	0x8D, 0x06, 0x20, /* STA $2006 */
+	0xA5, 0x10,       /* LDA $10 */
+	0x8D, 0x06, 0x20, /* STA $2006 */
+	0x8D, 0x07, 0x20, /* STA $2007 nametable */
+	0x4A, 0x4A, 0x4A, /* LSR LSR LSR */
+	0x29, 0x1F,       /* AND #$1F */
+	0x8D, 0x06, 0x20, /* STA $2006 */
+	0xA5, 0x10,       /* LDA $10 */
+	0x8D, 0x06, 0x20, /* STA $2006 */
+	0x8D, 0x07, 0x20, /* STA $2007 CHR-RAM */
+	0xA2, 0x08,       /* LDX #$08 */
+	0xA0, 0x00,       /* d1: LDY #$00 */
+	0x88,             /* d2: DEY */
+	0xD0, 0xFD,       /* BNE d2 */
+	0xCA,             /* DEX */
+	0xD0, 0xF8,       /* BNE d1 */
+	0x4C, 0x0F, 0xC0  /* JMP loop */
+};
+
+/* NROM, 16 KB PRG, 8 KB PRG-RAM, CHR-RAM */
+static void
+write_rom(char *path)
+{
+	static uint8_t prg[0x4000];
+	static const uint8_t header[16] = { 'N', 'E', 'S', 0x1A, 1, 0, 0, 0, 1 };
+	FILE *f;
+	int fd;
+
+	memcpy(prg, program, sizeof(program));
+	prg[0x3FFC] = 0x00; /* reset vector, $C000 */
+	prg[0x3FFD] = 0xC0;
+
+	fd = mkstemp(path);
+	cr_assert(ge(int, fd, 0));
+	f = fdopen(fd, "wb");
+	cr_assert(f != NULL);
+	fwrite(header, 1, sizeof(header), f);
+	fwrite(prg, 1, sizeof(prg), f);
+	fclose(f);
+}
+
+static void
+run_frame(bus *b)
+{
+	while (!bus_ppu_get_frame_ready_flag(b)) {
+		if (sched_due(&b->sched, b->cpu->total)) {
+			bus_sched_run(b);
+		}
+		bus_cpu_tick(b);
+		bus_ppu_run_until(b, b->cpu->total);
+	}
+	bus_ppu_unset_frame_ready_flag(b);
+}
+
+/* state_update of a kept state against a full state_save, every frame,
+ * before and after loading an older state */
+Test(state, update_matches_save)
+{
+	static r2A03 cpu;
+	static r2C02 ppu;
+	static apu apu;
+	static uint8_t ram[RAM_SIZE];
+	static bus b;
+	static state full, inc, saved;
+	char path[] = "/tmp/state_test_XXXXXX";
+	cartrige rom;
+	uint32_t since = 0;
+	int f;
+
+	write_rom(path);
+	rom = cartrige_create(path);
+	unlink(path);
+	cr_assert(eq(int, rom.invalid, 0));
+	cr_assert(rom.prg_ram != NULL && rom.chr_ram != NULL);
+
+	bus_init(&b, &cpu, &ppu, &apu, ram, rom);
+	bus_ram_reset(&b);
+	bus_cpu_reset(&b);
+	bus_ppu_reset(&b);
+	bus_apu_reset(&b);
+
+	for (f = 0; f < FRAMES; f++) {
+		run_frame(&b);
+
+		since = state_update(&inc, &b, since);
+		state_save(&full, &b);
+		cr_assert(eq(int, memcmp(&inc, &full, sizeof(full)), 0), "frame %d differs", f);
+
+		if (f == SAVE_AT) {
+			saved = full;
+		} else if (f == LOAD_AT) {
+			state_load(&b, &saved);
+		}
+	}
+
+	/* the program got around every region */
+	cr_assert(ne(int, full.ram[0x0200 + 0x10], 0));
+	cr_assert(ne(int, full.mapper.chr_ram[0x1000 + 0x80], 0));
+
+	cartrige_free(&b.rom);
+}
@@ -0,0 +1,146 @@
+#define _POSIX_C_SOURCE 199309L /* nanosleep */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "wav.h"
+
+/* See: http://soundfile.sapp.org/doc/WaveFormat/ */
+
+enum {
+	WAV_HEADER_SIZE = 44,
+	WAV_CHUNK = 4096,          /* samples the writer moves per fwrite */
+	WAV_FILE_BUFFER = 1 << 16
+};
+
+static void
+put16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t)(v & 0xFF);
+	p[1] = (uint8_t)(v >> 8);
+}
+
+static void
+put32(uint8_t *p, uint32_t v)
+{
+	put16(p, (uint16_t)(v & 0xFFFF));
+	put16(p + 2, (uint16_t)(v >> 16));
+}
+
+/* sizes are zero until wav_close knows them */
+static int
+write_header(wav_writer *w)
+{
+	uint8_t h[WAV_HEADER_SIZE] = "RIFF\0\0\0\0WAVEfmt ";
+	uint32_t data = w->samples * 2;
+
+	put32(h + 4, 36 + data);
+	put32(h + 16, 16);                   /* fmt chunk size */
+	put16(h + 20, 1);                    /* PCM */
+	put16(h + 22, 1);                    /* mono */
+	put32(h + 24, (uint32_t)w->rate);
+	put32(h + 28, (uint32_t)w->rate * 2); /* byte rate */
+	put16(h + 32, 2);                    /* block align */
+	put16(h + 34, 16);                   /* bits per sample */
+	h[36] = 'd'; h[37] = 'a'; h[38] = 't'; h[39] = 'a';
+	put32(h + 40, data);
+
+	return fwrite(h, 1, sizeof(h), w->f) == sizeof(h) ? 0 : -1;
+}
+
+static void
+nap(void)
+{
+	struct timespec ts = { 0, 1000000 }; /* 1 ms */
+
+	nanosleep(&ts, NULL);
+}
+
+/* NOTE: samples are written in host byte order, which is what WAV wants
+ * on every little-endian machine we build for */
+static void *
+writer(void *arg)
+{
+	wav_writer *w = arg;
+	int16_t chunk[WAV_CHUNK];
+	size_t n;
+
+	for (;;) {
+		n = ring_read(&w->ring, chunk, WAV_CHUNK);
+
+		if (n > 0) {
+			fwrite(chunk, sizeof(chunk[0]), n, w->f);
+			continue;
+		}
+
+		/* NOTE: done is set after the last samples went in */
+		if (atomic_load(&w->done) && ring_count(&w->ring) == 0) {
+			break;
+		}
+
+		nap();
+	}
+
+	return NULL;
+}
+
+int
+wav_open(wav_writer *w, const char *path, int rate)
+{
+	w->f = fopen(path, "wb");
+	if (w->f == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	setvbuf(w->f, NULL, _IOFBF, WAV_FILE_BUFFER);
+
+	w->rate = rate;
+	w->samples = 0;
+	ring_init(&w->ring, w->ring_buf, WAV_RING_SIZE);
+	atomic_init(&w->done, 0);
+
+	if (write_header(w) != 0 || pthread_create(&w->thread, NULL, writer, w) != 0) {
+		fclose(w->f);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* never drops samples: waits for the writer when the ring is full */
+void
+wav_write(wav_writer *w, const int16_t *samples, int count)
+{
+	size_t n;
+
+	w->samples += (uint32_t)count;
+
+	while (count > 0) {
+		n = ring_write(&w->ring, samples, (size_t)count);
+		samples += n;
+		count -= (int)n;
+
+		if (count > 0) {
+			nap();
+		}
+	}
+}
+
+int
+wav_close(wav_writer *w)
+{
+	int res;
+
+	atomic_store(&w->done, 1);
+	pthread_join(w->thread, NULL);
+
+	res = fseek(w->f, 0, SEEK_SET) == 0 ? write_header(w) : -1;
+	res |= ferror(w->f) ? -1 : 0;
+	res |= fclose(w->f);
+
+	return res;
+}
@@ -0,0 +1,30 @@
+#ifndef NES_WAV_H
+#define NES_WAV_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ring.h"
+
+/* 16-bit mono WAV file written by a thread of its own. The emulation only
+ * copies samples into the ring, the writer thread does the file I/O. */
+
+enum { WAV_RING_SIZE = 1 << 16 };
+
+typedef struct {
+	FILE *f;
+	int rate;
+	uint32_t samples;
+	ring ring;
+	int16_t ring_buf[WAV_RING_SIZE];
+	pthread_t thread;
+	atomic_int done;
+} wav_writer;
+
+int wav_open(wav_writer *, const char *, int);
+void wav_write(wav_writer *, const int16_t *, int);
+int wav_close(wav_writer *);
+
+#endif /* NES_WAV_H */